@@ -201,21 +201,24 @@ local function block_comment(comment, line1, col1, line2, col2)
   end
 end
 
-local function insert_paste(doc, value, whole_line, idx)
+-- edit pasting the values one after the other into a selection, for
+-- Doc:edit_selections
+local function paste_edit(doc, values, whole_line, idx, line1, col1, line2, col2)
+  local texts = {}
+  for i, value in ipairs(values) do
+    texts[i] = value:gsub("\r", "") .. (whole_line and "\n" or "")
+  end
+  local text = table.concat(texts)
   if whole_line then
-    local line1, col1 = doc:get_selection_idx(idx)
-    doc:insert(line1, 1, value:gsub("\r", "").."\n")
+    local line, col = doc:get_selection_idx(idx)
     -- Because we're inserting at the start of the line,
     -- if the cursor is in the middle of the line
     -- it gets carried to the next line along with the old text.
     -- If it's at the start of the line it doesn't get carried,
-    -- so we move it of as many characters as we're adding.
-    if col1 == 1 then
-      doc:move_to_cursor(idx, #value+1)
-    end
-  else
-    doc:text_input(value:gsub("\r", ""), idx)
+    -- so we move it after the text we're adding.
+    return line, 1, line, 1, text, col == 1 and "end" or nil
   end
+  return line1, col1, line2, col2, text, "end"
 end
 
 local commands = {
@@ -249,9 +252,9 @@ local commands = {
     if core.cursor_clipboard["full"] ~= clipboard then
       core.cursor_clipboard = {}
       core.cursor_clipboard_whole_line = {}
-      for idx in dv.doc:get_selections() do
-        insert_paste(dv.doc, clipboard, false, idx)
-      end
+      dv.doc:edit_selections(function(idx, line1, col1, line2, col2)
+        return paste_edit(dv.doc, { clipboard }, false, idx, line1, col1, line2, col2)
+      end)
       return
     end
     -- Use internal clipboard(s)
@@ -266,21 +269,31 @@ local commands = {
     if #core.cursor_clipboard_whole_line == (#dv.doc.selections/4) then
     -- If we have the same number of clipboards and selections,
     -- paste each clipboard into its corresponding selection
-      for idx in dv.doc:get_selections() do
-        insert_paste(dv.doc, core.cursor_clipboard[idx], only_whole_lines, idx)
-      end
+      dv.doc:edit_selections(function(idx, line1, col1, line2, col2)
+        local values = { core.cursor_clipboard[idx] }
+        return paste_edit(dv.doc, values, only_whole_lines, idx, line1, col1, line2, col2)
+      end)
     else
       -- Paste every clipboard and add a selection at the end of each one
+      local values, ends, total = {}, {}, 0
+      for cb_idx in ipairs(core.cursor_clipboard_whole_line) do
+        values[cb_idx] = core.cursor_clipboard[cb_idx]
+        total = total + #(values[cb_idx]:gsub("\r", ""))
+        ends[cb_idx] = total
+      end
+      dv.doc:edit_selections(function(idx, line1, col1, line2, col2)
+        return paste_edit(dv.doc, values, only_whole_lines, idx, line1, col1, line2, col2)
+      end)
       local new_selections = {}
-      for idx in dv.doc:get_selections() do
-        for cb_idx in ipairs(core.cursor_clipboard_whole_line) do
-          insert_paste(dv.doc, core.cursor_clipboard[cb_idx], only_whole_lines, idx)
-          if not only_whole_lines then
-            table.insert(new_selections, {dv.doc:get_selection_idx(idx)})
-          end
-        end
+      for _, line, col, line2, col2 in dv.doc:get_selections() do
         if only_whole_lines then
-          table.insert(new_selections, {dv.doc:get_selection_idx(idx)})
+          table.insert(new_selections, { line, col, line2, col2 })
+        else
+          -- the cursors are after the last clipboard
+          for _, offset in ipairs(ends) do
+            local l, c = dv.doc:position_offset(line, col, offset - total)
+            table.insert(new_selections, { l, c })
+          end
         end
       end
       local first = true
@@ -296,17 +309,18 @@ local commands = {
   end,
 
   ["doc:newline"] = function(dv)
-    for idx, line, col in dv.doc:get_selections(false, true) do
-      local indent = dv.doc.lines[line]:match("^[\t ]*")
-      if col <= #indent then
-        indent = indent:sub(#indent + 2 - col)
+    dv.doc:edit_selections(function(_, line1, col1, line2, col2)
+      local indent = dv.doc.lines[line1]:match("^[\t ]*")
+      if col1 <= #indent then
+        indent = indent:sub(#indent + 2 - col1)
       end
       -- Remove current line if it contains only whitespace
-      if not config.keep_newline_whitespace and dv.doc.lines[line]:match("^%s+$") then
-        dv.doc:remove(line, 1, line, math.huge)
+      if not config.keep_newline_whitespace and dv.doc.lines[line1]:match("^%s+$") then
+        col1 = 1
+        if line2 == line1 then col2 = #dv.doc.lines[line1] end
       end
-      dv.doc:text_input("\n" .. indent, idx)
-    end
+      return line1, col1, line2, col2, "\n" .. indent, "end"
+    end)
   end,
 
   ["doc:newline-below"] = function(dv)
@@ -326,26 +340,31 @@ local commands = {
   end,
 
   ["doc:delete"] = function(dv)
-    for idx, line1, col1, line2, col2 in dv.doc:get_selections(true, true) do
-      if line1 == line2 and col1 == col2 and dv.doc.lines[line1]:find("^%s*$", col1) then
-        dv.doc:remove(line1, col1, line1, math.huge)
+    dv.doc:edit_selections(function(_, line1, col1, line2, col2)
+      if line1 == line2 and col1 == col2 then
+        -- trailing whitespace is deleted along with the newline
+        if dv.doc.lines[line1]:find("^%s*$", col1) then
+          col2 = #dv.doc.lines[line1]
+        end
+        line2, col2 = translate.next_char(dv.doc, line2, col2)
       end
-      dv.doc:delete_to_cursor(idx, translate.next_char)
-    end
+      return line1, col1, line2, col2, "", "start"
+    end)
   end,
 
   ["doc:backspace"] = function(dv)
     local _, indent_size = dv.doc:get_indent_info()
-    for idx, line1, col1, line2, col2 in dv.doc:get_selections(true, true) do
+    dv.doc:edit_selections(function(_, line1, col1, line2, col2)
       if line1 == line2 and col1 == col2 then
         local text = dv.doc:get_text(line1, 1, line1, col1)
         if #text >= indent_size and text:find("^ *$") then
-          dv.doc:delete_to_cursor(idx, 0, -indent_size)
-          return
+          line1, col1 = dv.doc:position_offset(line1, col1, 0, -indent_size)
+        else
+          line1, col1 = translate.previous_char(dv.doc, line1, col1)
         end
       end
-      dv.doc:delete_to_cursor(idx, translate.previous_char)
-    end
+      return line1, col1, line2, col2, "", "start"
+    end)
   end,
 
   ["doc:select-all"] = function(dv)
@@ -163,7 +163,26 @@ local function is_in_any_selection(line, col)
   return false
 end
 
+local function select_add_all()
+  local l1, c1, l2, c2 = doc():get_selection(true)
+  local text = doc():get_text(l1, c1, l2, c2)
+  local matches = search.find_all(doc(), text)
+  if #matches == 0 then return end
+  -- the cursor of each match at its end, the last one being the match before
+  -- the current selection, as if they were added one after the other
+  local selections, last = {}, #matches / 4
+  for i = 1, #matches, 4 do
+    table.move({ matches[i + 2], matches[i + 3], matches[i], matches[i + 1] }, 1, 4, i, selections)
+    if matches[i] == l1 and matches[i + 1] == c1 and i > 1 then
+      last = (i - 1) / 4
+    end
+  end
+  doc().selections = selections
+  doc().last_selection = last
+end
+
 local function select_add_next(all)
+  if all then return select_add_all() end
   local il1, ic1 = doc():get_selection(true)
   for idx, l1, c1, l2, c2 in doc():get_selections(true, true) do
     local text = doc():get_text(l1, c1, l2, c2)
@@ -14,6 +14,13 @@ function SingleLineDoc:insert(line, col, text)
   SingleLineDoc.super.insert(self, line, col, text:gsub("\n", ""))
 end
 
+function SingleLineDoc:raw_apply_edits(edits, undo_stack, time)
+  for _, edit in ipairs(edits) do
+    edit[5] = edit[5]:gsub("\n", "")
+  end
+  SingleLineDoc.super.raw_apply_edits(self, edits, undo_stack, time)
+end
+
 ---@class core.commandview : core.docview
 ---@field super core.docview
 local CommandView = DocView:extend()
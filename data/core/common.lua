@@ -162,32 +162,29 @@ function common.path_suggest(text, root)
      (PATHSEP ~= "\\" and path:sub(-1) ~= PATHSEP) then
     path = path .. PATHSEP
   end
-  local files = system.list_dir(path) or {}
+  local files = system.list_dir_info(path, true) or { names = {}, types = {} }
   local res = {}
-  for _, file in ipairs(files) do
+  for i, file in ipairs(files.names) do
     file = path .. file
-    local info = system.get_file_info(file)
-    if info then
-      if info.type == "dir" then
-        file = file .. PATHSEP
-      end
-      if root then
-        -- remove root part from file path
-        local s, e = file:find(root, nil, true)
-        if s == 1 then
-          file = file:sub(e + 1)
-        end
-      elseif clean_dotslash then
-        -- remove added dot slash
-        local s, e = file:find("." .. PATHSEP, nil, true)
-        if s == 1 then
-          file = file:sub(e + 1)
-        end
+    if files.types[i] == "dir" then
+      file = file .. PATHSEP
+    end
+    if root then
+      -- remove root part from file path
+      local s, e = file:find(root, nil, true)
+      if s == 1 then
+        file = file:sub(e + 1)
       end
-      if file:lower():find(text:lower(), nil, true) == 1 then
-        table.insert(res, file)
+    elseif clean_dotslash then
+      -- remove added dot slash
+      local s, e = file:find("." .. PATHSEP, nil, true)
+      if s == 1 then
+        file = file:sub(e + 1)
       end
     end
+    if file:lower():find(text:lower(), nil, true) == 1 then
+      table.insert(res, file)
+    end
   end
   return res
 end
@@ -195,12 +192,11 @@ end
 
 function common.dir_path_suggest(text)
   local path, name = text:match("^(.-)([^/\\]*)$")
-  local files = system.list_dir(path == "" and "." or path) or {}
+  local files = system.list_dir_info(path == "" and "." or path, true) or { names = {}, types = {} }
   local res = {}
-  for _, file in ipairs(files) do
+  for i, file in ipairs(files.names) do
     file = path .. file
-    local info = system.get_file_info(file)
-    if info and info.type == "dir" and file:lower():find(text:lower(), nil, true) == 1 then
+    if files.types[i] == "dir" and file:lower():find(text:lower(), nil, true) == 1 then
       table.insert(res, file)
     end
   end
@@ -3,6 +3,14 @@ local common = require "core.common"
 local config = {}
 
 config.fps = 60
+-- number of threads used to redraw the window, 0 picks it from the CPU count
+config.render_threads = 0
+-- memory in MB used to keep rasterized glyphs around
+config.glyph_cache_size = 16
+-- show the time spent in Lua and by the renderer on every frame
+config.show_render_stats = false
+-- tokenize syntax highlighting on a background thread when possible
+config.threaded_highlighting = true
 config.max_log_items = 800
 config.message_timeout = 5
 config.mouse_wheel_scroll = 50 * SCALE
@@ -11,6 +19,9 @@ config.scroll_past_end = true
 ---@type "expanded" | "contracted" | false @Force the scrollbar status of the DocView
 config.force_scrollbar_status = false
 config.file_size_limit = 10
+-- files bigger than this, in MB, are kept in a native text buffer instead of
+-- a table of lines
+config.text_buffer_threshold = 4
 config.ignore_files = {
   -- folders
   "^%.svn/",        "^%.git/",   "^%.hg/",        "^CVS/", "^%.Trash/", "^%.Trash%-.*/",
@@ -25,6 +36,9 @@ config.symbol_pattern = "[%a_][%w_]*"
 config.non_word_chars = " \t\n/\\()\"':,.;<>~!@#$%^&*|+=[]{}`?-"
 config.undo_merge_timeout = 0.3
 config.max_undos = 10000
+-- memory used by the undo history of a document, in MB, before its oldest part
+-- is moved to a temporary file
+config.undo_memory_limit = 64
 config.max_tabs = 8
 config.always_show_tabs = true
 -- Possible values: false, true, "no_selection"
@@ -35,6 +49,13 @@ config.tab_type = "soft"
 config.keep_newline_whitespace = false
 config.line_limit = 80
 config.max_project_files = 2000
+-- keep the file list of project directories under USERDIR, so that it's shown
+-- right away when they're opened again and then checked in the background
+config.project_index = true
+-- changes of the project files told by the system are merged for this time, in
+-- seconds, and at most this many are applied at once
+config.dirmonitor_delay = 0.1
+config.dirmonitor_max_changes = 500
 config.transitions = true
 config.disabled_transitions = {
   scroll = false,
@@ -89,21 +89,43 @@ function dirwatch:unwatch(directory)
 end
 
 -- designed to be run inside a coroutine.
+-- "change_callback" is called with the directory that changed and, when the
+-- backend tells it, the name of the changed entry and the kind of change:
+-- "create", "delete" or "modify". Otherwise the whole directory should be
+-- checked again.
 function dirwatch:check(change_callback, scan_time, wait_time)
   local had_change = false
-  self.monitor:check(function(id)
+  local overflow = false
+  self.monitor:check(function(id, name, kind)
     had_change = true
-    if self.monitor:mode() == "single" then
-      local path = common.dirname(id)
+    if kind == "overflow" then
+      overflow = true
+    elseif self.monitor:mode() == "single" then
       if not string.match(id, "^/") and not string.match(id, "^%a:[/\\]") then
-        path = common.dirname(self.single_watch_top .. PATHSEP .. id)
+        id = self.single_watch_top .. PATHSEP .. id
+      end
+      if kind then
+        change_callback(common.dirname(id), common.basename(id), kind)
+      else
+        change_callback(common.dirname(id))
       end
-      change_callback(path)
     elseif self.reverse_watched[id] then
-      change_callback(self.reverse_watched[id])
+      change_callback(self.reverse_watched[id], name, kind)
     end
-  end)
+  end, config.dirmonitor_delay, config.dirmonitor_max_changes)
   local start_time = system.get_time()
+  if overflow then
+    -- changes were lost, every watched directory is checked again
+    local directories = {}
+    for directory in pairs(self.watched) do table.insert(directories, directory) end
+    for _, directory in ipairs(directories) do
+      if self.watched[directory] then change_callback(directory) end
+      if system.get_time() - start_time > (scan_time or 0.01) then
+        coroutine.yield(wait_time or 0.01)
+        start_time = system.get_time()
+      end
+    end
+  end
   for directory, old_modified in pairs(self.scanned) do
     if old_modified then
       local info = system.get_file_info(directory)
@@ -165,72 +187,81 @@ local function fileinfo_pass_filter(info, ignore_compiled)
 end
 
 
-local function compare_file(a, b)
-  return system.path_compare(a.filename, a.type, b.filename, b.type)
-end
-
-
--- compute a file's info entry completed with "filename" to be used
--- in project scan or falsy if it shouldn't appear in the list.
-local function get_project_file_info(root, file, ignore_compiled)
-  local info = system.get_file_info(root .. PATHSEP .. file)
+-- Gets the file "item" of "filename", a path within "root" like for
+-- get_directory_files, or nil if it doesn't exist or would be left out of
+-- the list.
+function dirwatch.get_file_info(root, filename)
+  local info = system.get_file_info(root .. PATHSEP .. filename)
   -- info can be not nil but info.type may be nil if is neither a file neither
   -- a directory, for example for /dev/* entries on linux.
   if info and info.type then
-    info.filename = file
-    return fileinfo_pass_filter(info, ignore_compiled) and info
+    info.filename = filename
+    return fileinfo_pass_filter(info, compile_ignore_files()) and info or nil
   end
 end
 
 
--- "root" will by an absolute path without trailing '/'
--- "path" will be a path starting without '/' and without trailing '/'
---    or the empty string.
---    It will identifies a sub-path within "root.
--- The current path location will therefore always be: root .. path.
--- When recursing "root" will always be the same, only "path" will change.
--- Returns a list of file "items". In each item the "filename" will be the
--- complete file path relative to "root" *without* the trailing '/', and without the starting '/'.
-function dirwatch.get_directory_files(dir, root, path, t, entries_count, recurse_pred)
-  local t0 = system.get_time()
-  local t_elapsed = system.get_time() - t0
-  local dirs, files = {}, {}
-  local ignore_compiled = compile_ignore_files()
+local function scan_directory(root, path, ignore_compiled, recursive, max_files, max_time)
+  return system.scan_directory(root, path, {
+    ignore = ignore_compiled,
+    size_limit = config.file_size_limit * 1e6,
+    recursive = recursive,
+    max_files = max_files,
+    max_time = max_time
+  })
+end
 
 
-  local all = system.list_dir(root .. PATHSEP .. path)
-  if not all then return nil end
+-- Lists the directory "path" within "root", an absolute path without trailing
+-- '/', as a sorted list of file "items" like for get_directory_files.
+-- If "recursive" is true, its subdirectories are listed too, on native
+-- threads, until "max_files" entries are found or "max_time" seconds are spent.
+-- Returns the list, whether every subdirectory was listed and the amount of
+-- entries, or nil if the directory can't be listed.
+function dirwatch.scan_directory(root, path, recursive, max_files, max_time)
+  return scan_directory(root, path, compile_ignore_files(), recursive, max_files, max_time)
+end
 
-  for _, file in ipairs(all or {}) do
-    local info = get_project_file_info(root, (path ~= "" and (path .. PATHSEP) or "") .. file, ignore_compiled)
-    if info then
-      table.insert(info.type == "dir" and dirs or files, info)
-      entries_count = entries_count + 1
-    end
-  end
+
+local function get_directory_files(dir, root, path, t, entries_count, recurse_pred, ignore_compiled)
+  local t0 = system.get_time()
+  local all = scan_directory(root, path, ignore_compiled)
+  if not all then return nil end
+  entries_count = entries_count + #all
 
   local recurse_complete = true
-  table.sort(dirs, compare_file)
-  for _, f in ipairs(dirs) do
+  for _, f in ipairs(all) do
     table.insert(t, f)
-    if recurse_pred(dir, f.filename, entries_count, t_elapsed) then
-      local _, complete, n = dirwatch.get_directory_files(dir, root, f.filename, t, entries_count, recurse_pred)
-      recurse_complete = recurse_complete and complete
-      if n ~= nil then
-        entries_count = n
+    if f.type == "dir" then
+      if recurse_pred(dir, f.filename, entries_count, system.get_time() - t0) then
+        local _, complete, n = get_directory_files(dir, root, f.filename, t, entries_count, recurse_pred, ignore_compiled)
+        recurse_complete = recurse_complete and complete
+        if n ~= nil then
+          entries_count = n
+        end
+      else
+        recurse_complete = false
       end
-    else
-      recurse_complete = false
     end
   end
 
-  table.sort(files, compare_file)
-  for _, f in ipairs(files) do
-    table.insert(t, f)
-  end
-
   return t, recurse_complete, entries_count
 end
 
 
+-- "root" will by an absolute path without trailing '/'
+-- "path" will be a path starting without '/' and without trailing '/'
+--    or the empty string.
+--    It will identifies a sub-path within "root.
+-- The current path location will therefore always be: root .. path.
+-- When recursing "root" will always be the same, only "path" will change.
+-- Returns a list of file "items". In each item the "filename" will be the
+-- complete file path relative to "root" *without* the trailing '/', and without the starting '/'.
+-- Each directory is listed natively, "recurse_pred" tells which subdirectories
+-- to list, see dirwatch.scan_directory to list them all at once.
+function dirwatch.get_directory_files(dir, root, path, t, entries_count, recurse_pred)
+  return get_directory_files(dir, root, path, t, entries_count, recurse_pred, compile_ignore_files())
+end
+
+
 return dirwatch
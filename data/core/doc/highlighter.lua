@@ -7,6 +7,9 @@ local Object = require "core.object"
 
 local Highlighter = Object:extend()
 
+-- lines sent at once to the background tokenizer
+local BACKGROUND_LINES = 500
+
 
 function Highlighter:new(doc)
   self.doc = doc
@@ -14,42 +17,164 @@ function Highlighter:new(doc)
   self:reset()
 end
 
+-- Past the edited lines, the cached lines are still valid as soon as the state
+-- at the end of a line matches the init state of the next one. States are
+-- short strings, interned by Lua, so comparing them is cheap.
+local function converged(self, i)
+  if i < self.dirty_line or i >= self.tokenized_line then return false end
+  local next_line = self.lines[i + 1]
+  return next_line and not next_line.resume and next_line.init_state == self.lines[i].state
+end
+
+
+local function set_first_invalid_line(self, idx)
+  self.first_invalid_line = idx
+  self.tokenized_line = math.max(self.tokenized_line, idx - 1)
+end
+
+
+local function skip_valid_lines(self)
+  set_first_invalid_line(self, self.tokenized_line + 1)
+  self.dirty_line = 0
+end
+
+
+local function tokenize_step(self)
+  local max = math.min(self.first_invalid_line + 40, self.max_wanted_line)
+  local retokenized_from
+  for i = self.first_invalid_line, max do
+    local state = (i > 1) and self.lines[i - 1].state
+    local line = self.lines[i]
+    if line and line.resume and (line.init_state ~= state or line.text ~= self.doc.lines[i]) then
+      -- Reset the progress if no longer valid
+      line.resume = nil
+    end
+    if not (line and line.init_state == state and line.text == self.doc.lines[i] and not line.resume) then
+      retokenized_from = retokenized_from or i
+      self.lines[i] = self:tokenize_line(i, state, line and line.resume)
+      if self.lines[i].resume then
+        set_first_invalid_line(self, i)
+        goto yield
+      end
+    elseif retokenized_from then
+      self:update_notify(retokenized_from, i - retokenized_from - 1)
+      retokenized_from = nil
+    end
+    if converged(self, i) then
+      max = i
+      skip_valid_lines(self)
+      goto yield
+    end
+  end
+
+  set_first_invalid_line(self, max + 1)
+  ::yield::
+  if retokenized_from then
+    self:update_notify(retokenized_from, max - retokenized_from)
+  end
+end
+
+
+local function cancel_job(self)
+  if self.job then
+    self.job.native:cancel()
+    self.job = nil
+  end
+end
+
+
+local function apply_job(self, job, tokens, states)
+  local retokenized_from
+  for n = 1, job.last - job.first + 1 do
+    local i = job.first + n - 1
+    local state = n > 1 and states[n - 1] or job.state
+    local line = self.lines[i]
+    if not (line and line.init_state == state and line.text == self.doc.lines[i] and not line.resume) then
+      retokenized_from = retokenized_from or i
+      self.lines[i] = {
+        init_state = state,
+        text = self.doc.lines[i],
+        tokens = tokens[n],
+        state = states[n]
+      }
+    elseif retokenized_from then
+      self:update_notify(retokenized_from, i - retokenized_from - 1)
+      retokenized_from = nil
+    end
+    if converged(self, i) then
+      if retokenized_from then
+        self:update_notify(retokenized_from, i - retokenized_from)
+      end
+      skip_valid_lines(self)
+      return
+    end
+  end
+  set_first_invalid_line(self, job.last + 1)
+  if retokenized_from then
+    self:update_notify(retokenized_from, job.last - retokenized_from)
+  end
+end
+
+
+-- Hands the next lines to the native tokenizer thread and applies its results
+-- once they're ready. Returns false when the lines have to be tokenized here.
+local function background_step(self)
+  local job = self.job
+  if not job then
+    local first = self.first_invalid_line
+    -- the edited lines usually converge right away, no need for the thread
+    if first <= self.dirty_line then return false end
+    local prev = first > 1 and self.lines[first - 1]
+    if first > 1 and not prev then return false end
+    local last = math.min(first + BACKGROUND_LINES - 1, self.max_wanted_line, #self.doc.lines)
+    local state = prev and prev.state
+    local native = tokenizer.tokenize_lines(self.doc.syntax, self.doc.lines, first, last, state)
+    if not native then return false end
+    self.job = {
+      native = native,
+      first = first,
+      last = last,
+      state = state,
+      syntax = self.doc.syntax,
+      change_id = self.change_id
+    }
+    return true
+  end
+
+  local tokens, states = job.native:result()
+  if tokens == nil then
+    coroutine.yield(1 / config.fps)
+    return true
+  end
+  self.job = nil
+  if not tokens then
+    core.log_quiet("Background highlighting failed, tokenizing on the main thread: %s", states)
+    self.background_failed = true
+    return false
+  end
+  -- discard the results of lines that changed in the meantime
+  if job.change_id == self.change_id and job.syntax == self.doc.syntax then
+    apply_job(self, job, tokens, states)
+    core.redraw = true
+    coroutine.yield()
+  end
+  return true
+end
+
+
 -- init incremental syntax highlighting
 function Highlighter:start()
   if self.running then return end
   self.running = true
   core.add_thread(function()
     while self.first_invalid_line <= self.max_wanted_line do
-      local max = math.min(self.first_invalid_line + 40, self.max_wanted_line)
-      local retokenized_from
-      for i = self.first_invalid_line, max do
-        local state = (i > 1) and self.lines[i - 1].state
-        local line = self.lines[i]
-        if line and line.resume and (line.init_state ~= state or line.text ~= self.doc.lines[i]) then
-          -- Reset the progress if no longer valid
-          line.resume = nil
-        end
-        if not (line and line.init_state == state and line.text == self.doc.lines[i] and not line.resume) then
-          retokenized_from = retokenized_from or i
-          self.lines[i] = self:tokenize_line(i, state, line and line.resume)
-          if self.lines[i].resume then
-            self.first_invalid_line = i
-            goto yield
-          end
-        elseif retokenized_from then
-          self:update_notify(retokenized_from, i - retokenized_from - 1)
-          retokenized_from = nil
-        end
-      end
-
-      self.first_invalid_line = max + 1
-      ::yield::
-      if retokenized_from then
-        self:update_notify(retokenized_from, max - retokenized_from)
+      if not (config.threaded_highlighting and not self.background_failed and background_step(self)) then
+        tokenize_step(self)
+        core.redraw = true
+        coroutine.yield()
       end
-      core.redraw = true
-      coroutine.yield()
     end
+    cancel_job(self)
     self.max_wanted_line = 0
     self.running = false
   end, self)
@@ -69,15 +194,31 @@ function Highlighter:reset()
 end
 
 function Highlighter:soft_reset()
+  self.change_id = (self.change_id or 0) + 1
+  cancel_job(self)
   for i=1,#self.lines do
     self.lines[i] = false
   end
   self.first_invalid_line = 1
   self.max_wanted_line = 0
+  -- lines up to `tokenized_line` were tokenized, those after `dirty_line`
+  -- didn't change since
+  self.tokenized_line = 0
+  self.dirty_line = 0
 end
 
 function Highlighter:invalidate(idx)
+  self.change_id = self.change_id + 1
+  if self.job then
+    -- edits after the lines being tokenized in background don't affect them
+    if idx > self.job.last then
+      self.job.change_id = self.change_id
+    else
+      cancel_job(self)
+    end
+  end
   self.first_invalid_line = math.min(self.first_invalid_line, idx)
+  self.dirty_line = math.max(self.dirty_line, idx)
   set_max_wanted_lines(self, math.min(self.max_wanted_line, #self.doc.lines))
 end
 
@@ -88,11 +229,19 @@ function Highlighter:insert_notify(line, n)
     blanks[i] = false
   end
   common.splice(self.lines, line, 0, blanks)
+  self.dirty_line = self.dirty_line + n
+  if self.tokenized_line >= line then
+    self.tokenized_line = self.tokenized_line + n
+  end
 end
 
 function Highlighter:remove_notify(line, n)
   self:invalidate(line)
   common.splice(self.lines, line, n)
+  self.dirty_line = math.max(self.dirty_line - n, line)
+  if self.tokenized_line >= line then
+    self.tokenized_line = math.max(self.tokenized_line - n, line - 1)
+  end
 end
 
 function Highlighter:update_notify(line, n)
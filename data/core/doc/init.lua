@@ -1,9 +1,12 @@
 local Object = require "core.object"
 local Highlighter = require "core.doc.highlighter"
+local UndoStack = require "core.doc.undo"
+local doclines = require "core.doc.lines"
 local core = require "core"
 local syntax = require "core.syntax"
 local config = require "core.config"
 local common = require "core.common"
+local style = require "core.style"
 
 ---@class core.doc : core.object
 local Doc = Object:extend()
@@ -33,11 +36,12 @@ end
 
 
 function Doc:reset()
+  self.buffer = nil
   self.lines = { "\n" }
   self.selections = { 1, 1, 1, 1 }
   self.last_selection = 1
-  self.undo_stack = { idx = 1 }
-  self.redo_stack = { idx = 1 }
+  self.undo_stack = UndoStack()
+  self.redo_stack = UndoStack()
   self.clean_change_id = 1
   self.highlighter = Highlighter(self)
   self:reset_syntax()
@@ -73,6 +77,27 @@ function Doc:load(filename)
   end
   local fp = assert( io.open(filename, "rb") )
   self:reset()
+  -- big files are kept in a native buffer, which needs the Lua 5.4 metamethods
+  if not LUAJIT and fp:seek("end") >= config.text_buffer_threshold * 1e6 then
+    local buffer, crlf
+    if self.convert then
+      fp:seek("set")
+      local content = assert(encoding.convert("UTF-8", self.encoding, fp:read("*a"), {
+        strict = false,
+        handle_from_bom = true
+      }))
+      buffer, crlf = textbuffer.new(content)
+    else
+      buffer, crlf = assert(textbuffer.load(filename))
+    end
+    fp:close()
+    self.buffer = buffer
+    self.lines = doclines.wrap(buffer)
+    if crlf then self.crlf = true end
+    self:reset_syntax()
+    return
+  end
+  fp:seek("set")
   self.lines = {}
   local i = 1
   if self.convert then
@@ -121,6 +146,21 @@ function Doc:reload()
 end
 
 
+-- long saves show their progress, the status view is drawn right away since
+-- the main loop is blocked until the file is written
+local function save_progress(filename)
+  local start, last = system.get_time(), 0
+  return function(done)
+    local now = system.get_time()
+    if not core.status_view or now - start < 0.5 or now - last < 0.1 then return end
+    last = now
+    core.status_view:show_message("i", style.text,
+      string.format("Saving \"%s\": %d%%", common.basename(filename), math.floor(done * 100)))
+    core.draw_frame()
+  end
+end
+
+
 function Doc:save(filename, abs_filename)
   if not filename then
     assert(self.filename, "no filename set to default to")
@@ -129,42 +169,18 @@ function Doc:save(filename, abs_filename)
   else
     assert(self.filename or abs_filename, "calling save on unnamed doc without absolute path")
   end
-  local fp
-  local output = ""
-  if not self.convert then
-    fp = assert( io.open(filename, "wb") )
-    for _, line in ipairs(self.lines) do
-      if self.crlf then line = line:gsub("\n", "\r\n") end
-      fp:write(line)
-    end
-  else
-      output = table.concat(self.lines);
-      if self.crlf then output = output:gsub("\n", "\r\n") end
-  end
-  local conversion_error = false
+  local options = { crlf = self.crlf, progress = save_progress(filename) }
   if self.convert then
-    local errmsg
-    output, errmsg = encoding.convert(self.encoding, "UTF-8", output, {
-      strict = true,
-      handle_to_bom = true
-    })
-    if output then
-      fp = assert( io.open(filename, "wb") )
-      fp:write(encoding.get_charset_bom(self.encoding) .. output)
-      fp:close()
-    else
-      conversion_error = true
-      core.error("%s", errmsg)
-    end
-  else
-    fp:close()
+    options.charset = self.encoding
+    options.bom = encoding.get_charset_bom(self.encoding)
   end
-  self:set_filename(filename, abs_filename)
-  if not conversion_error then
-    self.new_file = false
+  if self.buffer then
+    assert(self.buffer:save(filename, options))
   else
-    self.new_file = true
+    assert(textbuffer.save_lines(self.lines, filename, options))
   end
+  self:set_filename(filename, abs_filename)
+  self.new_file = false
   self:clean()
 end
 
@@ -301,6 +317,26 @@ function Doc:set_selection(line1, col1, line2, col2, swap)
 end
 
 function Doc:merge_cursors(idx)
+  if not idx then
+    -- keeps the first of the cursors starting at the same position, in a
+    -- single pass since batched edits can leave thousands of them
+    local seen, selections, removed = {}, {}, 0
+    for i = 1, #self.selections, 4 do
+      local line, col = self.selections[i], self.selections[i + 1]
+      seen[line] = seen[line] or {}
+      if seen[line][col] then
+        if self.last_selection >= (i + 3) / 4 - removed then
+          self.last_selection = self.last_selection - 1
+        end
+        removed = removed + 1
+      else
+        seen[line][col] = true
+        table.move(self.selections, i, i + 3, #selections + 1, selections)
+      end
+    end
+    if removed > 0 then self.selections = selections end
+    return
+  end
   for i = (idx or (#self.selections - 3)), (idx or 5), -4 do
     for j = 1, i - 4, 4 do
       if self.selections[i] == self.selections[j] and
@@ -383,6 +419,9 @@ function Doc:get_text(line1, col1, line2, col2)
   line1, col1 = self:sanitize_position(line1, col1)
   line2, col2 = self:sanitize_position(line2, col2)
   line1, col1, line2, col2 = sort_positions(line1, col1, line2, col2)
+  if self.buffer then
+    return self.buffer:get_text(line1, col1, line2, col2)
+  end
   if line1 == line2 then
     return self.lines[line1]:sub(col1, col2 - 1)
   end
@@ -401,76 +440,44 @@ function Doc:get_char(line, col)
 end
 
 
-local function push_undo(undo_stack, time, type, ...)
-  undo_stack[undo_stack.idx] = { type = type, time = time, ... }
-  undo_stack[undo_stack.idx - config.max_undos] = nil
-  undo_stack.idx = undo_stack.idx + 1
-end
-
-
-local function pop_undo(self, undo_stack, redo_stack, modified)
-  -- pop command
-  local cmd = undo_stack[undo_stack.idx - 1]
-  if not cmd then return end
-  undo_stack.idx = undo_stack.idx - 1
-
-  -- handle command
-  if cmd.type == "insert" then
-    local line, col, text = table.unpack(cmd)
-    self:raw_insert(line, col, text, redo_stack, cmd.time)
-  elseif cmd.type == "remove" then
-    local line1, col1, line2, col2 = table.unpack(cmd)
-    self:raw_remove(line1, col1, line2, col2, redo_stack, cmd.time)
-  elseif cmd.type == "selection" then
-    self.selections = { table.unpack(cmd) }
-    self:sanitize_selection()
-  end
-
-  modified = modified or (cmd.type ~= "selection")
-
-  -- if next undo command is within the merge timeout then treat as a single
-  -- command and continue to execute it
-  local next = undo_stack[undo_stack.idx - 1]
-  if next and math.abs(cmd.time - next.time) < config.undo_merge_timeout then
-    return pop_undo(self, undo_stack, redo_stack, modified)
-  end
-
-  if modified then
-    self:on_text_change("undo")
-  end
-end
-
-
 function Doc:raw_insert(line, col, text, undo_stack, time)
-  -- split text into lines and merge with line at insertion point
-  local lines = split_lines(text)
-  local len = #lines[#lines]
-  local before = self.lines[line]:sub(1, col - 1)
-  local after = self.lines[line]:sub(col)
-  for i = 1, #lines - 1 do
-    lines[i] = lines[i] .. "\n"
-  end
-  lines[1] = before .. lines[1]
-  lines[#lines] = lines[#lines] .. after
+  local n_lines, len
+  if self.buffer then
+    local added_lines
+    added_lines, len = self.buffer:insert(line, col, text)
+    doclines.changed(self.lines)
+    n_lines = added_lines + 1
+  else
+    -- split text into lines and merge with line at insertion point
+    local lines = split_lines(text)
+    len = #lines[#lines]
+    local before = self.lines[line]:sub(1, col - 1)
+    local after = self.lines[line]:sub(col)
+    for i = 1, #lines - 1 do
+      lines[i] = lines[i] .. "\n"
+    end
+    lines[1] = before .. lines[1]
+    lines[#lines] = lines[#lines] .. after
 
-  -- splice lines into line array
-  common.splice(self.lines, line, 1, lines)
+    -- splice lines into line array
+    common.splice(self.lines, line, 1, lines)
+    n_lines = #lines
+  end
 
   -- keep cursors where they should be
   for idx, cline1, ccol1, cline2, ccol2 in self:get_selections(true, true) do
     if cline1 < line then break end
-    local line_addition = (line < cline1 or col < ccol1) and #lines - 1 or 0
+    local line_addition = (line < cline1 or col < ccol1) and n_lines - 1 or 0
     local column_addition = line == cline1 and ccol1 > col and len or 0
     self:set_selections(idx, cline1 + line_addition, ccol1 + column_addition, cline2 + line_addition, ccol2 + column_addition)
   end
 
   -- push undo
   local line2, col2 = self:position_offset(line, col, #text)
-  push_undo(undo_stack, time, "selection", table.unpack(self.selections))
-  push_undo(undo_stack, time, "remove", line, col, line2, col2)
+  undo_stack:push_edit(time, self.selections, "remove", line, col, line2, col2)
 
   -- update highlighter and assure selection is in bounds
-  self.highlighter:insert_notify(line, #lines - 1)
+  self.highlighter:insert_notify(line, n_lines - 1)
   self:sanitize_selection()
 end
 
@@ -478,18 +485,22 @@ end
 function Doc:raw_remove(line1, col1, line2, col2, undo_stack, time)
   -- push undo
   local text = self:get_text(line1, col1, line2, col2)
-  push_undo(undo_stack, time, "selection", table.unpack(self.selections))
-  push_undo(undo_stack, time, "insert", line1, col1, text)
-
-  -- get line content before/after removed text
-  local before = self.lines[line1]:sub(1, col1 - 1)
-  local after = self.lines[line2]:sub(col2)
+  undo_stack:push_edit(time, self.selections, "insert", line1, col1, text)
 
   local line_removal = line2 - line1
   local col_removal = col2 - col1
 
-  -- splice line into line array
-  common.splice(self.lines, line1, line_removal + 1, { before .. after })
+  if self.buffer then
+    self.buffer:remove(line1, col1, line2, col2)
+    doclines.changed(self.lines)
+  else
+    -- get line content before/after removed text
+    local before = self.lines[line1]:sub(1, col1 - 1)
+    local after = self.lines[line2]:sub(col2)
+
+    -- splice line into line array
+    common.splice(self.lines, line1, line_removal + 1, { before .. after })
+  end
 
   local merge = false
 
@@ -534,8 +545,141 @@ function Doc:raw_remove(line1, col1, line2, col2, undo_stack, time)
 end
 
 
+-- amount of "\n" in a text, and length of the text after the last one
+local function count_lines(text)
+  local n, last = 0, 0
+  local i = text:find("\n", 1, true)
+  while i do
+    n, last = n + 1, i
+    i = text:find("\n", i + 1, true)
+  end
+  return n, #text - last
+end
+
+
+-- position once the edits are applied, a position inside a replaced range
+-- going to the start of its text
+local function map_position(edits, line, col)
+  local lo, hi, k = 1, #edits, 0
+  while lo <= hi do
+    local mid = math.floor((lo + hi) / 2)
+    local edit = edits[mid]
+    if edit[1] < line or edit[1] == line and edit[2] <= col then
+      k, lo = mid, mid + 1
+    else
+      hi = mid - 1
+    end
+  end
+  local edit = edits[k]
+  if not edit then return line, col end
+  if line < edit[3] or line == edit[3] and col <= edit[4] then
+    return edit.new_line1, edit.new_col1
+  elseif line == edit[3] then
+    return edit.new_line2, edit.new_col2 + col - edit[4]
+  end
+  return line + edit.line_delta, col
+end
+
+
+---Replaces several ranges at once, with a single pass over the lines, the
+---selections and the highlighter.
+---
+---Each edit is `{ line1, col1, line2, col2, text }`, the edits have to be
+---sorted, not overlapping and with valid positions. Their new ranges are
+---stored in their `new_line1`, `new_col1`, `new_line2` and `new_col2` fields.
+---@param edits table[]
+---@param undo_stack core.doc.undostack
+---@param time number
+function Doc:raw_apply_edits(edits, undo_stack, time)
+  if #edits == 0 then return end
+
+  -- new ranges, from the top
+  local delta, prev = 0, nil
+  for _, edit in ipairs(edits) do
+    local line, col = edit[1] + delta, edit[2]
+    if prev and edit[1] == prev[3] then
+      line, col = prev.new_line2, prev.new_col2 + edit[2] - prev[4]
+    end
+    local n, tail = count_lines(edit[5])
+    edit.new_line1, edit.new_col1 = line, col
+    edit.new_line2, edit.new_col2 = line + n, n == 0 and col + #edit[5] or tail + 1
+    delta = delta + n - (edit[3] - edit[1])
+    edit.line_delta = delta
+    prev = edit
+  end
+
+  -- push undo, the edits being undone from the top as they're applied from
+  -- the bottom; the selections are only stored with the first record
+  for i = #edits, 1, -1 do
+    local edit = edits[i]
+    local line1, col1, line2, col2, text = table.unpack(edit, 1, 5)
+    if line1 ~= line2 or col1 ~= col2 then
+      undo_stack:push_edit(time, self.selections, "insert", line1, col1,
+        self:get_text(line1, col1, line2, col2))
+    end
+    if text ~= "" then
+      local n, tail = count_lines(text)
+      undo_stack:push_edit(time, self.selections, "remove", line1, col1,
+        line1 + n, n == 0 and col1 + #text or tail + 1)
+    end
+  end
+
+  local first, last = edits[1][1], edits[#edits][3]
+  if self.buffer then
+    for i = #edits, 1, -1 do
+      local line1, col1, line2, col2, text = table.unpack(edits[i], 1, 5)
+      self.buffer:remove(line1, col1, line2, col2)
+      self.buffer:insert(line1, col1, text)
+    end
+    doclines.changed(self.lines)
+  else
+    -- rebuild the edited lines, from the first to the last edit
+    local lines, out = self.lines, {}
+    local line, col, pending = first, 1, ""
+    for _, edit in ipairs(edits) do
+      if edit[1] == line then
+        pending = pending .. lines[line]:sub(col, edit[2] - 1)
+      else
+        out[#out + 1] = pending .. lines[line]:sub(col)
+        for i = line + 1, edit[1] - 1 do out[#out + 1] = lines[i] end
+        pending = lines[edit[1]]:sub(1, edit[2] - 1)
+      end
+      local text, s = edit[5], 1
+      local nl = text:find("\n", 1, true)
+      while nl do
+        out[#out + 1] = pending .. text:sub(s, nl)
+        pending, s = "", nl + 1
+        nl = text:find("\n", s, true)
+      end
+      pending = pending .. text:sub(s)
+      line, col = edit[3], edit[4]
+    end
+    out[#out + 1] = pending .. lines[line]:sub(col)
+    common.splice(lines, first, last - first + 1, out)
+  end
+
+  -- move the selections through the edits, cursors ending up at the same
+  -- position are left for the caller to merge
+  local selections = self.selections
+  for i = 1, #selections, 2 do
+    selections[i], selections[i + 1] = map_position(edits, selections[i], selections[i + 1])
+  end
+
+  -- the highlighter gets the lines added or removed once, and every line of
+  -- the batch invalidated
+  if delta > 0 then
+    self.highlighter:insert_notify(first, delta)
+  elseif delta < 0 then
+    self.highlighter:remove_notify(first, -delta)
+  end
+  self.highlighter:invalidate(first)
+  self.highlighter:invalidate(last + delta)
+  self:sanitize_selection()
+end
+
+
 function Doc:insert(line, col, text)
-  self.redo_stack = { idx = 1 }
+  self.redo_stack = UndoStack()
   line, col = self:sanitize_position(line, col)
   self:raw_insert(line, col, text, self.undo_stack, system.get_time())
   self:on_text_change("insert")
@@ -543,7 +687,7 @@ end
 
 
 function Doc:remove(line1, col1, line2, col2)
-  self.redo_stack = { idx = 1 }
+  self.redo_stack = UndoStack()
   line1, col1 = self:sanitize_position(line1, col1)
   line2, col2 = self:sanitize_position(line2, col2)
   line1, col1, line2, col2 = sort_positions(line1, col1, line2, col2)
@@ -552,6 +696,201 @@ function Doc:remove(line1, col1, line2, col2)
 end
 
 
+local function compare_edits(a, b)
+  return a[1] < b[1] or a[1] == b[1] and a[2] < b[2]
+end
+
+local function batch_edits(self, edits)
+  self.redo_stack = UndoStack()
+  for _, edit in ipairs(edits) do
+    edit[1], edit[2] = self:sanitize_position(edit[1], edit[2])
+    edit[3], edit[4] = self:sanitize_position(edit[3], edit[4])
+    edit[1], edit[2], edit[3], edit[4] = sort_positions(edit[1], edit[2], edit[3], edit[4])
+  end
+  table.sort(edits, compare_edits)
+  for i = 2, #edits do
+    local prev, edit = edits[i - 1], edits[i]
+    if compare_edits(edit, { prev[3], prev[4] }) then
+      edit[1], edit[2] = prev[3], prev[4]
+      if compare_edits({ edit[3], edit[4] }, edit) then
+        edit[3], edit[4] = edit[1], edit[2]
+      end
+    end
+  end
+  self:raw_apply_edits(edits, self.undo_stack, system.get_time())
+end
+
+---Replaces several ranges at once, as a single undo step. Each edit is
+---`{ line1, col1, line2, col2, text }`, they're sorted and the parts of a range
+---overlapping the previous one are left out. See `Doc:raw_apply_edits`.
+---@param edits table[]
+function Doc:apply_edits(edits)
+  batch_edits(self, edits)
+  self:merge_cursors()
+  self:on_text_change("insert")
+end
+
+
+---Replaces a range for each selection, in a single pass when there are
+---several of them. `fn` gets the index and sorted positions of each selection
+---and returns the range to replace, its new text and where the selection
+---goes then: "start" or "end" of the new text, or nil to let it follow the
+---text. A single selection is edited with `Doc:remove` and `Doc:insert`.
+---@param fn fun(idx:integer, line1:integer, col1:integer, line2:integer, col2:integer):integer?,integer?,integer?,integer?,string?,string?
+function Doc:edit_selections(fn)
+  if #self.selections <= 4 then
+    local line1, col1, line2, col2, text, place = fn(1, self:get_selection(true))
+    if not line1 then return end
+    line1, col1 = self:sanitize_position(line1, col1)
+    line2, col2 = self:sanitize_position(line2, col2)
+    line1, col1, line2, col2 = sort_positions(line1, col1, line2, col2)
+    if line1 ~= line2 or col1 ~= col2 then
+      self:remove(line1, col1, line2, col2)
+    end
+    if text and text ~= "" then
+      self:insert(line1, col1, text)
+    end
+    if place == "start" then
+      self:set_selection(line1, col1)
+    elseif place == "end" then
+      self:set_selection(self:position_offset(line1, col1, #(text or "")))
+    end
+    return
+  end
+  local edits, placed, inserted = {}, {}, false
+  for idx, line1, col1, line2, col2 in self:get_selections(true) do
+    local l1, c1, l2, c2, text, place = fn(idx, line1, col1, line2, col2)
+    if l1 then
+      local edit = { l1, c1, l2, c2, text or "" }
+      edits[#edits + 1] = edit
+      inserted = inserted or edit[5] ~= ""
+      if place then placed[idx] = { edit, place } end
+    end
+  end
+  batch_edits(self, edits)
+  for idx, p in pairs(placed) do
+    local edit, place = p[1], p[2]
+    if place == "start" then
+      self:set_selections(idx, edit.new_line1, edit.new_col1)
+    else
+      self:set_selections(idx, edit.new_line2, edit.new_col2)
+    end
+  end
+  self:merge_cursors()
+  self:on_text_change(inserted and "insert" or "remove")
+end
+
+
+-- the records of a group with the same time as a batch of edits, each record
+-- being relative to the text once the previous ones are replayed; nil if a
+-- record isn't after the previous one, as a sequential replay is needed then
+local function group_edits(cmds)
+  local edits = {}
+  -- end of the last record replayed, in the text with the records replayed
+  -- and in the text as it is now
+  local seq_line, seq_col, line, col = 1, 1, 1, 1
+  local function current(l, c)
+    if l < seq_line or l == seq_line and c < seq_col then return end
+    if l == seq_line then return line, col + c - seq_col end
+    return l - seq_line + line, c
+  end
+  for _, cmd in ipairs(cmds) do
+    local edit
+    if cmd.type == "remove" then
+      local line1, col1 = current(cmd[1], cmd[2])
+      local line2, col2 = current(cmd[3], cmd[4])
+      if not line1 or not line2 or line1 == line2 and col1 >= col2 then return end
+      edit = { line1, col1, line2, col2, "" }
+      seq_line, seq_col, line, col = cmd[1], cmd[2], line2, col2
+    else
+      local l, c = current(cmd[1], cmd[2])
+      if not l or cmd[3] == "" then return end
+      edit = { l, c, l, c, cmd[3] }
+      local n, tail = count_lines(cmd[3])
+      seq_line, seq_col = cmd[1] + n, n == 0 and cmd[2] + #cmd[3] or tail + 1
+      line, col = l, c
+    end
+    edit.span = cmd.span
+    -- records next to each other, like the removal and the insertion of an
+    -- edit, are a single edit
+    local prev = edits[#edits]
+    if prev and prev[3] == edit[1] and prev[4] == edit[2] then
+      prev[3], prev[4], prev[5] = edit[3], edit[4], prev[5] .. edit[5]
+      prev.span = prev.span + edit.span
+    else
+      edits[#edits + 1] = edit
+    end
+  end
+  return edits
+end
+
+
+-- spans of the records Doc:raw_apply_edits pushes for the edits, so that the
+-- change ids of the group stay the same
+local function edit_spans(edits)
+  local spans = {}
+  for i = #edits, 1, -1 do
+    local edit = edits[i]
+    local removes = edit[1] ~= edit[3] or edit[2] ~= edit[4]
+    local inserts = edit[5] ~= ""
+    local n = (removes and 1 or 0) + (inserts and 1 or 0)
+    for j = 1, n do
+      spans[#spans + 1] = j == 1 and edit.span - (n - 1) or 1
+    end
+  end
+  return spans
+end
+
+
+local function pop_undo(self, undo_stack, redo_stack, modified)
+  -- pop command
+  local cmd = undo_stack:pop()
+  if not cmd then return end
+
+  -- handle command
+  if cmd.type == "insert" or cmd.type == "remove" then
+    -- the records of a batch share their time, they're replayed in one pass
+    local cmds = { cmd }
+    while true do
+      local kind, time = undo_stack:get_last()
+      if time ~= cmd.time or kind ~= "insert" and kind ~= "remove" then break end
+      cmds[#cmds + 1] = undo_stack:pop()
+    end
+    local edits = #cmds > 1 and group_edits(cmds)
+    if edits then
+      redo_stack.next_span = edit_spans(edits)
+      self:raw_apply_edits(edits, redo_stack, cmd.time)
+      redo_stack.next_span = nil
+    else
+      for _, c in ipairs(cmds) do
+        redo_stack.next_span = c.span
+        if c.type == "insert" then
+          self:raw_insert(c[1], c[2], c[3], redo_stack, c.time)
+        else
+          self:raw_remove(c[1], c[2], c[3], c[4], redo_stack, c.time)
+        end
+      end
+    end
+  elseif cmd.type == "selection" then
+    self.selections = table.move(cmd, 1, #cmd, 1, {})
+    self:sanitize_selection()
+  end
+
+  modified = modified or (cmd.type ~= "selection")
+
+  -- if next undo command is within the merge timeout then treat as a single
+  -- command and continue to execute it
+  local next_time = undo_stack:get_last_time()
+  if next_time and math.abs(cmd.time - next_time) < config.undo_merge_timeout then
+    return pop_undo(self, undo_stack, redo_stack, modified)
+  end
+
+  if modified then
+    self:on_text_change("undo")
+  end
+end
+
+
 function Doc:undo()
   pop_undo(self, self.undo_stack, self.redo_stack, false)
 end
@@ -563,6 +902,12 @@ end
 
 
 function Doc:text_input(text, idx)
+  if not idx and #self.selections > 4 then
+    self:edit_selections(function(_, line1, col1, line2, col2)
+      return line1, col1, line2, col2, text, "end"
+    end)
+    return
+  end
   for sidx, line1, col1, line2, col2 in self:get_selections(true, idx or true) do
     if line1 ~= line2 or col1 ~= col2 then
       self:delete_to_cursor(sidx)
@@ -599,13 +944,26 @@ function Doc:replace_cursor(idx, line1, col1, line2, col2, fn)
 end
 
 function Doc:replace(fn)
-  local has_selection, results = false, { }
+  local has_selection, results, edits = false, { }, { }
+  local batch = #self.selections > 4
   for idx, line1, col1, line2, col2 in self:get_selections(true) do
     if line1 ~= line2 or col1 ~= col2 then
-      results[idx] = self:replace_cursor(idx, line1, col1, line2, col2, fn)
+      if batch then
+        local old_text = self:get_text(line1, col1, line2, col2)
+        local new_text, res = fn(old_text)
+        if old_text ~= new_text then
+          table.insert(edits, { line1, col1, line2, col2, new_text })
+        end
+        results[idx] = res
+      else
+        results[idx] = self:replace_cursor(idx, line1, col1, line2, col2, fn)
+      end
       has_selection = true
     end
   end
+  if #edits > 0 then
+    self:apply_edits(edits)
+  end
   if not has_selection then
     self:set_selection(table.unpack(self.selections))
     results[1] = self:replace_cursor(1, 1, 1, #self.lines, #self.lines[#self.lines], fn)
@@ -615,6 +973,16 @@ end
 
 
 function Doc:delete_to_cursor(idx, ...)
+  if not idx and #self.selections > 4 then
+    local args = table.pack(...)
+    self:edit_selections(function(_, line1, col1, line2, col2)
+      if line1 == line2 and col1 == col2 then
+        line2, col2 = self:position_offset(line1, col1, table.unpack(args, 1, args.n))
+      end
+      return line1, col1, line2, col2, "", "start"
+    end)
+    return
+  end
   for sidx, line1, col1, line2, col2 in self:get_selections(true, idx) do
     if line1 ~= line2 or col1 ~= col2 then
       self:remove(line1, col1, line2, col2)
@@ -0,0 +1,74 @@
+-- Presents the native text buffer of a Doc as its array of lines, so that
+-- `doc.lines[i]`, `#doc.lines` and `ipairs(doc.lines)` keep working.
+
+local lines = {}
+
+-- lines turned into strings are kept until the next edit, up to this amount
+local MAX_CACHED_LINES = 4096
+
+local caches = setmetatable({}, { __mode = "k" })
+
+
+local function clear_cache(cache)
+  cache.lines = {}
+  cache.count = 0
+end
+
+
+---@param buffer textbuffer
+---@return string[]
+function lines.wrap(buffer)
+  local cache = {}
+  clear_cache(cache)
+
+  local function get_line(idx)
+    if type(idx) ~= "number" then return nil end
+    local line = cache.lines[idx]
+    if line then return line end
+    line = buffer:get_line(idx)
+    if line then
+      if cache.count >= MAX_CACHED_LINES then clear_cache(cache) end
+      cache.lines[idx] = line
+      cache.count = cache.count + 1
+    end
+    return line
+  end
+
+  local proxy = setmetatable({}, {
+    __index = function(_, idx)
+      return get_line(idx)
+    end,
+    -- replaces a whole line, for plugins writing to `doc.lines` directly
+    __newindex = function(_, idx, text)
+      local count = buffer:get_line_count()
+      assert(math.type(idx) == "integer" and idx >= 1 and idx <= count + 1,
+        "lines can only be replaced or appended")
+      if idx <= count then buffer:remove(idx, 1, idx + 1, 1) end
+      if text then buffer:insert(idx, 1, text) end
+      clear_cache(cache)
+    end,
+    __len = function()
+      return buffer:get_line_count()
+    end,
+    __pairs = function(t)
+      return function(_, idx)
+        idx = idx + 1
+        local line = get_line(idx)
+        if line then return idx, line end
+      end, t, 0
+    end
+  })
+  caches[proxy] = cache
+  return proxy
+end
+
+
+---Drops the lines cached by a wrapped buffer, to be called after editing it.
+---@param wrapped string[]
+function lines.changed(wrapped)
+  local cache = caches[wrapped]
+  if cache then clear_cache(cache) end
+end
+
+
+return lines
@@ -41,8 +41,57 @@ local function rfind(func, text, pattern, index, plain)
 end
 
 
+-- lines given at once to native_search, so that only the text up to the
+-- first match is copied
+local window_lines = 4096
+
+-- finds the matches from a position with native_search, a window of lines at
+-- a time
+local function native_find(doc, line, col, text, opt, limit, cancel)
+  local results = {}
+  local n = #doc.lines
+  local window = window_lines
+  while true do
+    local first, last = line, math.min(line + window - 1, n)
+    local source = doc.lines
+    if doc.buffer then
+      source = doc.buffer:get_text(first, 1, last, #doc.lines[last] + 1)
+    end
+    local matches, complete, next_line, next_col = native_search.find(source, text, {
+      line = first, col = col, last_line = last, more = last < n,
+      no_case = opt.no_case, regex = opt.regex,
+      limit = limit and limit - #results / 4,
+      cancel = cancel and function(done)
+        return cancel((first - 1 + done * (last - first + 1)) / n)
+      end
+    })
+    table.move(matches, 1, #matches, #results + 1, results)
+    if not next_line then
+      return results, complete
+    end
+    -- no progress means that a match may be longer than the window
+    if next_line == line and next_col == col then
+      window = window * 2
+    else
+      window = window_lines
+    end
+    line, col = next_line, next_col
+  end
+end
+
+
 function search.find(doc, line, col, text, opt)
   doc, line, col, text, opt = init_args(doc, line, col, text, opt)
+  if not opt.pattern and not opt.reverse then
+    local results = native_find(doc, line, col, text, opt, 1)
+    if results[1] then
+      return table.unpack(results, 1, 4)
+    end
+    if opt.wrap then
+      return search.find(doc, 1, 1, text, { no_case = opt.no_case, regex = opt.regex })
+    end
+    return
+  end
   local plain = not opt.pattern
   local pattern = text
   local search_func = string.find
@@ -82,4 +131,33 @@ function search.find(doc, line, col, text, opt)
 end
 
 
+---Finds every match in the document at once, with the options of
+---`search.find` except `wrap` and `reverse`, plus a `cancel` function as in
+---`native_search.find`.
+---@return integer[] matches The `line1, col1, line2, col2` of each match.
+---@return boolean complete
+function search.find_all(doc, text, opt)
+  opt = opt or default_opt
+  if not opt.pattern then
+    return native_find(doc, 1, 1, text, opt, nil, opt.cancel)
+  end
+  -- Lua patterns are still matched line by line
+  if opt.no_case then text = text:lower() end
+  local results = {}
+  for line, line_text in ipairs(doc.lines) do
+    if opt.no_case then line_text = line_text:lower() end
+    local init = 1
+    while init <= #line_text do
+      local s, e = line_text:find(text, init)
+      if not s then break end
+      if e >= s then
+        table.move({ line, s, line, e + 1 }, 1, 4, #results + 1, results)
+      end
+      init = math.max(e, s) + 1
+    end
+  end
+  return results, true
+end
+
+
 return search
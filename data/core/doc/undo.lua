@@ -0,0 +1,325 @@
+local Object = require "core.object"
+local config = require "core.config"
+
+-- Undo or redo history of a Doc.
+--
+-- Records are kept in flat arrays instead of a table each. An edit pushes the
+-- selections before it and the command undoing it, but characters typed or
+-- deleted one after the other extend the previous command. Once the history
+-- uses more than `config.undo_memory_limit`, its oldest records are moved to
+-- a temporary file and read back when undoing that far.
+---@class core.doc.undostack : core.object
+local UndoStack = Object:extend()
+
+-- rough size in bytes of a record and of each of its values
+local RECORD_SIZE = 64
+local VALUE_SIZE = 16
+
+
+function UndoStack:new()
+  -- change id, grows with every edit and goes back on undo
+  self.idx = 1
+  -- records are numbered from 1 to `top`, those from `first` are in memory at
+  -- their number minus `base`
+  self.top = 0
+  self.first = 1
+  self.base = 0
+  self.kinds, self.times, self.last_times = {}, {}, {}
+  self.spans, self.offsets, self.sizes = {}, {}, {}
+  self.values = {}
+  self.n_values = 0
+  self.size = 0
+  -- blocks of older records in the temporary file, oldest first
+  self.spilled = {}
+end
+
+
+local function drop_record(self, p)
+  for i = self.offsets[p], (self.offsets[p + 1] or self.n_values + 1) - 1 do
+    self.values[i] = nil
+  end
+  self.size = self.size - self.sizes[p]
+  self.kinds[p], self.times[p], self.last_times[p] = nil, nil, nil
+  self.spans[p], self.offsets[p], self.sizes[p] = nil, nil, nil
+end
+
+
+-- moves the records in memory back to the start of the arrays
+local function compact(self)
+  local kinds, times, last_times, spans, offsets, sizes = {}, {}, {}, {}, {}, {}
+  local values, n_values = {}, 0
+  for i = self.first, self.top do
+    local p, q = i - self.base, i - self.first + 1
+    kinds[q], times[q], last_times[q] = self.kinds[p], self.times[p], self.last_times[p]
+    spans[q], sizes[q] = self.spans[p], self.sizes[p]
+    offsets[q] = n_values + 1
+    for j = self.offsets[p], (self.offsets[p + 1] or self.n_values + 1) - 1 do
+      n_values = n_values + 1
+      values[n_values] = self.values[j]
+    end
+  end
+  self.kinds, self.times, self.last_times = kinds, times, last_times
+  self.spans, self.offsets, self.sizes = spans, offsets, sizes
+  self.values, self.n_values = values, n_values
+  self.base = self.first - 1
+end
+
+
+local function encode(out, value)
+  if type(value) == "string" then
+    out[#out + 1] = "s" .. #value .. ":"
+    out[#out + 1] = value
+  else
+    out[#out + 1] = string.format("n%.17g;", value)
+  end
+end
+
+
+local function decode(data, pos)
+  local tag, value, next_pos = data:match("^(%a)([^:;]*)[:;]()", pos)
+  if tag == "s" then
+    local len = tonumber(value)
+    return data:sub(next_pos, next_pos + len - 1), next_pos + len
+  end
+  return tonumber(value), next_pos
+end
+
+
+-- writes the oldest half of the records in memory to the temporary file
+local function spill(self)
+  if self.first > self.top then return false end
+  self.file = self.file or io.tmpfile()
+  if not self.file then return false end
+  local out, size, last = {}, 0, self.first - 1
+  while last < self.top and size < self.size / 2 do
+    last = last + 1
+    local p = last - self.base
+    size = size + self.sizes[p]
+    encode(out, self.kinds[p])
+    encode(out, self.times[p])
+    encode(out, self.last_times[p])
+    encode(out, self.spans[p])
+    local to = (self.offsets[p + 1] or self.n_values + 1) - 1
+    encode(out, to - self.offsets[p] + 1)
+    for i = self.offsets[p], to do encode(out, self.values[i]) end
+  end
+  local data = table.concat(out)
+  local offset = self.file:seek("end")
+  if not offset or not self.file:write(data) then return false end
+  table.insert(self.spilled, {
+    from = self.first, to = last, offset = offset, length = #data,
+    last_time = self.last_times[last - self.base]
+  })
+  for i = self.first, last do drop_record(self, i - self.base) end
+  self.first = last + 1
+  return true
+end
+
+
+-- reads back the newest spilled block, once no record is left in memory
+local function unspill(self)
+  local block = table.remove(self.spilled)
+  if not block then return end
+  self.file:seek("set", block.offset)
+  local data = self.file:read(block.length)
+  self.kinds, self.times, self.last_times = {}, {}, {}
+  self.spans, self.offsets, self.sizes = {}, {}, {}
+  self.values, self.n_values = {}, 0
+  self.base = block.from - 1
+  local pos = 1
+  for p = 1, block.to - block.from + 1 do
+    local n
+    self.kinds[p], pos = decode(data, pos)
+    self.times[p], pos = decode(data, pos)
+    self.last_times[p], pos = decode(data, pos)
+    self.spans[p], pos = decode(data, pos)
+    n, pos = decode(data, pos)
+    self.offsets[p] = self.n_values + 1
+    local size = RECORD_SIZE + n * VALUE_SIZE
+    for i = self.n_values + 1, self.n_values + n do
+      self.values[i], pos = decode(data, pos)
+      if type(self.values[i]) == "string" then size = size + #self.values[i] end
+    end
+    self.n_values = self.n_values + n
+    self.sizes[p] = size
+    self.size = self.size + size
+  end
+  self.first = block.from
+  if #self.spilled == 0 then
+    self.file:close()
+    self.file = nil
+  end
+end
+
+
+local function trim(self)
+  local oldest = self.top - config.max_undos
+  while self.spilled[1] and self.spilled[1].to <= oldest do
+    table.remove(self.spilled, 1)
+  end
+  if #self.spilled == 0 then
+    while self.first <= oldest do
+      drop_record(self, self.first - self.base)
+      self.first = self.first + 1
+    end
+  end
+  local limit = config.undo_memory_limit * 1024 * 1024
+  while self.size > limit and spill(self) do end
+  if self.first - self.base > 1024 and (self.first - self.base) * 2 > self.top - self.base then
+    compact(self)
+  end
+end
+
+
+-- span given to the next record, `next_span` being a number or a list of
+-- spans for the next records
+local function take_span(self)
+  local spans = self.next_span
+  if type(spans) ~= "table" then
+    self.next_span = nil
+    return spans
+  end
+  spans.n = (spans.n or 0) + 1
+  if spans.n >= #spans then self.next_span = nil end
+  return spans[spans.n]
+end
+
+
+local function push_values(self, time, kind, args, n)
+  local span = 1
+  if kind ~= "selection" and self.next_span then
+    span = take_span(self)
+  end
+  self.top = self.top + 1
+  local p = self.top - self.base
+  local size = RECORD_SIZE + n * VALUE_SIZE
+  self.kinds[p], self.times[p], self.last_times[p] = kind, time, time
+  self.spans[p], self.offsets[p] = span, self.n_values + 1
+  for i = 1, n do
+    local value = args[i]
+    self.values[self.n_values + i] = value
+    if type(value) == "string" then size = size + #value end
+  end
+  self.n_values = self.n_values + n
+  self.sizes[p] = size
+  self.size = self.size + size
+  self.idx = self.idx + span
+  trim(self)
+end
+
+
+---Pushes a record.
+---@param time number
+---@param kind string
+---@param ... any
+function UndoStack:push(time, kind, ...)
+  push_values(self, time, kind, { ... }, select("#", ...))
+end
+
+
+-- extends the newest command when the edit continues it: text typed right
+-- after the text it removes, or text removed next to the text it inserts
+local function coalesce(self, time, kind, ...)
+  if self.top < self.first then return false end
+  local p = self.top - self.base
+  if self.kinds[p] ~= kind
+  or math.abs(time - self.last_times[p]) >= config.undo_merge_timeout then
+    return false
+  end
+  local v = self.offsets[p]
+  local values = self.values
+  if kind == "remove" then
+    local line1, col1, line2, col2 = ...
+    if line1 ~= line2 or values[v + 2] ~= line1 or values[v + 3] ~= col1 then
+      return false
+    end
+    values[v + 3] = col2
+  elseif kind == "insert" then
+    local line, col, text = ...
+    if text:find("\n", 1, true) or values[v] ~= line then return false end
+    if values[v + 1] == col + #text then
+      values[v + 1], values[v + 2] = col, text .. values[v + 2]
+    elseif values[v + 1] == col then
+      values[v + 2] = values[v + 2] .. text
+    else
+      return false
+    end
+    self.sizes[p] = self.sizes[p] + #text
+    self.size = self.size + #text
+  else
+    return false
+  end
+  self.last_times[p] = time
+  self.spans[p] = self.spans[p] + 2
+  self.idx = self.idx + 2
+  return true
+end
+
+
+---Pushes the records of an edit: the selections before it and the command
+---undoing it, a "remove" or "insert" command.
+---@param time number
+---@param selections integer[]
+---@param kind string
+---@param ... any
+function UndoStack:push_edit(time, selections, kind, ...)
+  -- a single cursor typing or deleting, commands replayed from the other
+  -- stack are kept as they are
+  if not self.next_span and #selections <= 4 and coalesce(self, time, kind, ...) then
+    return
+  end
+  -- records with the same time are always undone together, and only the
+  -- oldest selections of the group are left once they are, so the edits of a
+  -- batch or of a replayed group don't need to store them again
+  if self.top < self.first or self.last_times[self.top - self.base] ~= time then
+    push_values(self, time, "selection", selections, #selections)
+  end
+  self:push(time, kind, ...)
+end
+
+
+---Pops the newest record, as a table with its `type`, `time`, `span` and
+---values. The `span` has to be given to the other stack as `next_span` when
+---the command is replayed, so that the change ids match again; a list of
+---spans is used for the next records in order.
+---@return table?
+function UndoStack:pop()
+  if self.top < self.first then unspill(self) end
+  if self.top < self.first then return nil end
+  local p = self.top - self.base
+  local offset = self.offsets[p]
+  local cmd = { type = self.kinds[p], time = self.times[p], span = self.spans[p] }
+  for i = offset, self.n_values do
+    cmd[#cmd + 1] = self.values[i]
+  end
+  self.idx = self.idx - self.spans[p]
+  drop_record(self, p)
+  self.n_values = offset - 1
+  self.top = self.top - 1
+  return cmd
+end
+
+
+---Returns the type and time of the newest record, without popping it.
+---@return string? type
+---@return number? time
+function UndoStack:get_last()
+  if self.top < self.first then unspill(self) end
+  if self.top < self.first then return nil end
+  local p = self.top - self.base
+  return self.kinds[p], self.times[p]
+end
+
+
+---Returns the time of the last edit extending the newest record.
+---@return number?
+function UndoStack:get_last_time()
+  if self.top >= self.first then
+    return self.last_times[self.top - self.base]
+  end
+  local block = self.spilled[#self.spilled]
+  return block and block.last_time
+end
+
+
+return UndoStack
@@ -61,6 +61,8 @@ function DocView:new(doc)
   self.doc = assert(doc)
   self.font = "code_font"
   self.last_x_offset = {}
+  self.x_offset_cache = { lines = setmetatable({}, { __mode = "k" }), size = 0, fonts = {} }
+  self.last_draw_offset = {}
   self.ime_selection = { from = 0, size = 0 }
   self.ime_status = false
   self.hovering_gutter = false
@@ -166,67 +168,145 @@ function DocView:get_visible_line_range()
 end
 
 
-function DocView:get_col_x_offset(line, col)
+-- x offsets are sampled every this amount of characters of a token
+local X_OFFSET_STEP = 64
+-- x offsets are cached for this amount of samples per view, longer lines
+-- being measured without being kept
+local MAX_X_OFFSET_SAMPLES = 16384
+
+-- Whether the fonts, their sizes or the indent size changed since the cached
+-- offsets were measured; the scale plugin resizes the fonts in place.
+local function x_offset_fonts_changed(cache, default_font, indent_size)
+  local fonts = cache.fonts
+  if cache.indent_size ~= indent_size or fonts[default_font] ~= default_font:get_size() then
+    return true
+  end
+  local n = 1
+  for _, font in pairs(style.syntax_fonts) do
+    if fonts[font] ~= font:get_size() then return true end
+    n = n + 1
+  end
+  return n ~= cache.font_count
+end
+
+local function reset_x_offset_cache(cache, default_font, indent_size)
+  local fonts, n = { [default_font] = default_font:get_size() }, 1
+  for _, font in pairs(style.syntax_fonts) do
+    fonts[font] = font:get_size()
+    n = n + 1
+  end
+  cache.lines, cache.size = setmetatable({}, { __mode = "k" }), 0
+  cache.fonts, cache.font_count, cache.indent_size = fonts, n, indent_size
+end
+
+-- Returns the column and x offset of samples of a line, at the start of each
+-- token and every X_OFFSET_STEP characters within it, the font of the token
+-- holding each sample, and the amount of samples, the last entry being the end
+-- of the line. They're kept as long as the tokens of the line, the highlighter
+-- replacing them when the line changes or is retokenized.
+local function get_x_offsets(self, line)
+  local highlighter = self.doc.highlighter
+  local hl_line = highlighter:get_line(line)
   local default_font = self:get_font()
   local _, indent_size = self.doc:get_indent_info()
+  local cache = self.x_offset_cache
+  if x_offset_fonts_changed(cache, default_font, indent_size) then
+    reset_x_offset_cache(cache, default_font, indent_size)
+  end
+  local entry = cache.lines[hl_line]
+  if entry then
+    return entry, hl_line.text
+  end
+
   default_font:set_tab_size(indent_size)
-  local column = 1
-  local xoffset = 0
-  for _, type, text in self.doc.highlighter:each_token(line) do
+  local cols, xs, fonts, n = {}, {}, {}, 0
+  local column, xoffset = 1, 0
+  for _, type, text in highlighter:each_token(line) do
     local font = style.syntax_fonts[type] or default_font
     if font ~= default_font then font:set_tab_size(indent_size) end
-    local length = #text
-    if column + length <= col then
-      xoffset = xoffset + font:get_width(text)
-      column = column + length
-      if column >= col then
-        return xoffset
-      end
-    else
-      for char in common.utf8_chars(text) do
-        if column >= col then
-          return xoffset
-        end
-        xoffset = xoffset + font:get_width(char)
-        column = column + #char
+    local widths, k = font:get_prefix_widths(text), 0
+    for char in common.utf8_chars(text) do
+      if k % X_OFFSET_STEP == 0 then
+        n = n + 1
+        cols[n], fonts[n] = column, font
+        xs[n] = xoffset + (k > 0 and (widths[k] or widths[#widths] or 0) or 0)
       end
+      k = k + 1
+      column = column + #char
     end
+    xoffset = xoffset + (widths[#widths] or 0)
   end
+  cols[n + 1], xs[n + 1] = column, xoffset
 
-  return xoffset
+  entry = { cols = cols, xs = xs, fonts = fonts, n = n }
+  if n <= MAX_X_OFFSET_SAMPLES then
+    if cache.size + n > MAX_X_OFFSET_SAMPLES then
+      reset_x_offset_cache(cache, default_font, indent_size)
+    end
+    cache.lines[hl_line] = entry
+    cache.size = cache.size + n
+  end
+  return entry, hl_line.text
 end
 
 
-function DocView:get_x_offset_col(line, x)
-  local line_text = self.doc.lines[line]
-
-  local xoffset, last_i, i = 0, 1, 1
-  local default_font = self:get_font()
-  local _, indent_size = self.doc:get_indent_info()
-  default_font:set_tab_size(indent_size)
-  for _, type, text in self.doc.highlighter:each_token(line) do
-    local font = style.syntax_fonts[type] or default_font
-    if font ~= default_font then font:set_tab_size(indent_size) end
-    local width = font:get_width(text)
-    -- Don't take the shortcut if the width matches x,
-    -- because we need last_i which should be calculated using utf-8.
-    if xoffset + width < x then
-      xoffset = xoffset + width
-      i = i + #text
-    else
-      for char in common.utf8_chars(text) do
-        local w = font:get_width(char)
-        if xoffset >= x then
-          return (xoffset - x > w / 2) and last_i or i
-        end
-        xoffset = xoffset + w
-        last_i = i
-        i = i + #char
-      end
-    end
+-- largest index up to `n` whose value is at most `value`
+local function bisect(t, value, n)
+  if n < 1 or t[1] > value then return nil end
+  local lo, hi = 1, n
+  while lo < hi do
+    local mid = math.floor((lo + hi + 1) / 2)
+    if t[mid] > value then hi = mid - 1 else lo = mid end
+  end
+  return lo
+end
+
+
+-- Calls `fn` with the start column, start x, end column and end x of each
+-- character from sample `k` to the next one, until it returns a value.
+local function each_sampled_char(self, entry, text, k, fn)
+  local cols, xs = entry.cols, entry.xs
+  local font = entry.fonts[k]
+  font:set_tab_size(self.x_offset_cache.indent_size)
+  local sample = text:sub(cols[k], cols[k + 1] - 1)
+  local widths, i = font:get_prefix_widths(sample), 0
+  local col, x = cols[k], xs[k]
+  for char in common.utf8_chars(sample) do
+    i = i + 1
+    local col2, x2 = col + #char, xs[k] + (widths[i] or widths[#widths] or 0)
+    if col2 >= cols[k + 1] then x2 = xs[k + 1] end
+    local result = fn(col, x, col2, x2)
+    if result then return result end
+    col, x = col2, x2
   end
+end
+
 
-  return #line_text
+function DocView:get_col_x_offset(line, col)
+  local entry, text = get_x_offsets(self, line)
+  local k = bisect(entry.cols, col, entry.n)
+  if not k then return 0 end
+  if entry.cols[k] == col then return entry.xs[k] end
+  return each_sampled_char(self, entry, text, k, function(_, _, col2, x2)
+    if col2 >= col then return x2 end
+  end) or entry.xs[entry.n + 1]
+end
+
+
+function DocView:get_x_offset_col(line, x)
+  local entry, text = get_x_offsets(self, line)
+  local cols, xs, n = entry.cols, entry.xs, entry.n
+  local k = bisect(xs, x, n)
+  if not k then return 1 end
+  if xs[k] == x then return cols[k] end
+  -- only the start of the characters, the end of the line isn't a column
+  local last = cols[n + 1]
+  return each_sampled_char(self, entry, text, k, function(col1, x1, col2, x2)
+    if x2 >= x then
+      if col2 >= last then return #text end
+      return x2 - x > (x2 - x1) / 2 and col1 or col2
+    end
+  end) or (k < n and cols[k + 1] or #text)
 end
 
 
@@ -562,7 +642,27 @@ function DocView:draw_overlay()
   end
 end
 
+function DocView:draw_scroll()
+  local pos, size = self.position, self.size
+  local gw = self:get_gutter_width()
+  local ox, oy = self:get_content_offset()
+  local last = self.last_draw_offset
+  if last.x == pos.x and last.y == pos.y and last.w == size.x and last.h == size.y and last.gw == gw then
+    if last.ox == ox and last.oy ~= oy then
+      renderer.scroll_rect(pos.x, pos.y, size.x, size.y, 0, oy - last.oy)
+    elseif last.oy == oy and last.ox ~= ox then
+      -- the gutter doesn't move horizontally
+      renderer.scroll_rect(pos.x + gw, pos.y, size.x - gw, size.y, ox - last.ox, 0)
+    end
+  end
+  last.x, last.y, last.w, last.h, last.gw = pos.x, pos.y, size.x, size.y, gw
+  last.ox, last.oy = ox, oy
+end
+
+
 function DocView:draw()
+  -- let the renderer move what is already on screen instead of redrawing it
+  self:draw_scroll()
   self:draw_background(style.background)
   local _, indent_size = self.doc:get_indent_info()
   self:get_font():set_tab_size(indent_size)
@@ -55,11 +55,44 @@ local function update_recents_project(action, dir_path_abs)
 end
 
 
+-- The file list of a project directory is saved under USERDIR, with a key
+-- telling what it was scanned with, see system.save_project_index.
+local function project_index_path(topdir)
+  local hash = 2166136261
+  for i = 1, #topdir.name do
+    hash = ((hash ~ topdir.name:byte(i)) * 16777619) & 0xffffffff
+  end
+  return USERDIR .. PATHSEP .. "project_index" .. PATHSEP .. string.format("%08x", hash)
+end
+
+local function project_index_key(topdir)
+  return table.concat({ topdir.name, common.serialize(config.ignore_files),
+    config.file_size_limit }, "\n")
+end
+
+
+local function save_project_index(topdir)
+  if not config.project_index or topdir.files_limit then return end
+  local dir = USERDIR .. PATHSEP .. "project_index"
+  if not system.get_file_info(dir) then system.mkdir(dir) end
+  local ok, err = system.save_project_index(project_index_path(topdir),
+    project_index_key(topdir), topdir.files)
+  if not ok then core.log_quiet("Cannot save the project index: %s", err) end
+end
+
+
+local function load_project_index(topdir)
+  if not config.project_index then return end
+  return system.load_project_index(project_index_path(topdir), project_index_key(topdir))
+end
+
+
 function core.set_project_dir(new_dir, change_project_fn)
   local chdir_ok = pcall(system.chdir, new_dir)
   if chdir_ok then
     if change_project_fn then change_project_fn() end
     core.project_dir = common.normalize_volume(new_dir)
+    for _, dir in ipairs(core.project_directories) do save_project_index(dir) end
     core.project_directories = {}
   end
   return chdir_ok
@@ -185,7 +218,7 @@ local function refresh_directory(topdir, target)
     directory_start_idx = directory_start_idx + 1
   end
 
-  local files = dirwatch.get_directory_files(topdir, topdir.name, (target or ""), {}, 0, function() return false end)
+  local files = dirwatch.scan_directory(topdir.name, target or "")
   local change = false
 
   -- If this file doesn't exist, we should be calling this on our parent directory, assume we'll do that.
@@ -239,12 +272,119 @@ local function refresh_directory(topdir, target)
 end
 
 
--- Predicate function to inhibit directory recursion in get_directory_files
--- based on a time limit and the number of files.
-local function timed_max_files_pred(dir, filename, entries_count, t_elapsed)
-  local n_limit = entries_count <= config.max_project_files
-  local t_limit = t_elapsed < 20 / config.fps
-  return n_limit and t_limit and core.project_subdir_is_shown(dir, filename)
+-- Applies the change of a single entry of a directory, told by the directory
+-- monitor, instead of listing the whole directory again. The entry is checked
+-- on disk as events can come late or out of order.
+local function refresh_entry(topdir, dirpath, name, kind)
+  -- the content of a file changed, not the list
+  if kind == "modify" then return false end
+  local filename = dirpath == "" and name or dirpath .. PATHSEP .. name
+  local new_info = dirwatch.get_file_info(topdir.name, filename)
+  local old_idx, old_info
+  for _, type in ipairs { "dir", "file" } do
+    local idx, found = file_search(topdir.files, { filename = filename, type = type })
+    if found then
+      old_idx, old_info = idx, topdir.files[idx]
+      break
+    end
+  end
+  if files_info_equal(new_info, old_info) then return false end
+
+  if old_info then
+    local count = 1
+    if old_info.type == "dir" then
+      count = select(2, project_subdir_bounds(topdir, filename, old_idx))
+      for i = old_idx, old_idx + count - 1 do
+        if topdir.files[i].type == "dir" then
+          topdir.watch:unwatch(topdir.name .. PATHSEP .. topdir.files[i].filename)
+        end
+      end
+    end
+    local n = #topdir.files
+    table.move(topdir.files, old_idx + count, n, old_idx)
+    for i = n - count + 1, n do topdir.files[i] = nil end
+  end
+  if new_info then
+    table.insert(topdir.files, (file_search(topdir.files, new_info)), new_info)
+    if new_info.type == "dir" then
+      topdir.watch:watch(topdir.name .. PATHSEP .. filename)
+      if not topdir.files_limit or core.project_subdir_is_shown(topdir, filename) then
+        refresh_directory(topdir, filename)
+      end
+    end
+  end
+  core.redraw = true
+  topdir.is_dirty = true
+  return true
+end
+
+
+local function project_dir_is_open(topdir)
+  for _, prj in ipairs(core.project_directories) do
+    if topdir == prj then return true end
+  end
+  return false
+end
+
+
+-- Checks a file list loaded from the index against the disk, listing again the
+-- directories modified since, and watches its directories.
+local function check_project_index(topdir)
+  core.add_thread(function()
+    local dirs = {}
+    for _, info in ipairs(topdir.files) do
+      if info.type == "dir" then table.insert(dirs, info) end
+    end
+    local changed = refresh_directory(topdir)
+    local start_time = system.get_time()
+    for _, dir in ipairs(dirs) do
+      local idx, found = file_search(topdir.files, dir)
+      local path = topdir.name .. PATHSEP .. dir.filename
+      -- a directory still listed is the same table, unless removed and added again
+      local info = found and topdir.files[idx] == dir and system.get_file_info(path)
+      if info then
+        if info.modified ~= dir.modified then
+          dir.modified = info.modified
+          changed = refresh_directory(topdir, dir.filename) or changed
+        end
+        topdir.watch:watch(path)
+      end
+      if system.get_time() - start_time > 0.01 then
+        coroutine.yield(0.01)
+        if not project_dir_is_open(topdir) then return end
+        start_time = system.get_time()
+      end
+    end
+    if changed then save_project_index(topdir) end
+  end)
+end
+
+
+-- On a filesystem too slow to scan the project when it's opened, it's scanned
+-- in the background one directory at a time, for the index to be used the
+-- next time. The scan gives up past the files limit.
+local function build_project_index(topdir)
+  if not config.project_index then return end
+  core.add_thread(function()
+    local files = {}
+    local start_time = system.get_time()
+    local function scan(path)
+      for _, info in ipairs(dirwatch.scan_directory(topdir.name, path) or {}) do
+        table.insert(files, info)
+        if #files > config.max_project_files then return false end
+        if info.type == "dir" and not scan(info.filename) then return false end
+        if system.get_time() - start_time > 0.01 then
+          coroutine.yield(0.01)
+          if not project_dir_is_open(topdir) then return false end
+          start_time = system.get_time()
+        end
+      end
+      return true
+    end
+    if scan("") then
+      save_project_index({ name = topdir.name, files = files })
+    end
+  end)
 end
 
 
@@ -266,16 +406,29 @@ function core.add_project_directory(path)
 
   local fstype = PLATFORM == "Linux" and system.get_fs_type(topdir.name) or "unknown"
   topdir.force_scans = (fstype == "nfs" or fstype == "fuse")
-  local t, complete, entries_count = dirwatch.get_directory_files(topdir, topdir.name, "", {}, 0, timed_max_files_pred)
-  topdir.files = t
-  if not complete then
-    topdir.slow_filesystem = not complete and (entries_count <= config.max_project_files)
-    topdir.files_limit = true
-    show_max_files_warning(topdir)
-    refresh_directory(topdir)
+  local t = load_project_index(topdir)
+  if t then
+    topdir.files = t
+    check_project_index(topdir)
   else
-    for i,v in ipairs(t) do
-      if v.type == "dir" then topdir.watch:watch(path .. PATHSEP .. v.filename) end
+    -- the whole tree is listed on native threads, up to the files limit and
+    -- within a time limit
+    local complete, entries_count
+    t, complete, entries_count = dirwatch.scan_directory(topdir.name, "", true,
+      config.max_project_files, 20 / config.fps)
+    t = t or {}
+    topdir.files = t
+    if not complete then
+      topdir.slow_filesystem = not complete and (entries_count <= config.max_project_files)
+      topdir.files_limit = true
+      show_max_files_warning(topdir)
+      refresh_directory(topdir)
+      if topdir.slow_filesystem then build_project_index(topdir) end
+    else
+      for i,v in ipairs(t) do
+        if v.type == "dir" then topdir.watch:watch(path .. PATHSEP .. v.filename) end
+      end
+      save_project_index(topdir)
     end
   end
   topdir.watch:watch(topdir.name)
@@ -286,8 +439,11 @@ function core.add_project_directory(path)
   -- time; the watch will yield in this coroutine after 0.01 second, for 0.1 seconds.
   topdir.watch_thread = core.add_thread(function()
     while true do
-      local changed = topdir.watch:check(function(target)
-        if target == topdir.name then return refresh_directory(topdir) end
+      local changed = topdir.watch:check(function(target, name, kind)
+        if target == topdir.name then
+          if name and kind then return refresh_entry(topdir, "", name, kind) end
+          return refresh_directory(topdir)
+        end
         local dirpath = target:sub(#topdir.name + 2)
         local abs_dirpath = topdir.name .. PATHSEP .. dirpath
         if dirpath then
@@ -295,17 +451,11 @@ function core.add_project_directory(path)
           local dir_index, dir_match = file_search(topdir.files, {filename = dirpath, type = "dir"})
           if not dir_match or not core.project_subdir_is_shown(topdir, topdir.files[dir_index].filename) then return end
         end
+        if name and kind then return refresh_entry(topdir, dirpath, name, kind) end
         return refresh_directory(topdir, dirpath)
       end, 0.01, 0.01)
       -- properly exit coroutine if project not open anymore to clear dir watch
-      local project_dir_open = false
-      for _, prj in ipairs(core.project_directories) do
-        if topdir == prj then
-          project_dir_open = true
-          break
-        end
-      end
-      if project_dir_open then
+      if project_dir_is_open(topdir) then
         coroutine.yield(changed and 0 or 0.05)
       else
         return
@@ -388,17 +538,20 @@ end
 -- Filter files and yields file's directory and info table. This latter
 -- is filled to be like required by project directories "files" list.
 local function find_files_rec(root, path)
-  local all = system.list_dir(root .. path) or {}
-  for _, file in ipairs(all) do
+  local all = system.list_dir_info(root .. path)
+  if not all then return end
+  for i, file in ipairs(all.names) do
     local file = path .. PATHSEP .. file
-    local info = system.get_file_info(root .. file)
-    if info then
-      info.filename = strip_leading_path(file)
-      if info.type == "file" then
-        coroutine.yield(root, info)
-      elseif not common.match_pattern(common.basename(info.filename), config.ignore_files) then
-        find_files_rec(root, PATHSEP .. info.filename)
-      end
+    local info = {
+      filename = strip_leading_path(file),
+      type = all.types[i],
+      size = all.sizes[i],
+      modified = all.modified[i]
+    }
+    if info.type == "file" then
+      coroutine.yield(root, info)
+    elseif not common.match_pattern(common.basename(info.filename), config.ignore_files) then
+      find_files_rec(root, PATHSEP .. info.filename)
     end
   end
 end
@@ -620,6 +773,7 @@ function core.remove_project_directory(path)
   for i = 2, #core.project_directories do
     local dir = core.project_directories[i]
     if dir.name == path then
+      save_project_index(dir)
       table.remove(core.project_directories, i)
       return true
     end
@@ -908,6 +1062,7 @@ local function quit_with_function(quit_fn, force)
   if force then
     core.delete_temp_files()
     core.on_quit_project()
+    for _, dir in ipairs(core.project_directories) do save_project_index(dir) end
     save_session()
     quit_fn()
   else
@@ -1336,7 +1491,44 @@ function core.compose_window_title(title)
 end
 
 
+local render_stats_lua_time = 0
+
+-- overlay with the time spent in Lua and by the renderer, averaged over the last frames
+local function draw_render_stats(lua_time)
+  local frames = renderer.get_stats(60)
+  local last = frames[#frames]
+  if not last then return end
+  local hash_time, draw_time, present_time = 0, 0, 0
+  for _, frame in ipairs(frames) do
+    hash_time = hash_time + frame.hash_time / #frames
+    draw_time = draw_time + frame.draw_time / #frames
+    present_time = present_time + frame.present_time / #frames
+  end
+  render_stats_lua_time = render_stats_lua_time + (lua_time - render_stats_lua_time) / 10
+  local lines = {
+    string.format("lua     %6.2f ms", render_stats_lua_time * 1000),
+    string.format("hash    %6.2f ms", hash_time * 1000),
+    string.format("draw    %6.2f ms", draw_time * 1000),
+    string.format("present %6.2f ms", present_time * 1000),
+    string.format("rects %d, %.1f kpx", last.rects, last.pixels / 1000),
+    string.format("commands %d, %d KB", last.commands, math.floor(last.command_bytes / 1024)),
+  }
+  local font = style.code_font
+  local lh = font:get_height()
+  local w = 0
+  for _, line in ipairs(lines) do w = math.max(w, font:get_width(line)) end
+  local x = core.root_view.size.x - w - style.padding.x * 3
+  local y = style.padding.y
+  renderer.set_clip_rect(table.unpack(core.clip_rect_stack[1]))
+  renderer.draw_rect(x, y, w + style.padding.x * 2, lh * #lines + style.padding.y * 2, style.background3)
+  for i, line in ipairs(lines) do
+    renderer.draw_text(font, line, x + style.padding.x, y + style.padding.y + (i - 1) * lh, style.text)
+  end
+end
+
+
 function core.step()
+  local step_start = system.get_time()
   -- handle events
   local did_keymap = false
 
@@ -1395,13 +1587,26 @@ function core.step()
     core.window_title = current_title
   end
 
-  -- draw
+  core.draw_frame(step_start)
+  return true
+end
+
+
+---Draws the views, called by `core.step` and by long blocking operations
+---that show their progress.
+---@param step_start? number Time at which the step started, for the stats.
+function core.draw_frame(step_start)
+  local width, height = renderer.get_size()
+  renderer.set_render_threads(config.render_threads)
+  renderer.set_glyph_cache_size(config.glyph_cache_size * 1024 * 1024)
   renderer.begin_frame()
   core.clip_rect_stack[1] = { 0, 0, width, height }
   renderer.set_clip_rect(table.unpack(core.clip_rect_stack[1]))
   core.root_view:draw()
+  if config.show_render_stats and step_start then
+    core.try(draw_render_stats, system.get_time() - step_start)
+  end
   renderer.end_frame()
-  return true
 end
 
 
@@ -126,10 +126,12 @@ local function report_bad_pattern(log_fn, syntax, pattern_idx, msg, ...)
             pattern_idx, syntax.name or "unnamed", ...)
 end
 
+---Reference implementation of `tokenizer.tokenize`, the native tokenizer
+---returns the same tokens and states.
 ---@param incoming_syntax table
 ---@param text string
 ---@param state string
-function tokenizer.tokenize(incoming_syntax, text, state, resume)
+function tokenizer.tokenize_lua(incoming_syntax, text, state, resume)
   local res
   local i = 1
 
@@ -377,6 +379,183 @@ function tokenizer.tokenize(incoming_syntax, text, state, resume)
 end
 
 
+-- Compiled syntaxes are cached until syntaxes get added or the patterns or
+-- symbols of a syntax they were compiled from change, a false entry means the
+-- syntax can only be handled by the Lua tokenizer.
+local native_syntaxes = setmetatable({}, { __mode = "k" })
+
+local function report_native_bad_pattern(syn, pattern_idx, n_types, n_results)
+  local p = syn.patterns[pattern_idx]
+  if n_results == 2 and type(p.type) == "table" then
+    report_bad_pattern(core.warn, syn, pattern_idx,
+      "Token type is a table, but a string was expected.")
+    p.type = p.type[1]
+  elseif n_results - 1 > n_types then
+    report_bad_pattern(core.error, syn, pattern_idx,
+      "Not enough token types: got %d needed %d.", n_types, n_results - 1)
+  elseif n_results - 1 < n_types then
+    report_bad_pattern(core.warn, syn, pattern_idx,
+      "Too many token types: got %d needed %d.", n_types, n_results - 1)
+  end
+end
+
+local function copy_field(value)
+  return type(value) == "table" and { table.unpack(value) } or value
+end
+
+local function same_field(value, copy)
+  if type(value) ~= "table" or type(copy) ~= "table" then
+    return value == copy
+  end
+  if #value ~= #copy then return false end
+  for i = 1, #copy do
+    if value[i] ~= copy[i] then return false end
+  end
+  return true
+end
+
+-- Records the patterns and symbols of a syntax and of the subsyntaxes it can
+-- enter, as they were read by native_tokenizer.compile.
+local function snapshot_syntax(syn, snapshot)
+  if snapshot[syn] then return end
+  local patterns, symbols, n_symbols = {}, {}, 0
+  for i, p in ipairs(syn.patterns or {}) do
+    patterns[i] = {
+      table = p, pattern = copy_field(p.pattern), regex = copy_field(p.regex),
+      type = copy_field(p.type), syntax = p.syntax
+    }
+  end
+  for symbol, type in pairs(syn.symbols or {}) do
+    symbols[symbol] = type
+    n_symbols = n_symbols + 1
+  end
+  snapshot[syn] = {
+    patterns_table = syn.patterns, patterns = patterns,
+    symbols_table = syn.symbols, symbols = symbols, n_symbols = n_symbols
+  }
+  for _, p in ipairs(patterns) do
+    if p.syntax then
+      local sub = type(p.syntax) == "table" and p.syntax or syntax.get(p.syntax)
+      if sub then snapshot_syntax(sub, snapshot) end
+    end
+  end
+  return snapshot
+end
+
+local function syntax_changed(snapshot)
+  for syn, s in pairs(snapshot) do
+    if syn.patterns ~= s.patterns_table or syn.symbols ~= s.symbols_table
+      or #(syn.patterns or {}) ~= #s.patterns
+    then
+      return true
+    end
+    for i, p in ipairs(syn.patterns or {}) do
+      local c = s.patterns[i]
+      if p ~= c.table or p.syntax ~= c.syntax or not same_field(p.pattern, c.pattern)
+        or not same_field(p.regex, c.regex) or not same_field(p.type, c.type)
+      then
+        return true
+      end
+    end
+    local n_symbols = 0
+    for symbol, type in pairs(syn.symbols or {}) do
+      if s.symbols[symbol] ~= type then return true end
+      n_symbols = n_symbols + 1
+    end
+    if n_symbols ~= s.n_symbols then return true end
+  end
+  return false
+end
+
+-- Plugins may edit the patterns or symbols of a syntax in place, so they're
+-- compared with the ones it was compiled from once per frame.
+local function get_native_syntax(incoming_syntax)
+  local entry = native_syntaxes[incoming_syntax]
+  if entry and entry.items ~= #syntax.items then
+    entry = nil
+  elseif entry and entry.frame ~= core.frame_start then
+    entry.frame = core.frame_start
+    if syntax_changed(entry.snapshot) then entry = nil end
+  end
+  if not entry then
+    local ok, compiled = pcall(native_tokenizer.compile, incoming_syntax,
+      syntax.get, report_native_bad_pattern)
+    if not ok then
+      core.log_quiet("Using the Lua tokenizer for %s: %s",
+        incoming_syntax.name or "unnamed", compiled)
+    end
+    entry = {
+      native = ok and compiled,
+      items = #syntax.items,
+      frame = core.frame_start,
+      snapshot = snapshot_syntax(incoming_syntax, {})
+    }
+    native_syntaxes[incoming_syntax] = entry
+  end
+  return entry.native
+end
+
+---@param incoming_syntax table
+---@param text string
+---@param state string
+function tokenizer.tokenize(incoming_syntax, text, state, resume)
+  if #incoming_syntax.patterns == 0 then
+    return { "normal", text }
+  end
+
+  local native = get_native_syntax(incoming_syntax)
+  -- Resume information can only be used by the tokenizer that created it
+  if resume and (resume.native == true) ~= (native and true or false) then
+    resume = nil
+  end
+  if not native then
+    return tokenizer.tokenize_lua(incoming_syntax, text, state, resume)
+  end
+
+  local res, i
+  state = state or string.char(0)
+  if resume then
+    res = resume.res
+    -- Remove "incomplete" tokens
+    while res[#res-1] == "incomplete" do
+      table.remove(res, #res)
+      table.remove(res, #res)
+    end
+    i = resume.i
+    state = resume.state
+  end
+
+  local incomplete_i
+  res, state, incomplete_i =
+    native_tokenizer.tokenize(native, text, state, res, i, 0.5 / config.fps)
+  if incomplete_i then
+    return res, string.char(0), {
+      res = res,
+      i = incomplete_i,
+      state = state,
+      native = true
+    }
+  end
+  return res, state
+end
+
+
+---Starts tokenizing `lines[first..last]` on a background thread.
+---Returns nil when the syntax can't be tokenized natively.
+---@param incoming_syntax table
+---@param lines string[]
+---@param first integer
+---@param last integer
+---@param state string
+---@return native_tokenizer.job?
+function tokenizer.tokenize_lines(incoming_syntax, lines, first, last, state)
+  if #incoming_syntax.patterns == 0 then return nil end
+  local native = get_native_syntax(incoming_syntax)
+  if not native then return nil end
+  return native:tokenize_lines(lines, first, last, state or string.char(0))
+end
+
+
 local function iter(t, i)
   i = i + 2
   local type, text = t[i], t[i+1]
@@ -65,9 +65,10 @@ end
 
 local on_check = dirwatch.check
 function dirwatch:check(change_callback, ...)
-  on_check(self, function(dir)
+  on_check(self, function(dir, name, kind)
     for _, doc in ipairs(core.docs) do
-      if doc.abs_filename and (dir == common.dirname(doc.abs_filename) or dir == doc.abs_filename) then
+      if doc.abs_filename and (dir == doc.abs_filename or (dir == common.dirname(doc.abs_filename)
+        and (not name or name == common.basename(doc.abs_filename)))) then
         local info = system.get_file_info(doc.filename or "")
         if info and times[doc] ~= info.modified then
           if not doc:is_dirty() and not config.plugins.autoreload.always_show_nagview then
@@ -79,7 +80,7 @@ function dirwatch:check(change_callback, ...)
         end
       end
     end
-    change_callback(dir)
+    change_callback(dir, name, kind)
   end, ...)
 end
 
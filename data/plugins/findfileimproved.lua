@@ -22,17 +22,15 @@ local coroutine_running = false
 
 
 local function basedir_files()
-  local files = system.list_dir(project_directory)
+  local files = system.list_dir_info(project_directory, true)
   local files_return = {}
 
   if files then
-    for _, file in ipairs(files) do
-      local info = system.get_file_info(
-        project_directory .. PATHSEP .. file
-      )
+    for i, file in ipairs(files.names) do
+      local file_type = files.types[i]
 
-      if info and not common.match_pattern(file, config.ignore_files) then
-        if info.type ~= "dir" then
+      if not common.match_pattern(file, config.ignore_files) then
+        if file_type ~= "dir" then
           table.insert(files_return, file)
         end
       end
@@ -109,20 +107,18 @@ local function index_files_thread(pathsep, ignore_files)
         dir_path = root
       end
 
-      local files = system.list_dir(dir_path)
+      local files = system.list_dir_info(dir_path, true)
 
       if files then
-        for _, file in ipairs(files) do
-          local info = system.get_file_info(
-            dir_path .. pathsep .. file
-          )
+        for i, file in ipairs(files.names) do
+          local file_type = files.types[i]
 
           if
-            info and not commons.match_pattern(
+            not commons.match_pattern(
               file, ignore_files
             )
           then
-            if info.type == "dir" then
+            if file_type == "dir" then
               table.insert(directories, directory .. file)
             else
               table.insert(files_found, directory .. file)
@@ -233,20 +229,18 @@ local function index_files_coroutine()
             dir_path = root
           end
 
-          local files = system.list_dir(dir_path)
+          local files = system.list_dir_info(dir_path, true)
 
           if files then
-            for _, file in ipairs(files) do
-              local info = system.get_file_info(
-                dir_path .. PATHSEP .. file
-              )
+            for i, file in ipairs(files.names) do
+              local file_type = files.types[i]
 
               if
-                info and not common.match_pattern(
+                not common.match_pattern(
                   file, config.ignore_files
                 )
               then
-                if info.type == "dir" then
+                if file_type == "dir" then
                   table.insert(directories, directory .. file)
                 else
                   table.insert(project_files, directory .. file)
@@ -340,6 +340,21 @@ function Doc:raw_remove(line1, col1, line2, col2, undo_stack, time)
   end
 end
 
+local old_doc_apply_edits = Doc.raw_apply_edits
+function Doc:raw_apply_edits(edits, undo_stack, time)
+  local old_lines = #self.lines
+  local line1, line2 = edits[1] and edits[1][1], edits[#edits] and edits[#edits][3]
+  old_doc_apply_edits(self, edits, undo_stack, time)
+  if open_files[self] and line1 then
+    for i,docview in ipairs(open_files[self]) do
+      if docview.wrapped_settings then
+        local lines = #self.lines - old_lines
+        LineWrapping.update_breaks(docview, line1, line2, lines)
+      end
+    end
+  end
+end
+
 local old_doc_update = DocView.update
 function DocView:update()
   old_doc_update(self)
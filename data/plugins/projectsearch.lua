@@ -227,20 +227,18 @@ local function files_search_threaded(
         dir_path = root
       end
 
-      local files = system.list_dir(dir_path)
+      local files = system.list_dir_info(dir_path, true)
 
       if files then
-        for _, file in ipairs(files) do
-          local info = system.get_file_info(
-            dir_path .. pathsep .. file
-          )
+        for i, file in ipairs(files.names) do
+          local file_type = files.types[i]
           count = count + 1
           if
-            info and not commons.match_pattern(
+            not commons.match_pattern(
               file, ignore_files
             )
           then
-            if info.type == "dir" then
+            if file_type == "dir" then
               table.insert(directories, directory .. file)
             else
               filename_channels[current_worker]:push(dir_path .. pathsep .. file)
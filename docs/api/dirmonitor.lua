@@ -7,7 +7,13 @@
 ---@class dirmonitor
 dirmonitor = {}
 
----@alias dirmonitor.callback fun(fd_or_path:integer|string)
+---@alias dirmonitor.change
+---| "create" # An entry was added or moved in.
+---| "delete" # An entry was removed or moved out.
+---| "modify" # The content of a file changed.
+---| "overflow" # Changes were lost, everything should be checked again.
+
+---@alias dirmonitor.callback fun(fd_or_path?:integer|string, name?:string, kind?:dirmonitor.change)
 
 ---
 ---Creates a new dirmonitor object.
@@ -45,10 +51,25 @@ function dirmonitor:unwatch(fd_or_path) end
 ---edited, removed or added. A file descriptor will be passed to the
 ---callback in "multiple" mode or a path in "single" mode.
 ---
----@param callback dirmonitor.callback
+---When the backend tells them, the kind of change is passed too and, in
+---"multiple" mode, the name of the changed entry of the watched directory.
+---Currently only inotify gives the names, and inotify and win32 the kinds.
 ---
----@return boolean? changes True when changes were detected.
-function dirmonitor:check(callback) end
+---Changes are read in the background and merged until checked: the changes
+---of an entry are given once, an entry created then deleted isn't given and
+---a directory with many changed entries is given once without a name. When
+---too many changes pile up they're dropped and the callback is called once
+---with "overflow" and no path.
+---
+---@param callback dirmonitor.callback
+---@param delay? number Only give changes older than this, in seconds, so that
+---bursts of changes are merged.
+---@param max_changes? integer Give at most this many changes, the others are
+---kept for the next check.
+---
+---@return boolean? changes True when changes were given, changes waiting for
+---the delay wake the main loop up once they're due.
+function dirmonitor:check(callback, delay, max_changes) end
 
 ---
 ---Get the working mode for the current file system monitoring backend.
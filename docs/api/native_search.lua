@@ -0,0 +1,44 @@
+---@meta
+
+---
+---Native search over the whole text of a document, used by `core.doc.search`.
+---@class native_search
+native_search = {}
+
+---
+---@class native_search.options
+---@field line? integer Line of the first byte of the text, 1 if omitted.
+---@field col? integer Column of that line where the search starts, 1 if
+---omitted.
+---@field no_case? boolean Ignore the case of ASCII letters.
+---@field regex? boolean Search for a regex, in multi-line mode.
+---@field limit? integer Stop after this amount of matches.
+---@field cancel? fun(done:number):boolean? Called now and then with the
+---fraction of the text searched so far, the search stops if it returns true.
+---@field last_line? integer Last line of a table of lines to search.
+---@field more? boolean The text is followed by more of the document, matches
+---that could go on past its end aren't given.
+
+---
+---Finds every match of a plain text or regex, matches can span lines.
+---
+---When searching a table of lines, they're searched from `options.line` and
+---`options.col` up to `options.last_line`. A string is the text from the
+---start of `options.line` and is searched from `options.col`.
+---
+---With `options.more`, the position from which the rest of the document has
+---to be searched is returned when the search wasn't stopped.
+---
+---@param text string|string[] The text, or an array of lines.
+---@param pattern string
+---@param options? native_search.options
+---
+---@return integer[] matches The `line1, col1, line2, col2` of each match, one
+---after the other, the second position being after the last byte.
+---@return boolean complete False if stopped by `limit` or `cancel`.
+---@return integer? next_line
+---@return integer? next_col
+function native_search.find(text, pattern, options) end
+
+
+return native_search
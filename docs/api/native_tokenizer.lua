@@ -0,0 +1,75 @@
+---@meta
+
+---
+---Native implementation of the syntax highlighting tokenizer, used by
+---`core.tokenizer` which keeps the Lua implementation as the reference.
+---@class native_tokenizer
+native_tokenizer = {}
+
+---@alias native_tokenizer.report fun(syntax:table, pattern_idx:integer, types:integer, results:integer)
+
+---
+---Compiles a syntax, and all the subsyntaxes it can enter, into a tokenizer.
+---
+---Patterns are read once, a tokenizer has to be compiled again after the
+---syntax is modified.
+---
+---@param syntax table A syntax as given to `syntax.add`.
+---@param get_syntax fun(name:string):table Resolves the subsyntaxes given by name.
+---@param report native_tokenizer.report Called the first time a pattern
+---matches a different amount of spans than the token types it declares.
+---
+---@return native_tokenizer
+function native_tokenizer.compile(syntax, get_syntax, report) end
+
+---
+---Tokenizes a line of text.
+---
+---@param text string
+---@param state string The state at the end of the previous line.
+---@param res? table Tokens of an incomplete line to append to.
+---@param i? integer Byte where the incomplete line has to be resumed.
+---@param time_limit? number Seconds after which the rest of the line is
+---returned as an "incomplete" token, no limit if omitted.
+---
+---@return table tokens Array of alternating token types and texts.
+---@return string state The state at the end of the line, or where it stopped.
+---@return integer? i Byte where tokenizing stopped if the line is incomplete.
+function native_tokenizer:tokenize(text, state, res, i, time_limit) end
+
+---
+---Tokenizes a range of lines on a background thread.
+---
+---The lines are copied, the tokenizer can be used again right away.
+---Jobs are run one after the other, without any time limit.
+---
+---@param lines string[]
+---@param first integer
+---@param last integer
+---@param state string The state at the end of the line before `first`.
+---
+---@return native_tokenizer.job
+function native_tokenizer:tokenize_lines(lines, first, last, state) end
+
+
+---
+---Lines being tokenized in background.
+---@class native_tokenizer.job
+native_tokenizer.job = {}
+
+---
+---Gets the tokens of the lines once the job is done, reports the bad patterns
+---like `native_tokenizer:tokenize`.
+---
+---@return table|false|nil tokens Array with the tokens of every line, nil if
+---the job is not done, false if it failed or was cancelled.
+---@return table|string states Array with the state at the end of every line,
+---or the error message.
+function native_tokenizer.job:result() end
+
+---
+---Stops the job, waiting for the background thread if it is tokenizing it.
+function native_tokenizer.job:cancel() end
+
+
+return native_tokenizer
@@ -26,6 +26,17 @@ renderer = {}
 ---@field public smoothing boolean
 ---@field public strikethrough boolean
 
+---
+---Work done by the renderer at the end of a frame.
+---@class renderer.stats
+---@field public commands integer Drawing commands issued during the frame.
+---@field public command_bytes integer Size of the command buffer.
+---@field public rects integer Dirty rectangles that got redrawn.
+---@field public pixels integer Pixels that got redrawn.
+---@field public hash_time number Seconds spent finding the changed regions.
+---@field public draw_time number Seconds spent redrawing the changed regions.
+---@field public present_time number Seconds spent updating the window.
+
 ---
 ---@class renderer.font
 renderer.font = {}
@@ -74,6 +85,17 @@ function renderer.font:set_tab_size(chars) end
 ---@return number
 function renderer.font:get_width(text) end
 
+---
+---Get the width in pixels of every prefix of the given text, one
+---entry per UTF-8 character: the n-th entry is the width of the
+---first n characters. Measuring a text once this way is a lot
+---cheaper than measuring each of its characters.
+---
+---@param text string
+---
+---@return number[]
+function renderer.font:get_prefix_widths(text) end
+
 ---
 ---Get the height in pixels that occupies a single character
 ---when rendered with this font.
@@ -107,6 +129,31 @@ function renderer.font:get_path() end
 ---@param enable boolean
 function renderer.show_debug(enable) end
 
+---
+---Set the amount of threads used to redraw the changed regions of the window,
+---including the main thread. A value of 0 or less picks the amount based on
+---the number of available CPUs.
+---
+---@param count integer
+function renderer.set_render_threads(count) end
+
+---
+---Set the memory budget in bytes of the glyph cache shared by all fonts.
+---When it grows past it, the glyphs that were drawn least recently are
+---evicted at the end of the frame and rasterized again when needed.
+---
+---@param size integer
+function renderer.set_glyph_cache_size(size) end
+
+---
+---Get statistics about the work done by the renderer at the end of the
+---last frames, starting from the oldest one.
+---
+---@param count? integer Maximum amount of frames to return, all the kept ones by default.
+---
+---@return renderer.stats[]
+function renderer.get_stats(count) end
+
 ---
 ---Get the size of the screen area been rendered.
 ---
@@ -131,6 +178,21 @@ function renderer.end_frame() end
 ---@param height number
 function renderer.set_clip_rect(x, y, width, height) end
 
+---
+---Tell the rendering system that the content of a region of the screen
+---moved by the given amount since the previous frame, so that the pixels
+---already on screen get moved instead of redrawn. Only what differs from
+---the moved content, like the newly exposed strip, is drawn again.
+---Only one region is handled per frame.
+---
+---@param x number
+---@param y number
+---@param width number
+---@param height number
+---@param dx integer
+---@param dy integer
+function renderer.scroll_rect(x, y, width, height, dx, dy) end
+
 ---
 ---Draw a rectangle.
 ---
@@ -210,6 +210,30 @@ function system.mkdir(directory_path) end
 ---@return string? message Error message in case of error.
 function system.list_dir(path) end
 
+---
+---@class system.dirinfo
+---@field public names string[] Names of the files and directories.
+---@field public types system.fileinfotype[] Type of each entry.
+---@field public sizes? integer[] Size in bytes of each entry.
+---@field public modified? integer[] Last modification time of each entry, in
+---seconds since the UNIX epoch.
+
+---
+---Lists a directory with the details of its entries, like `system.list_dir`
+---followed by `system.get_file_info` for each entry but in a single call.
+---
+---The details are returned as one array each, the ones of an entry being at
+---the index of its name. Entries that aren't files or directories, or whose
+---details can't be read, are left out.
+---
+---@param path string
+---@param types_only? boolean Only get the types, without sizes and modification
+---times, which avoids reading the details of most entries on some systems.
+---
+---@return system.dirinfo|nil info The entries or nil in case of error.
+---@return string? message Error message in case of error.
+function system.list_dir_info(path, types_only) end
+
 ---
 ---Converts a relative path from current directory to the absolute one.
 ---
@@ -320,6 +344,56 @@ function system.set_window_opacity(opacity) end
 ---@return number nargs the return value of the entrypoint
 function system.load_native_plugin(name, path) end
 
+---
+---@class system.scan_options
+---@field ignore? table[] Entries excluded like by `config.ignore_files`, each
+---with its `pattern` and whether it applies to the path (`use_path`) or only
+---to directories (`match_dir`).
+---@field size_limit? number Files of this size in bytes or more are excluded.
+---@field recursive? boolean List the subdirectories too, on several threads.
+---@field max_files? integer Stop listing subdirectories past this amount of entries.
+---@field max_time? number Stop listing subdirectories after this amount of seconds.
+
+---
+---Lists a directory, and its subdirectories if asked to, as the sorted list
+---of files of a project directory.
+---
+---Each entry has the `filename` relative to `root`, and the `type`, `size`,
+---`modified` and, for directories on Linux, `symlink` fields of
+---`system.get_file_info`. The entries of a directory come right after it.
+---
+---@param root string
+---@param path string Directory to list, relative to `root`, or "".
+---@param options? system.scan_options
+---
+---@return table[]? files
+---@return boolean|string complete_or_error False if some subdirectories weren't listed.
+---@return integer? count Amount of entries found.
+function system.scan_directory(root, path, options) end
+
+---
+---Saves a list of file items like the one of `system.scan_directory` to a
+---compact binary file, replaced only once fully written.
+---
+---@param filename string
+---@param key string Stored with the list, to be checked when loading it.
+---@param files table[]
+---
+---@return boolean|nil ok
+---@return string? message Error message in case of error.
+function system.save_project_index(filename, key, files) end
+
+---
+---Loads a list of file items saved with `system.save_project_index`, reading
+---the file from a memory mapping.
+---
+---@param filename string
+---@param key string
+---
+---@return table[]|nil files The items, or nil if the file can't be read, isn't
+---valid or was saved with another key.
+function system.load_project_index(filename, key) end
+
 ---
 ---Compares two paths in the order used by TreeView.
 ---
@@ -0,0 +1,146 @@
+---@meta
+
+---
+---Native storage for the text of big documents, used by `core.doc` instead of
+---its table of lines for files over `config.text_buffer_threshold`, and to
+---save every document.
+---
+---Lines and columns are 1-based and counted in bytes, every line includes its
+---"\n" like the lines of `core.doc`.
+---@class textbuffer
+textbuffer = {}
+
+---
+---Creates a buffer with the given text.
+---
+---Like when `core.doc` loads a file, the UTF-8 BOM and the "\r" of "\r\n" are
+---removed and a final "\n" is added if missing.
+---
+---@param text? string
+---
+---@return textbuffer
+---@return boolean crlf Whether "\r\n" line endings were found.
+function textbuffer.new(text) end
+
+---
+---Creates a buffer with the content of a file, see `textbuffer.new`.
+---
+---Big read-only files without "\r" are mapped in memory instead of being read,
+---only the edited parts are copied. Files that other programs could write,
+---like growing logs, are always read, as a mapped file changing or getting
+---truncated would corrupt the buffer or crash.
+---
+---@param filename string
+---
+---@return textbuffer? buffer
+---@return boolean|string crlf_or_error
+function textbuffer.load(filename) end
+
+---
+---@class textbuffer.save_options
+---@field crlf? boolean Write "\r\n" line endings.
+---@field charset? string Encoding to convert the text to, UTF-8 if omitted.
+---@field bom? string Bytes written before the text.
+---@field progress? fun(done:number) Called with the fraction of the text
+---written so far, an error raised by it cancels the save.
+
+---
+---Writes the text to a file.
+---
+---The text is written to a temporary file in the same directory, which is
+---synced to disk and renamed over the file, so the file is left untouched if
+---saving fails. Hard links, special files and files in directories that can't
+---be written are overwritten in place instead.
+---
+---@param filename string
+---@param options? textbuffer.save_options
+---
+---@return boolean? ok
+---@return string? error
+function textbuffer:save(filename, options) end
+
+---
+---Writes an array of lines to a file like `textbuffer:save`.
+---
+---@param lines string[]
+---@param filename string
+---@param options? textbuffer.save_options
+---
+---@return boolean? ok
+---@return string? error
+function textbuffer.save_lines(lines, filename, options) end
+
+---
+---@param line integer
+---
+---@return string? line The line, including its "\n", nil if out of range.
+function textbuffer:get_line(line) end
+
+---
+---@param line integer
+---
+---@return integer? length Length in bytes of the line, including its "\n".
+function textbuffer:get_line_length(line) end
+
+---
+---@return integer
+function textbuffer:get_line_count() end
+
+---
+---@return integer length Length of the text in bytes.
+function textbuffer:get_length() end
+
+---
+---Gets the text between two positions, or the whole text if they're omitted.
+---
+---@param line1? integer
+---@param col1? integer
+---@param line2? integer
+---@param col2? integer Position after the last byte.
+---
+---@return string
+function textbuffer:get_text(line1, col1, line2, col2) end
+
+---
+---@param line integer
+---@param col integer
+---@param text string
+---
+---@return integer lines Amount of lines added.
+---@return integer length Length of the text after its last "\n".
+function textbuffer:insert(line, col, text) end
+
+---
+---@param line1 integer
+---@param col1 integer
+---@param line2 integer
+---@param col2 integer Position after the last removed byte.
+function textbuffer:remove(line1, col1, line2, col2) end
+
+---
+---@param line integer
+---@param col integer
+---
+---@return integer offset 1-based byte offset of the position.
+function textbuffer:get_offset(line, col) end
+
+---
+---@param offset integer 1-based byte offset.
+---
+---@return integer line
+---@return integer col
+function textbuffer:get_position(offset) end
+
+---
+---Moves a position by a number of UTF-8 characters, across lines.
+---
+---@param line integer
+---@param col integer
+---@param chars integer Negative to move backwards.
+---
+---@return integer line
+---@return integer col
+function textbuffer:utf8_offset(line, col, chars) end
+
+
+return textbuffer
@@ -0,0 +1,243 @@
+/* Compares the hash used by the render cache to the 32bit FNV-1a it replaced,
+** by replaying the commands of recorded frames through the cell update loop of
+** rencache_end_frame with both.
+**
+** To record frames, build lite-xl with -DRENCACHE_RECORD in c_args and run it
+** with LITE_RENCACHE_RECORD set to the output file. Without a recording, a
+** frame resembling a full screen of code is generated.
+**
+**   cc -O2 -o rencache-hash-bench scripts/rencache-hash-bench.c
+**   ./rencache-hash-bench [recording] [iterations]
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  int32_t x1, y1, x2, y2;
+  uint32_t size;
+  const uint8_t *data;
+} Record;
+
+typedef struct {
+  int cells_x, cells_y;
+  Record *records;
+  int count;
+} Frame;
+
+static Frame *frames;
+static int frame_count;
+static uint8_t *recording;
+
+
+static void* check_alloc(void *ptr) {
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+
+static void push_record(Record r) {
+  Frame *f = &frames[frame_count - 1];
+  f->records = check_alloc(realloc(f->records, (f->count + 1) * sizeof(Record)));
+  f->records[f->count++] = r;
+}
+
+
+static void push_frame(int cells_x, int cells_y) {
+  frames = check_alloc(realloc(frames, (frame_count + 1) * sizeof(Frame)));
+  frames[frame_count++] = (Frame) { cells_x, cells_y, NULL, 0 };
+}
+
+
+static void load_recording(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    fprintf(stderr, "Error: can't open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  recording = check_alloc(malloc(len > 0 ? len : 1));
+  if (fread(recording, 1, len, fp) != (size_t) len) {
+    fprintf(stderr, "Error: can't read %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+
+  for (long i = 0; i + 5 * (long) sizeof(int32_t) <= len;) {
+    int32_t header[5];
+    memcpy(header, recording + i, sizeof(header));
+    i += sizeof(header);
+    if (header[4] == 0) {
+      push_frame(header[0], header[1]);
+    } else if (frame_count > 0 && i + header[4] <= len) {
+      push_record((Record) { header[0], header[1], header[2], header[3], header[4], recording + i });
+      i += header[4];
+    } else {
+      break;
+    }
+  }
+}
+
+
+/* a 1920x1080 window with 24px cells: a background, and 50 lines of code each
+** drawn as 12 tokens */
+static void generate_frame(void) {
+  static const char *tokens[] = { "local", " ", "function", " ", "DocView:get_col_x_offset", "(", "line", ", ", "col", ")", "    ", "return", "\"text\"" };
+  const int cells_x = 1920 / 24 + 1, cells_y = 1080 / 24 + 1;
+  recording = check_alloc(calloc(1, 1 << 20));
+  uint8_t *p = recording;
+  uint32_t seed = 1;
+  push_frame(cells_x, cells_y);
+  /* rect commands are a header and a rect of doubles with a color */
+  push_record((Record) { 0, 0, cells_x - 1, cells_y - 1, 48, p });
+  p += 48;
+  for (int line = 0; line < 50; line++) {
+    int y = line * 21 / 24;
+    int x = 0;
+    for (int t = 0; t < 12; t++) {
+      /* text commands are a header of 152 bytes (rect, color, fonts, x, length
+      ** and tab size) followed by the text */
+      seed = seed * 1103515245 + 12345;
+      const char *text = tokens[(seed >> 16) % (sizeof(tokens) / sizeof(*tokens))];
+      uint32_t len = strlen(text), size = (152 + len + 7) & ~7u;
+      for (uint32_t i = 0; i < 152; i++)
+        p[i] = (uint8_t) (i * 31 + line * 7 + t);
+      memcpy(p + 152, text, len);
+      int w = len * 9 / 24;
+      push_record((Record) { x, y, x + w, y + 1, size, p });
+      p += size;
+      x += w;
+    }
+  }
+}
+
+
+/* 32bit fnv-1a hash, as rencache hashed before */
+#define FNV_INITIAL 2166136261u
+
+static void fnv_hash(uint32_t *h, const void *data, int size) {
+  const unsigned char *p = data;
+  while (size--) {
+    *h = (*h ^ *p++) * 16777619;
+  }
+}
+
+
+/* the hash of src/rencache.c, keep in sync */
+#define HASH_INITIAL 0x243f6a8885a308d3ull
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+
+static inline int min(int a, int b) { return a < b ? a : b; }
+
+static inline uint64_t hash_mum(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t) a * b;
+  return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+  uint64_t a_lo = (uint32_t) a, a_hi = a >> 32, b_lo = (uint32_t) b, b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+  uint64_t cross = (lo_lo >> 32) + (uint32_t) hi_lo + lo_hi;
+  uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+  return ((cross << 32) | (uint32_t) lo_lo) ^ hi;
+#endif
+}
+
+static inline uint64_t hash_read(const uint8_t *p, int size) {
+  uint64_t v = 0;
+  memcpy(&v, p, size);
+  return v;
+}
+
+static void hash(uint64_t *h, const void *data, int size) {
+  const uint8_t *p = data;
+  uint64_t seed = *h ^ HASH_P0;
+  int n = size;
+  for (; n > 16; n -= 16, p += 16) {
+    seed = hash_mum(hash_read(p, 8) ^ HASH_P1, hash_read(p + 8, 8) ^ seed);
+  }
+  uint64_t a = hash_read(p, min(n, 8));
+  uint64_t b = n > 8 ? hash_read(p + 8, n - 8) : 0;
+  *h = hash_mum(HASH_P1 ^ (uint64_t) size, hash_mum(a ^ HASH_P1, b ^ seed));
+}
+
+
+/* the cell update loop of rencache_end_frame, for both hashes */
+#define REPLAY(name, type, initial, hash_fn) \
+  static type name(const Frame *f, type *cells) { \
+    for (int i = 0; i < f->cells_x * f->cells_y; i++) \
+      cells[i] = initial; \
+    for (int i = 0; i < f->count; i++) { \
+      const Record *r = &f->records[i]; \
+      type h = initial; \
+      hash_fn(&h, r->data, r->size); \
+      for (int y = r->y1; y <= r->y2 && y < f->cells_y; y++) \
+        for (int x = r->x1; x <= r->x2 && x < f->cells_x; x++) \
+          hash_fn(&cells[x + y * f->cells_x], &h, sizeof(h)); \
+    } \
+    type sum = 0; \
+    for (int i = 0; i < f->cells_x * f->cells_y; i++) \
+      sum ^= cells[i]; \
+    return sum; \
+  }
+
+REPLAY(replay_fnv, uint32_t, FNV_INITIAL, fnv_hash)
+REPLAY(replay_hash, uint64_t, HASH_INITIAL, hash)
+
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "-") != 0)
+    load_recording(argv[1]);
+  else
+    generate_frame();
+  int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+  if (frame_count == 0 || iterations <= 0) {
+    fprintf(stderr, "Error: nothing to replay\n");
+    return EXIT_FAILURE;
+  }
+
+  size_t bytes = 0, commands = 0, max_cells = 0;
+  for (int i = 0; i < frame_count; i++) {
+    size_t n = (size_t) frames[i].cells_x * frames[i].cells_y;
+    max_cells = n > max_cells ? n : max_cells;
+    commands += frames[i].count;
+    for (int j = 0; j < frames[i].count; j++)
+      bytes += frames[i].records[j].size;
+  }
+  uint32_t *fnv_cells = check_alloc(malloc(max_cells * sizeof(uint32_t)));
+  uint64_t *hash_cells = check_alloc(malloc(max_cells * sizeof(uint64_t)));
+  printf("%d frames, %zu commands, %zu command bytes, %d iterations\n", frame_count, commands, bytes, iterations);
+
+  uint64_t check = 0;
+  double start = now();
+  for (int n = 0; n < iterations; n++)
+    for (int i = 0; i < frame_count; i++)
+      check += replay_fnv(&frames[i], fnv_cells);
+  double fnv_time = now() - start;
+
+  start = now();
+  for (int n = 0; n < iterations; n++)
+    for (int i = 0; i < frame_count; i++)
+      check += replay_hash(&frames[i], hash_cells);
+  double hash_time = now() - start;
+
+  double replayed = (double) frame_count * iterations;
+  printf("fnv-1a 32bit: %9.2f us/frame %9.1f MB/s\n", fnv_time * 1e6 / replayed, bytes * (double) iterations / fnv_time / 1e6);
+  printf("rencache:     %9.2f us/frame %9.1f MB/s\n", hash_time * 1e6 / replayed, bytes * (double) iterations / hash_time / 1e6);
+  printf("speedup: %.2fx (check %016llx)\n", fnv_time / hash_time, (unsigned long long) check);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+-- Checks that the native tokenizer gives the same tokens and states as the
+-- Lua reference implementation, tokenizer.tokenize_lua, line by line and on
+-- the background thread, over the syntaxes of the bundled language plugins.
+--
+-- It has to be run by lite-xl, which has the native tokenizer built in, in
+-- place of the editor:
+--
+--   LITE_USERDIR=scripts LITE_XL_RUNTIME=tokenizer-check lite-xl [--all-syntaxes] [path...]
+--
+-- Files are tokenized with the syntax they get in the editor, or with every
+-- syntax when --all-syntaxes is given. Directories are walked recursively,
+-- the data directory being checked when no path is given. It exits with 1
+-- when there are mismatches.
+local core = require "core"
+local syntax = require "core.syntax"
+local tokenizer = require "core.tokenizer"
+
+local MAX_FILE_SIZE = 1024 * 1024
+local MAX_SHOWN_TOKENS = 16
+
+local check = {}
+local lua_only = {}
+
+
+-- the editor isn't running, messages go to the terminal
+function core.custom_log(level, show, backtrace, fmt, ...)
+  local text = string.format(fmt, ...)
+  local name = text:match("^Using the Lua tokenizer for (.-):")
+  if name then lua_only[name] = text end
+  if level ~= "INFO" then print(level .. ": " .. text) end
+end
+
+
+local function load_syntaxes()
+  for _, file in ipairs(system.list_dir(DATADIR .. PATHSEP .. "plugins") or {}) do
+    local name = file:match("^(language_.+)%.lua$")
+    if name then
+      local ok, err = pcall(require, "plugins." .. name)
+      if not ok then print("ERROR: can't load " .. name .. ": " .. tostring(err)) end
+    end
+  end
+end
+
+
+local function list_files(path, files)
+  local info = system.get_file_info(path)
+  if not info then
+    print("ERROR: can't find " .. path)
+  elseif info.type == "dir" then
+    local entries = system.list_dir(path) or {}
+    table.sort(entries)
+    for _, entry in ipairs(entries) do
+      if entry:sub(1, 1) ~= "." then list_files(path .. PATHSEP .. entry, files) end
+    end
+  elseif info.size <= MAX_FILE_SIZE then
+    table.insert(files, path)
+  end
+  return files
+end
+
+
+-- lines as the document splits them, with the line ending kept
+local function read_lines(path)
+  local fp = io.open(path, "rb")
+  if not fp then return nil end
+  local content = fp:read("a")
+  fp:close()
+  if content:find("\0", 1, true) then return nil end
+  if content:sub(-1) ~= "\n" then content = content .. "\n" end
+  local lines = {}
+  for line in content:gmatch("[^\n]*\n") do
+    lines[#lines + 1] = line:gsub("\r\n$", "\n")
+  end
+  return lines
+end
+
+
+local function tokenize_lines(tokenize, syn, lines)
+  local tokens, states, state = {}, {}, nil
+  for i, text in ipairs(lines) do
+    local res, resume
+    res, state, resume = tokenize(syn, text, state)
+    while resume do
+      res, state, resume = tokenize(syn, text, state, resume)
+    end
+    tokens[i], states[i] = res, state
+  end
+  return tokens, states
+end
+
+
+local function tokenize_background(syn, lines)
+  local job = tokenizer.tokenize_lines(syn, lines, 1, #lines, nil)
+  if not job then return nil end
+  local tokens, states = job:result()
+  while tokens == nil do
+    system.sleep(0.001)
+    tokens, states = job:result()
+  end
+  if not tokens then error("background tokenizing failed: " .. tostring(states)) end
+  return tokens, states
+end
+
+
+local function format_tokens(tokens)
+  local parts = {}
+  for i = 1, math.min(#tokens, MAX_SHOWN_TOKENS * 2), 2 do
+    parts[#parts + 1] = string.format("%s %q", tokens[i], tokens[i + 1])
+  end
+  if #tokens > MAX_SHOWN_TOKENS * 2 then parts[#parts + 1] = "..." end
+  return "{ " .. table.concat(parts, ", ") .. " }"
+end
+
+
+local function same_tokens(a, b)
+  if #a ~= #b then return false end
+  for i = 1, #a do
+    if a[i] ~= b[i] then return false end
+  end
+  return true
+end
+
+
+-- returns the first line where the results differ, if any
+local function compare(lines, ref_tokens, ref_states, tokens, states)
+  for i = 1, #lines do
+    if not same_tokens(ref_tokens[i], tokens[i]) or ref_states[i] ~= states[i] then
+      return i
+    end
+  end
+end
+
+
+local function report(path, syn, how, line, text, ref_tokens, ref_states, tokens, states)
+  print(string.format("MISMATCH: %s:%d, %s, %s", path, line, syn.name or "unnamed", how))
+  print(string.format("  text:   %q", text))
+  print(string.format("  lua:    %s state %q", format_tokens(ref_tokens[line]), ref_states[line]))
+  print(string.format("  native: %s state %q", format_tokens(tokens[line]), states[line]))
+end
+
+
+local function check_file(path, syn, lines, stats)
+  if #syn.patterns == 0 then return end
+  local ref_tokens, ref_states = tokenize_lines(tokenizer.tokenize_lua, syn, lines)
+  local tokens, states = tokenize_lines(tokenizer.tokenize, syn, lines)
+  local line = compare(lines, ref_tokens, ref_states, tokens, states)
+  if line then
+    report(path, syn, "line by line", line, lines[line], ref_tokens, ref_states, tokens, states)
+    stats.mismatches = stats.mismatches + 1
+  end
+  local ok, bg_tokens, bg_states = pcall(tokenize_background, syn, lines)
+  if not ok then
+    print(string.format("MISMATCH: %s, %s, %s", path, syn.name or "unnamed", bg_tokens))
+    stats.mismatches = stats.mismatches + 1
+  elseif bg_tokens then
+    line = compare(lines, ref_tokens, ref_states, bg_tokens, bg_states)
+    if line then
+      report(path, syn, "background", line, lines[line], ref_tokens, ref_states, bg_tokens, bg_states)
+      stats.mismatches = stats.mismatches + 1
+    end
+  end
+  stats.lines = stats.lines + #lines
+  stats.syntaxes[syn] = true
+end
+
+
+function check.init()
+  load_syntaxes()
+end
+
+
+function check.run()
+  local all_syntaxes, paths = false, {}
+  for i = 2, #ARGS do
+    if ARGS[i] == "--all-syntaxes" then
+      all_syntaxes = true
+    else
+      table.insert(paths, ARGS[i])
+    end
+  end
+  if #paths == 0 then paths = { DATADIR } end
+
+  local files = {}
+  for _, path in ipairs(paths) do list_files(path, files) end
+
+  local stats = { files = 0, lines = 0, mismatches = 0, syntaxes = {} }
+  for _, path in ipairs(files) do
+    local lines = read_lines(path)
+    if lines then
+      stats.files = stats.files + 1
+      local own = syntax.get(path, lines[1])
+      check_file(path, own, lines, stats)
+      if all_syntaxes then
+        for _, syn in ipairs(syntax.items) do
+          if syn ~= own then check_file(path, syn, lines, stats) end
+        end
+      end
+    end
+  end
+
+  local n_syntaxes = 0
+  for _ in pairs(stats.syntaxes) do n_syntaxes = n_syntaxes + 1 end
+  for _, text in pairs(lua_only) do print("NOTE: " .. text) end
+  print(string.format("%d files, %d lines, %d syntaxes, %d mismatches",
+    stats.files, stats.lines, n_syntaxes, stats.mismatches))
+  os.exit(stats.mismatches > 0 and 1 or 0)
+end
+
+
+return check
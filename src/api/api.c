@@ -8,6 +8,9 @@ int luaopen_dirmonitor(lua_State* L);
 int luaopen_shmem(lua_State* L);
 int luaopen_utf8extra(lua_State* L);
 int luaopen_encoding(lua_State* L);
+int luaopen_native_tokenizer(lua_State* L);
+int luaopen_textbuffer(lua_State* L);
+int luaopen_native_search(lua_State* L);
 
 #ifdef LUA_JIT
 int luaopen_bit32(lua_State *L);
@@ -31,6 +34,9 @@ static const luaL_Reg libs[] = {
   { "utf8extra",  luaopen_utf8extra  },
   { "encoding",   luaopen_encoding   },
   { "shmem",      luaopen_shmem      },
+  { "native_tokenizer", luaopen_native_tokenizer },
+  { "textbuffer", luaopen_textbuffer },
+  { "native_search", luaopen_native_search },
   LUAJIT_COMPATIBILITY
   { NULL, NULL }
 };
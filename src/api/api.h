@@ -15,6 +15,9 @@
 #define API_TYPE_DIRMONITOR "Dirmonitor"
 #define API_TYPE_NATIVE_PLUGIN "NativePlugin"
 #define API_TYPE_SHARED_MEMORY "SharedMemory"
+#define API_TYPE_NATIVE_TOKENIZER "NativeTokenizer"
+#define API_TYPE_TOKENIZER_JOB "TokenizerJob"
+#define API_TYPE_TEXT_BUFFER "TextBuffer"
 
 #define API_CONSTANT_DEFINE(L, idx, key, n) (lua_pushnumber(L, n), lua_setfield(L, idx - 1, key))
 
@@ -4,13 +4,38 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include "dirmonitor/dirmonitor.h"
+
 static unsigned int DIR_EVENT_TYPE = 0;
 
+// Changes are read by the monitor thread as soon as the backend has them and
+// kept until Lua checks them, merged by watch id and name. Past MAX_CHANGES
+// they're all dropped for a single "overflow" notification, and a directory
+// with more than MAX_DIR_CHANGES changed entries is listed again instead.
+#define MAX_CHANGES 16384
+#define MAX_DIR_CHANGES 64
+
+struct change {
+  int id;             // watch id, -1 for a path in "single" mode
+  char* name;         // entry of the watched directory or path, NULL for the directory itself
+  size_t len;
+  unsigned int time;  // ticks of the first event
+  int named;          // for a directory, amount of its entries with changes kept
+  bool pending;       // false once created then deleted, or for a directory not to list
+  bool existed, exists, listed, unknown, done;
+};
+
 struct dirmonitor {
   SDL_Thread* thread;
   SDL_mutex* mutex;
   char buffer[64512];
-  volatile int length;
+  volatile bool stopped;
+  bool overflow;
+  unsigned int delay, wake_time; // delay given to check, when the next wake up is due
+  struct change* changes;
+  size_t count, capacity;
+  size_t* slots; // open addressing table of indexes + 1 in changes
+  size_t slots_size;
   struct dirmonitor_internal* internal;
 };
 
@@ -18,46 +43,196 @@ struct dirmonitor {
 struct dirmonitor_internal* init_dirmonitor();
 void deinit_dirmonitor(struct dirmonitor_internal*);
 int get_changes_dirmonitor(struct dirmonitor_internal*, char*, int);
-int translate_changes_dirmonitor(struct dirmonitor_internal*, char*, int, int (*)(int, const char*, void*), void*);
+int translate_changes_dirmonitor(struct dirmonitor_internal*, char*, int, dirmonitor_callback, void*);
 int add_dirmonitor(struct dirmonitor_internal*, const char*);
 void remove_dirmonitor(struct dirmonitor_internal*, int);
 int get_mode_dirmonitor();
 
 
-static int f_check_dir_callback(int watch_id, const char* path, void* L) {
-  lua_pushvalue(L, -1);
-  if (path)
-    lua_pushlstring(L, path, watch_id);
-  else
-    lua_pushnumber(L, watch_id);
-  lua_call(L, 1, 1);
-  int result = lua_toboolean(L, -1);
-  lua_pop(L, 1);
-  return !result;
+static const char* change_kinds[] = { NULL, "create", "delete", "modify", "overflow" };
+
+
+static size_t change_hash(int id, const char* name, size_t len) {
+  size_t hash = 2166136261u ^ (unsigned int) id;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+  return hash;
+}
+
+
+static bool change_rehash(struct dirmonitor* monitor, size_t slots_size) {
+  size_t* slots = calloc(slots_size, sizeof(size_t));
+  if (!slots)
+    return false;
+  free(monitor->slots);
+  monitor->slots = slots;
+  monitor->slots_size = slots_size;
+  for (size_t i = 0; i < monitor->count; i++) {
+    struct change* c = &monitor->changes[i];
+    size_t slot = change_hash(c->id, c->name, c->len) & (slots_size - 1);
+    while (slots[slot])
+      slot = (slot + 1) & (slots_size - 1);
+    slots[slot] = i + 1;
+  }
+  return true;
+}
+
+
+static void change_clear(struct dirmonitor* monitor) {
+  for (size_t i = 0; i < monitor->count; i++)
+    free(monitor->changes[i].name);
+  monitor->count = 0;
+  if (monitor->slots)
+    memset(monitor->slots, 0, monitor->slots_size * sizeof(size_t));
+}
+
+
+// returns the index of the change of an entry, or -1 if missing
+static long change_get(struct dirmonitor* monitor, int id, const char* name, size_t len, size_t* slot) {
+  if (!monitor->slots_size)
+    return -1;
+  size_t mask = monitor->slots_size - 1;
+  for (*slot = change_hash(id, name, len) & mask; monitor->slots[*slot]; *slot = (*slot + 1) & mask) {
+    struct change* c = &monitor->changes[monitor->slots[*slot] - 1];
+    if (c->id == id && (name ? c->name && c->len == len && memcmp(c->name, name, len) == 0 : !c->name))
+      return monitor->slots[*slot] - 1;
+  }
+  return -1;
+}
+
+
+// returns the index of the change of an entry, added if missing, or -1
+static long change_find(struct dirmonitor* monitor, int id, const char* name, size_t len, bool* created) {
+  if ((monitor->count + 1) * 2 > monitor->slots_size && !change_rehash(monitor, monitor->slots_size ? monitor->slots_size * 2 : 256))
+    return -1;
+  size_t slot;
+  long idx = change_get(monitor, id, name, len, &slot);
+  *created = idx < 0;
+  if (idx >= 0)
+    return idx;
+  if (monitor->count == monitor->capacity) {
+    size_t capacity = monitor->capacity ? monitor->capacity * 2 : 128;
+    struct change* changes = realloc(monitor->changes, capacity * sizeof(struct change));
+    if (!changes)
+      return -1;
+    monitor->changes = changes;
+    monitor->capacity = capacity;
+  }
+  char* copy = NULL;
+  if (name) {
+    if (!(copy = malloc(len + 1)))
+      return -1;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+  }
+  monitor->changes[monitor->count] = (struct change) { .id = id, .name = copy, .len = len, .time = SDL_GetTicks() };
+  monitor->slots[slot] = ++monitor->count;
+  *created = true;
+  return monitor->count - 1;
+}
+
+
+// called by the monitor thread for each event, with the mutex locked
+static int f_queue_change(int watch_id, const char* path, const char* name, int kind, void* data) {
+  struct dirmonitor* monitor = data;
+  if (monitor->overflow)
+    return 0;
+  if (kind == DIRMONITOR_CHANGE_OVERFLOW || monitor->count + 2 > MAX_CHANGES) {
+    change_clear(monitor);
+    monitor->overflow = true;
+    return 0;
+  }
+  bool created;
+  long dir = -1;
+  size_t len;
+  if (path) {
+    // the path isn't NUL terminated, its length is given as the watch id
+    name = path;
+    len = (size_t) watch_id;
+    watch_id = -1;
+  } else {
+    // the directory keeps count of its changed entries
+    if ((dir = change_find(monitor, watch_id, NULL, 0, &created)) < 0)
+      return 0;
+    struct change* d = &monitor->changes[dir];
+    if (d->pending)
+      return 0;
+    if (!name || d->named >= MAX_DIR_CHANGES) {
+      d->pending = true;
+      d->time = SDL_GetTicks();
+      return 0;
+    }
+    len = strlen(name);
+  }
+  long idx = change_find(monitor, watch_id, name, len, &created);
+  if (idx < 0)
+    return 0;
+  struct change* c = &monitor->changes[idx];
+  if (created) {
+    c->existed = kind != DIRMONITOR_CHANGE_CREATE;
+    if (dir >= 0)
+      monitor->changes[dir].named++;
+  }
+  if (kind == DIRMONITOR_CHANGE_CREATE || kind == DIRMONITOR_CHANGE_DELETE) {
+    c->exists = kind == DIRMONITOR_CHANGE_CREATE;
+    c->listed = true;
+  } else if (created) {
+    c->exists = true;
+  }
+  c->unknown |= kind == DIRMONITOR_CHANGE_UNKNOWN;
+  // an entry created then deleted is left out
+  c->pending = c->existed || c->exists || c->unknown;
+  return 0;
+}
+
+
+// wakes the main loop up, to check changes that were waiting for the delay
+static Uint32 dirmonitor_wake_timer(Uint32 interval, void* data) {
+  SDL_Event event = { .type = DIR_EVENT_TYPE };
+  SDL_PushEvent(&event);
+  return 0;
+}
+
+
+// arms the wake up timer for `due`, unless one is already armed to go off
+// before it; must be called with the mutex locked
+static void dirmonitor_wake_at(struct dirmonitor* monitor, unsigned int due) {
+  unsigned int now = SDL_GetTicks();
+  if ((int)(now - monitor->wake_time) < 0 && (int)(due - monitor->wake_time) >= 0)
+    return;
+  monitor->wake_time = due;
+  SDL_AddTimer((int)(due - now) > 0 ? due - now + 1 : 1, dirmonitor_wake_timer, NULL);
 }
 
 
 static int dirmonitor_check_thread(void* data) {
   struct dirmonitor* monitor = data;
-  while (monitor->length >= 0) {
-    if (monitor->length == 0) {
-      int result = get_changes_dirmonitor(monitor->internal, monitor->buffer, sizeof(monitor->buffer));
-      SDL_LockMutex(monitor->mutex);
-      if (monitor->length == 0)
-        monitor->length = result;
-      SDL_UnlockMutex(monitor->mutex);
+  while (!monitor->stopped) {
+    int length = get_changes_dirmonitor(monitor->internal, monitor->buffer, sizeof(monitor->buffer));
+    SDL_LockMutex(monitor->mutex);
+    if (length < 0)
+      monitor->stopped = true;
+    else if (length > 0 && !monitor->stopped)
+      translate_changes_dirmonitor(monitor->internal, monitor->buffer, length, f_queue_change, monitor);
+    if (monitor->count > 0 && monitor->delay > 0)
+      dirmonitor_wake_at(monitor, SDL_GetTicks() + monitor->delay);
+    SDL_UnlockMutex(monitor->mutex);
+    if (length == 0) {
+      SDL_Delay(1);
+    } else {
+      SDL_Event event = { .type = DIR_EVENT_TYPE };
+      SDL_PushEvent(&event);
     }
-    SDL_Delay(1);
-    SDL_Event event = { .type = DIR_EVENT_TYPE };
-    SDL_PushEvent(&event);
   }
   return 0;
 }
 
 
 static int f_dirmonitor_new(lua_State* L) {
-  if (DIR_EVENT_TYPE == 0)
+  if (DIR_EVENT_TYPE == 0) {
     DIR_EVENT_TYPE = SDL_RegisterEvents(1);
+    SDL_InitSubSystem(SDL_INIT_TIMER);
+  }
   struct dirmonitor* monitor = lua_newuserdata(L, sizeof(struct dirmonitor));
   luaL_setmetatable(L, API_TYPE_DIRMONITOR);
   memset(monitor, 0, sizeof(struct dirmonitor));
@@ -70,11 +245,14 @@ static int f_dirmonitor_new(lua_State* L) {
 static int f_dirmonitor_gc(lua_State* L) {
   struct dirmonitor* monitor = luaL_checkudata(L, 1, API_TYPE_DIRMONITOR);
   SDL_LockMutex(monitor->mutex);
-  monitor->length = -1;
+  monitor->stopped = true;
   deinit_dirmonitor(monitor->internal);
   SDL_UnlockMutex(monitor->mutex);
   SDL_WaitThread(monitor->thread, NULL);
   free(monitor->internal);
+  change_clear(monitor);
+  free(monitor->changes);
+  free(monitor->slots);
   SDL_DestroyMutex(monitor->mutex);
   return 0;
 }
@@ -95,18 +273,120 @@ static int f_dirmonitor_unwatch(lua_State *L) {
 }
 
 
+static void push_change(lua_State* L, const struct change* c, int* n) {
+  int kind = DIRMONITOR_CHANGE_UNKNOWN;
+  if (c->name && !c->unknown)
+    kind = !c->listed ? DIRMONITOR_CHANGE_MODIFY : c->exists ? DIRMONITOR_CHANGE_CREATE : DIRMONITOR_CHANGE_DELETE;
+  if (c->id < 0)
+    lua_pushlstring(L, c->name, c->len);
+  else
+    lua_pushinteger(L, c->id);
+  lua_rawseti(L, -2, ++*n);
+  if (c->id >= 0 && c->name)
+    lua_pushlstring(L, c->name, c->len);
+  else
+    lua_pushboolean(L, 0);
+  lua_rawseti(L, -2, ++*n);
+  if (change_kinds[kind])
+    lua_pushstring(L, change_kinds[kind]);
+  else
+    lua_pushboolean(L, 0);
+  lua_rawseti(L, -2, ++*n);
+}
+
+
+// Changes are given once they're older than the window, so that the events of
+// a burst are merged, and at most `limit` at a time.
 static int f_dirmonitor_check(lua_State* L) {
   struct dirmonitor* monitor = luaL_checkudata(L, 1, API_TYPE_DIRMONITOR);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  unsigned int window = luaL_optnumber(L, 3, 0) * 1000;
+  lua_Integer limit = luaL_optinteger(L, 4, 0);
+  lua_settop(L, 2);
+  lua_newtable(L);
+  int n = 0;
+
   SDL_LockMutex(monitor->mutex);
-  if (monitor->length < 0)
+  bool overflow = monitor->overflow;
+  monitor->overflow = false;
+  if (monitor->stopped && !overflow && monitor->count == 0) {
+    SDL_UnlockMutex(monitor->mutex);
     lua_pushnil(L);
-  else if (monitor->length > 0) {
-    if (translate_changes_dirmonitor(monitor->internal, monitor->buffer, monitor->length, f_check_dir_callback, L) == 0)
-      monitor->length = 0;
-    lua_pushboolean(L, 1);
-  } else
-    lua_pushboolean(L, 0);
+    return 1;
+  }
+  monitor->delay = window;
+  unsigned int now = SDL_GetTicks();
+  lua_Integer given = 0;
+  bool ready_left = false, waiting = false;
+  unsigned int next_due = 0;
+  for (size_t i = 0; i < monitor->count; i++) {
+    struct change* c = &monitor->changes[i];
+    struct change* dir = NULL;
+    size_t slot;
+    long dir_idx = c->id >= 0 && c->name ? change_get(monitor, c->id, NULL, 0, &slot) : -1;
+    if (dir_idx >= 0)
+      dir = &monitor->changes[dir_idx];
+    if (dir && dir->pending) {
+      // the whole directory is listed again
+      c->done = true;
+    } else if (c->pending && now - c->time >= window && (limit <= 0 || given < limit)) {
+      push_change(L, c, &n);
+      given++;
+      c->done = true;
+    } else if (!c->pending && c->name) {
+      c->done = true;
+    } else if (c->pending && now - c->time >= window) {
+      ready_left = true;
+    } else if (c->pending && (!waiting || (int)(c->time + window - next_due) < 0)) {
+      waiting = true;
+      next_due = c->time + window;
+    }
+    if (dir && c->done)
+      dir->named--;
+  }
+  // directories are kept while they have entries with changes
+  size_t kept = 0;
+  for (size_t i = 0; i < monitor->count; i++) {
+    struct change* c = &monitor->changes[i];
+    if (c->done || (!c->name && !c->pending && c->named == 0))
+      free(c->name);
+    else
+      monitor->changes[kept++] = *c;
+  }
+  monitor->count = kept;
+  if (monitor->slots_size)
+    change_rehash(monitor, monitor->slots_size);
+  // the main loop may be waiting without a timeout when the next change is due
+  if (waiting)
+    dirmonitor_wake_at(monitor, next_due);
   SDL_UnlockMutex(monitor->mutex);
+  // the changes past the limit are given at the next check, which may have to
+  // be woken up for
+  if (ready_left) {
+    SDL_Event event = { .type = DIR_EVENT_TYPE };
+    SDL_PushEvent(&event);
+  }
+
+  if (overflow) {
+    lua_pushvalue(L, 2);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushstring(L, "overflow");
+    lua_call(L, 3, 0);
+  }
+  for (int i = 1; i <= n; i += 3) {
+    lua_pushvalue(L, 2);
+    for (int j = 0; j < 3; j++) {
+      // false stands for nil in the table
+      lua_rawgeti(L, 3, i + j);
+      if (!lua_toboolean(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+      }
+    }
+    lua_call(L, 3, 0);
+  }
+  lua_pushboolean(L, overflow || n > 0);
   return 1;
 }
 
@@ -0,0 +1,21 @@
+#ifndef DIRMONITOR_H
+#define DIRMONITOR_H
+
+/* Kinds of changes told by the backends, those that can't tell use
+** DIRMONITOR_CHANGE_UNKNOWN and the whole directory is checked again.
+** DIRMONITOR_CHANGE_OVERFLOW tells that events were lost. */
+enum dirmonitor_change {
+  DIRMONITOR_CHANGE_UNKNOWN,
+  DIRMONITOR_CHANGE_CREATE,
+  DIRMONITOR_CHANGE_DELETE,
+  DIRMONITOR_CHANGE_MODIFY,
+  DIRMONITOR_CHANGE_OVERFLOW
+};
+
+/* Called by translate_changes_dirmonitor for each change with the watch id,
+** or in "single" mode the length of the changed path and the path, the name
+** of the changed entry of the watched directory if known, and the kind of
+** change. */
+typedef int (*dirmonitor_callback)(int, const char*, const char*, int, void*);
+
+#endif
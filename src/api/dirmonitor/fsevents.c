@@ -1,6 +1,8 @@
 #include <SDL.h>
 #include <CoreServices/CoreServices.h>
 
+#include "dirmonitor.h"
+
 struct dirmonitor_internal {
   SDL_mutex* lock;
   char** changes;
@@ -124,13 +126,13 @@ int translate_changes_dirmonitor(
   struct dirmonitor_internal* monitor,
   char* buffer,
   int buffer_size,
-  int (*change_callback)(int, const char*, void*),
+  dirmonitor_callback change_callback,
   void* L
 ) {
   SDL_LockMutex(monitor->lock);
   if (monitor->count > 0) {
     for (size_t i = 0; i<monitor->count; i++) {
-      change_callback(strlen(monitor->changes[i]), monitor->changes[i], L);
+      change_callback(strlen(monitor->changes[i]), monitor->changes[i], NULL, DIRMONITOR_CHANGE_UNKNOWN, L);
       free(monitor->changes[i]);
     }
     free(monitor->changes);
@@ -4,6 +4,8 @@
 #include <fcntl.h>
 #include <poll.h>
 
+#include "dirmonitor.h"
+
 
 struct dirmonitor_internal {
   int fd;
@@ -36,9 +38,20 @@ int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, in
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, int (*change_callback)(int, const char*, void*), void* data) {
-  for (struct inotify_event* info = (struct inotify_event*)buffer; (char*)info < buffer + length; info = (struct inotify_event*)((char*)info + sizeof(struct inotify_event)))
-    change_callback(info->wd, NULL, data);
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, dirmonitor_callback change_callback, void* data) {
+  // events are followed by the name of the entry, padded with NUL bytes
+  for (struct inotify_event* info = (struct inotify_event*)buffer; (char*)info < buffer + length; info = (struct inotify_event*)((char*)info + sizeof(struct inotify_event) + info->len)) {
+    int kind = DIRMONITOR_CHANGE_UNKNOWN;
+    if (info->mask & IN_Q_OVERFLOW)
+      kind = DIRMONITOR_CHANGE_OVERFLOW;
+    else if (info->mask & (IN_CREATE | IN_MOVED_TO))
+      kind = DIRMONITOR_CHANGE_CREATE;
+    else if (info->mask & (IN_DELETE | IN_MOVED_FROM))
+      kind = DIRMONITOR_CHANGE_DELETE;
+    else if (info->mask & IN_MODIFY)
+      kind = DIRMONITOR_CHANGE_MODIFY;
+    change_callback(info->wd, NULL, info->len ? info->name : NULL, kind, data);
+  }
   return 0;
 }
 
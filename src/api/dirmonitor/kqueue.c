@@ -6,6 +6,8 @@
 #include <unistd.h>
 #include <time.h>
 
+#include "dirmonitor.h"
+
 struct dirmonitor_internal {
   int fd;
 };
@@ -35,9 +37,9 @@ int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, in
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, int (*change_callback)(int, const char*, void*), void* data) {
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, dirmonitor_callback change_callback, void* data) {
   for (struct kevent* info = (struct kevent*)buffer; (char*)info < buffer + buffer_size; info = (struct kevent*)(((char*)info) + sizeof(kevent)))
-    change_callback(info->ident, NULL, data);
+    change_callback(info->ident, NULL, NULL, DIRMONITOR_CHANGE_UNKNOWN, data);
   return 0;
 }
 
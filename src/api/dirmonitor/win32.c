@@ -1,5 +1,7 @@
 #include <windows.h>
 
+#include "dirmonitor.h"
+
 
 struct dirmonitor_internal {
   HANDLE handle;
@@ -38,11 +40,19 @@ void deinit_dirmonitor(struct dirmonitor_internal* monitor) {
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, int (*change_callback)(int, const char*, void*), void* data) {
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, dirmonitor_callback change_callback, void* data) {
   for (FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)buffer; (char*)info < buffer + buffer_size; info = (FILE_NOTIFY_INFORMATION*)(((char*)info) + info->NextEntryOffset)) {
     char transform_buffer[MAX_PATH*4];
     int count = WideCharToMultiByte(CP_UTF8, 0, (WCHAR*)info->FileName, info->FileNameLength / 2, transform_buffer, MAX_PATH*4 - 1, NULL, NULL);
-    change_callback(count, transform_buffer, data);
+    int kind = DIRMONITOR_CHANGE_UNKNOWN;
+    switch (info->Action) {
+      case FILE_ACTION_ADDED:
+      case FILE_ACTION_RENAMED_NEW_NAME: kind = DIRMONITOR_CHANGE_CREATE; break;
+      case FILE_ACTION_REMOVED:
+      case FILE_ACTION_RENAMED_OLD_NAME: kind = DIRMONITOR_CHANGE_DELETE; break;
+      case FILE_ACTION_MODIFIED:         kind = DIRMONITOR_CHANGE_MODIFY; break;
+    }
+    change_callback(count, transform_buffer, NULL, kind, data);
     if (!info->NextEntryOffset)
       break;
   }
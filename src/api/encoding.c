@@ -10,6 +10,9 @@
   #include <windows.h>
 #endif
 
+/* bytes read from the start of a file to detect its encoding */
+#define ENCODING_SAMPLE_SIZE (8 * 1024 * 1024)
+
 typedef struct {
   const char* charset;
   unsigned char bom[4];
@@ -318,7 +321,12 @@ int f_detect(lua_State *L) {
   fseek(file, 0, SEEK_END);
 
   size_t file_size = ftell(file);
-  char* string = malloc(file_size);
+  /* only the start of big files is checked, cut after a line ending so that
+   * no character is split */
+  size_t sample_size = file_size;
+  if (sample_size > ENCODING_SAMPLE_SIZE)
+    sample_size = ENCODING_SAMPLE_SIZE;
+  char* string = malloc(sample_size);
 
   if (!string) {
     lua_pushnil(L);
@@ -328,9 +336,20 @@ int f_detect(lua_State *L) {
   }
 
   fseek(file, 0, SEEK_SET);
-  fread(string, 1, file_size, file);
+  sample_size = fread(string, 1, sample_size, file);
+
+  if (sample_size < file_size) {
+    size_t len = sample_size;
+    while (len > 0 && string[len-1] != '\n')
+      len--;
+    /* the null bytes after "\n" in UTF-16LE and UTF-32LE */
+    for (int i = 0; len > 0 && i < 3 && len < sample_size && !string[len]; i++)
+      len++;
+    if (len > 0)
+      sample_size = len;
+  }
 
-  const char* charset = encoding_detect(string, file_size);
+  const char* charset = encoding_detect(string, sample_size);
 
   fclose(file);
   free(string);
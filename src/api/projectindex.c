@@ -0,0 +1,277 @@
+#include "api.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include "../utfconv.h"
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+/* Index of the files of a project directory, saved under USERDIR so that
+** opening the project again doesn't wait for a full scan.
+**
+** The file holds a header, a fixed size record per entry in the order of the
+** project file list, the names of the entries one after the other and a key
+** given by core, which tells the project directory and the options of the
+** scan. The index is only loaded if the key is the same. Numbers are in
+** native byte order, a file written with another order or version doesn't
+** match the magic and is simply ignored. The file is mapped in memory to be
+** read. */
+
+#define INDEX_MAGIC 0x4958504c /* "LPXI" */
+#define INDEX_VERSION 1
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t count, key_len;
+  uint64_t names_len;
+} IndexHeader;
+
+typedef struct {
+  int64_t size, modified;
+  uint32_t name_len;
+  uint8_t type; /* 0 for a directory, 1 for a file */
+  uint8_t symlink;
+  uint16_t unused;
+} IndexRecord;
+
+typedef struct {
+  const char *data;
+  size_t len;
+#ifdef _WIN32
+  HANDLE mapping;
+#endif
+} IndexMapping;
+
+
+static bool index_map(const char *filename, IndexMapping *map) {
+#ifdef _WIN32
+  LPWSTR wfilename = utfconv_utf8towc(filename);
+  if (!wfilename)
+    return false;
+  HANDLE file = CreateFileW(wfilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  free(wfilename);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  HANDLE mapping = NULL;
+  if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG) sizeof(IndexHeader) && (ULONGLONG) size.QuadPart <= SIZE_MAX)
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping)
+    return false;
+  const char *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    return false;
+  }
+  *map = (IndexMapping) { data, size.QuadPart, mapping };
+#else
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= (off_t) sizeof(IndexHeader) && (uintmax_t) st.st_size <= SIZE_MAX)
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  *map = (IndexMapping) { data, st.st_size };
+#endif
+  return true;
+}
+
+
+static void index_unmap(IndexMapping *map) {
+#ifdef _WIN32
+  UnmapViewOfFile(map->data);
+  CloseHandle(map->mapping);
+#else
+  munmap((void*) map->data, map->len);
+#endif
+}
+
+
+/* pushes the file list of the index, returns false if it isn't valid */
+static bool index_push(lua_State *L, const IndexMapping *map, const char *key, size_t key_len) {
+  IndexHeader h;
+  memcpy(&h, map->data, sizeof(h));
+  if (h.magic != INDEX_MAGIC || h.version != INDEX_VERSION || h.key_len != key_len)
+    return false;
+  size_t records = sizeof(IndexHeader);
+  size_t names = records + (size_t) h.count * sizeof(IndexRecord);
+  if (h.names_len > map->len || names > map->len - h.names_len || map->len - h.names_len - names != key_len)
+    return false;
+  size_t names_end = names + h.names_len;
+  if (memcmp(map->data + names_end, key, key_len) != 0)
+    return false;
+
+  lua_createtable(L, h.count, 0);
+  size_t name = names;
+  for (uint32_t i = 0; i < h.count; i++) {
+    IndexRecord r;
+    memcpy(&r, map->data + records + i * sizeof(IndexRecord), sizeof(r));
+    if (r.type > 1 || r.name_len > names_end - name) {
+      lua_pop(L, 1);
+      return false;
+    }
+    lua_createtable(L, 0, 5);
+    lua_pushlstring(L, map->data + name, r.name_len);
+    lua_setfield(L, -2, "filename");
+    lua_pushstring(L, r.type == 0 ? "dir" : "file");
+    lua_setfield(L, -2, "type");
+    lua_pushinteger(L, r.size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, r.modified);
+    lua_setfield(L, -2, "modified");
+  #ifdef __linux__
+    if (r.type == 0) {
+      lua_pushboolean(L, r.symlink);
+      lua_setfield(L, -2, "symlink");
+    }
+  #endif
+    lua_rawseti(L, -2, i + 1);
+    name += r.name_len;
+  }
+  return name == names_end;
+}
+
+
+int system_load_project_index(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  size_t key_len;
+  const char *key = luaL_checklstring(L, 2, &key_len);
+  IndexMapping map;
+  if (!index_map(filename, &map))
+    return 0;
+  bool ok = index_push(L, &map, key, key_len);
+  index_unmap(&map);
+  return ok ? 1 : 0;
+}
+
+
+static bool index_write(const char *filename, const char *data, size_t len) {
+#ifdef _WIN32
+  LPWSTR wfilename = utfconv_utf8towc(filename);
+  FILE *fp = wfilename ? _wfopen(wfilename, L"wb") : NULL;
+#else
+  FILE *fp = fopen(filename, "wb");
+#endif
+  bool ok = fp && fwrite(data, 1, len, fp) == len;
+  ok = fp && fclose(fp) == 0 && ok;
+#ifdef _WIN32
+  if (!ok && fp)
+    _wremove(wfilename);
+  free(wfilename);
+#else
+  if (!ok && fp)
+    unlink(filename);
+#endif
+  return ok;
+}
+
+
+static bool index_replace(const char *temp, const char *filename) {
+#ifdef _WIN32
+  LPWSTR wtemp = utfconv_utf8towc(temp), wfilename = utfconv_utf8towc(filename);
+  bool ok = wtemp && wfilename && MoveFileExW(wtemp, wfilename, MOVEFILE_REPLACE_EXISTING);
+  if (!ok && wtemp)
+    _wremove(wtemp);
+  free(wtemp);
+  free(wfilename);
+  return ok;
+#else
+  if (rename(temp, filename) == 0)
+    return true;
+  unlink(temp);
+  return false;
+#endif
+}
+
+
+/* gets the name and type of an entry of the file list, left on the stack */
+static const char *index_entry(lua_State *L, lua_Integer i, size_t *name_len, uint8_t *type) {
+  lua_rawgeti(L, 3, i);
+  if (!lua_istable(L, -1))
+    luaL_error(L, "invalid file at index %d", (int) i);
+  lua_getfield(L, -1, "type");
+  const char *t = lua_tostring(L, -1);
+  *type = t && strcmp(t, "dir") == 0 ? 0 : 1;
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "filename");
+  const char *name = lua_tolstring(L, -1, name_len);
+  if (!name || !t || *name_len > UINT32_MAX)
+    luaL_error(L, "invalid file at index %d", (int) i);
+  return name;
+}
+
+
+int system_save_project_index(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  size_t key_len;
+  const char *key = luaL_checklstring(L, 2, &key_len);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  lua_settop(L, 3);
+  lua_Integer count = luaL_len(L, 3);
+  luaL_argcheck(L, count >= 0 && (uint64_t) count <= UINT32_MAX, 3, "too many files");
+  luaL_argcheck(L, key_len <= UINT32_MAX, 2, "key too long");
+
+  IndexHeader h = { INDEX_MAGIC, INDEX_VERSION, count, key_len, 0 };
+  size_t name_len;
+  uint8_t type;
+  for (lua_Integer i = 1; i <= count; i++) {
+    index_entry(L, i, &name_len, &type);
+    h.names_len += name_len;
+    lua_pop(L, 2);
+  }
+
+  size_t names = sizeof(IndexHeader) + count * sizeof(IndexRecord);
+  size_t len = names + h.names_len + key_len;
+  char *data = malloc(len);
+  if (!data)
+    return luaL_error(L, "not enough memory to save the index");
+  memcpy(data, &h, sizeof(h));
+  char *record = data + sizeof(IndexHeader), *name = data + names;
+  for (lua_Integer i = 1; i <= count; i++) {
+    const char *s = index_entry(L, i, &name_len, &type);
+    memcpy(name, s, name_len);
+    name += name_len;
+    IndexRecord r = { 0 };
+    r.name_len = name_len;
+    r.type = type;
+    lua_getfield(L, -2, "size");
+    lua_getfield(L, -3, "modified");
+    lua_getfield(L, -4, "symlink");
+    r.size = lua_tointeger(L, -3);
+    r.modified = lua_tointeger(L, -2);
+    r.symlink = lua_toboolean(L, -1);
+    lua_pop(L, 5);
+    memcpy(record, &r, sizeof(r));
+    record += sizeof(r);
+  }
+  memcpy(name, key, key_len);
+
+  /* written next to the index then renamed, so that it's never left half written */
+  lua_pushfstring(L, "%s.tmp", filename);
+  bool ok = index_write(lua_tostring(L, -1), data, len) && index_replace(lua_tostring(L, -1), filename);
+  int err = errno;
+  free(data);
+  if (!ok) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to save '%s': %s", filename, strerror(err));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
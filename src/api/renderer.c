@@ -202,6 +202,21 @@ static int f_font_get_width(lua_State *L) {
   return 1;
 }
 
+static int f_font_get_prefix_widths(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  size_t len;
+  const char *text = luaL_checklstring(L, 2, &len);
+
+  const double *widths;
+  int count = ren_font_group_get_prefix_widths(&window_renderer, fonts, text, len, &widths);
+  lua_createtable(L, count, 0);
+  for (int i = 0; i < count; ++i) {
+    lua_pushnumber(L, widths[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
 static int f_font_get_height(lua_State *L) {
   RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
   lua_pushnumber(L, ren_font_group_get_height(fonts));
@@ -345,6 +360,47 @@ static int f_show_debug(lua_State *L) {
 }
 
 
+static int f_set_render_threads(lua_State *L) {
+  rencache_set_render_threads(luaL_checkinteger(L, 1));
+  return 0;
+}
+
+
+static int f_set_glyph_cache_size(lua_State *L) {
+  lua_Integer size = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, size >= 0, 1, "size can't be negative");
+  ren_set_glyph_cache_size(size);
+  return 0;
+}
+
+
+static int f_get_stats(lua_State *L) {
+  static RenCacheStats frames[RENCACHE_STATS_FRAMES];
+  int max = luaL_optinteger(L, 1, RENCACHE_STATS_FRAMES);
+  int count = rencache_get_stats(frames, max < 0 ? 0 : max);
+  lua_createtable(L, count, 0);
+  for (int i = 0; i < count; i++) {
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, frames[i].commands);
+    lua_setfield(L, -2, "commands");
+    lua_pushinteger(L, frames[i].command_bytes);
+    lua_setfield(L, -2, "command_bytes");
+    lua_pushinteger(L, frames[i].rects);
+    lua_setfield(L, -2, "rects");
+    lua_pushinteger(L, frames[i].pixels);
+    lua_setfield(L, -2, "pixels");
+    lua_pushnumber(L, frames[i].hash_time);
+    lua_setfield(L, -2, "hash_time");
+    lua_pushnumber(L, frames[i].draw_time);
+    lua_setfield(L, -2, "draw_time");
+    lua_pushnumber(L, frames[i].present_time);
+    lua_setfield(L, -2, "present_time");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+
 static int f_get_size(lua_State *L) {
   int w, h;
   ren_get_size(&window_renderer, &w, &h);
@@ -387,6 +443,17 @@ static int f_set_clip_rect(lua_State *L) {
 }
 
 
+static int f_scroll_rect(lua_State *L) {
+  lua_Number x = luaL_checknumber(L, 1);
+  lua_Number y = luaL_checknumber(L, 2);
+  lua_Number w = luaL_checknumber(L, 3);
+  lua_Number h = luaL_checknumber(L, 4);
+  RenRect rect = rect_to_grid(x, y, w, h);
+  rencache_scroll_rect(rect, luaL_checkinteger(L, 5), luaL_checkinteger(L, 6));
+  return 0;
+}
+
+
 static int f_draw_rect(lua_State *L) {
   lua_Number x = luaL_checknumber(L, 1);
   lua_Number y = luaL_checknumber(L, 2);
@@ -426,10 +493,14 @@ static int f_draw_text(lua_State *L) {
 
 static const luaL_Reg lib[] = {
   { "show_debug",         f_show_debug         },
+  { "set_render_threads", f_set_render_threads },
+  { "set_glyph_cache_size", f_set_glyph_cache_size },
+  { "get_stats",          f_get_stats          },
   { "get_size",           f_get_size           },
   { "begin_frame",        f_begin_frame        },
   { "end_frame",          f_end_frame          },
   { "set_clip_rect",      f_set_clip_rect      },
+  { "scroll_rect",        f_scroll_rect        },
   { "draw_rect",          f_draw_rect          },
   { "draw_text",          f_draw_text          },
   { NULL,                 NULL                 }
@@ -442,6 +513,7 @@ static const luaL_Reg fontLib[] = {
   { "group",              f_font_group              },
   { "set_tab_size",       f_font_set_tab_size       },
   { "get_width",          f_font_get_width          },
+  { "get_prefix_widths",  f_font_get_prefix_widths  },
   { "get_height",         f_font_get_height         },
   { "get_size",           f_font_get_size           },
   { "set_size",           f_font_set_size           },
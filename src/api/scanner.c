@@ -0,0 +1,833 @@
+#include "api.h"
+
+#include <SDL.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include "../utfconv.h"
+  #define PATHSEP '\\'
+  #define PATHSEP_STR "\\"
+#else
+  #include <dirent.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #define PATHSEP '/'
+  #define PATHSEP_STR "/"
+#endif
+
+/* Native project scanner, behind system.scan_directory.
+** Directories are listed by a pool of threads sharing a stack of directories
+** to list: each thread pops one, lists and filters it, sorts its entries and
+** pushes its subdirectories back, so the threads keep busy as long as there is
+** anything left to list. Entries are stat'ed relative to their directory and
+** filtered with config.ignore_files before anything goes back to Lua; the
+** patterns are matched by a copy of the Lua pattern matcher that can't raise
+** errors, as it runs outside of the Lua thread. Once done, the sorted
+** directories are joined into the flat list of the project files. */
+
+#define SCAN_MAX_THREADS 8
+#define SCAN_MAXCCALLS 200
+#define SCAN_MAXCAPTURES 32
+
+int system_path_compare(const char *path1, size_t len1, int type1,
+                        const char *path2, size_t len2, int type2);
+
+typedef struct {
+  char *pattern;
+  size_t len;
+  bool use_path, match_dir;
+} ScanIgnore;
+
+typedef struct ScanDir ScanDir;
+
+typedef struct {
+  char *name;
+  size_t len;
+  int type; /* 0 for directories and 1 for files, like in system_path_compare */
+  bool symlink;
+  int64_t size, modified;
+  ScanDir *dir; /* the directory listed, for subdirectories */
+} ScanEntry;
+
+struct ScanDir {
+  char *path; /* relative to the root, empty for the root */
+  size_t len;
+  ScanEntry *entries;
+  size_t n_entries, entries_size;
+  bool listed;
+};
+
+typedef struct {
+  const char *root;
+  size_t root_len;
+  ScanIgnore *ignore;
+  int n_ignore;
+  int64_t size_limit;
+  bool recursive;
+  int max_files;
+  Uint64 deadline;
+
+  SDL_mutex *mutex;
+  SDL_cond *cond;
+  ScanDir **stack; /* directories left to list */
+  size_t n_stack, stack_size;
+  ScanDir **dirs;  /* every directory, to free them */
+  size_t n_dirs, dirs_size;
+  int busy;        /* threads listing a directory */
+  bool stop, failed;
+  SDL_atomic_t count;
+} Scanner;
+
+
+/* Lua pattern matching, from lstrlib.c with errors making the match fail
+** instead of raising them, captures are only kept for back references */
+
+typedef struct {
+  const char *src_init, *src_end, *p_end;
+  int matchdepth, level;
+  struct {
+    const char *init;
+    ptrdiff_t len;
+  } capture[SCAN_MAXCAPTURES];
+  bool error;
+} ScanMatch;
+
+#define CAP_UNFINISHED (-1)
+#define CAP_POSITION   (-2)
+#define L_ESC '%'
+#define uchar(c) ((unsigned char)(c))
+
+static const char *scan_match(ScanMatch *ms, const char *s, const char *p);
+
+
+static const char *classend(ScanMatch *ms, const char *p) {
+  switch (*p++) {
+    case L_ESC:
+      if (p == ms->p_end) {
+        ms->error = true;
+        return p;
+      }
+      return p + 1;
+    case '[':
+      if (*p == '^') p++;
+      do {
+        if (p == ms->p_end) {
+          ms->error = true;
+          return p;
+        }
+        if (*(p++) == L_ESC && p < ms->p_end)
+          p++;
+      } while (*p != ']');
+      return p + 1;
+    default:
+      return p;
+  }
+}
+
+
+static int match_class(int c, int cl) {
+  int res;
+  switch (tolower(cl)) {
+    case 'a': res = isalpha(c); break;
+    case 'c': res = iscntrl(c); break;
+    case 'd': res = isdigit(c); break;
+    case 'g': res = isgraph(c); break;
+    case 'l': res = islower(c); break;
+    case 'p': res = ispunct(c); break;
+    case 's': res = isspace(c); break;
+    case 'u': res = isupper(c); break;
+    case 'w': res = isalnum(c); break;
+    case 'x': res = isxdigit(c); break;
+    default: return cl == c;
+  }
+  if (isupper(cl)) res = !res;
+  return res;
+}
+
+
+static int matchbracketclass(int c, const char *p, const char *ec) {
+  int sig = 1;
+  if (*(p + 1) == '^') {
+    sig = 0;
+    p++;
+  }
+  while (++p < ec) {
+    if (*p == L_ESC) {
+      p++;
+      if (match_class(c, uchar(*p)))
+        return sig;
+    } else if (*(p + 1) == '-' && p + 2 < ec) {
+      p += 2;
+      if (uchar(*(p - 2)) <= c && c <= uchar(*p))
+        return sig;
+    } else if (uchar(*p) == c) {
+      return sig;
+    }
+  }
+  return !sig;
+}
+
+
+static int singlematch(ScanMatch *ms, const char *s, const char *p, const char *ep) {
+  if (s >= ms->src_end)
+    return 0;
+  int c = uchar(*s);
+  switch (*p) {
+    case '.': return 1;
+    case L_ESC: return match_class(c, uchar(*(p + 1)));
+    case '[': return matchbracketclass(c, p, ep - 1);
+    default: return uchar(*p) == c;
+  }
+}
+
+
+static const char *matchbalance(ScanMatch *ms, const char *s, const char *p) {
+  if (p >= ms->p_end - 1) {
+    ms->error = true;
+    return NULL;
+  }
+  if (s >= ms->src_end || *s != *p)
+    return NULL;
+  int b = *p, e = *(p + 1), cont = 1;
+  while (++s < ms->src_end) {
+    if (*s == e) {
+      if (--cont == 0)
+        return s + 1;
+    } else if (*s == b) {
+      cont++;
+    }
+  }
+  return NULL;
+}
+
+
+static const char *max_expand(ScanMatch *ms, const char *s, const char *p, const char *ep) {
+  ptrdiff_t i = 0;
+  while (singlematch(ms, s + i, p, ep))
+    i++;
+  while (i >= 0 && !ms->error) {
+    const char *res = scan_match(ms, s + i, ep + 1);
+    if (res) return res;
+    i--;
+  }
+  return NULL;
+}
+
+
+static const char *min_expand(ScanMatch *ms, const char *s, const char *p, const char *ep) {
+  for (;;) {
+    const char *res = scan_match(ms, s, ep + 1);
+    if (res)
+      return res;
+    else if (!ms->error && singlematch(ms, s, p, ep))
+      s++;
+    else
+      return NULL;
+  }
+}
+
+
+static const char *start_capture(ScanMatch *ms, const char *s, const char *p, int what) {
+  if (ms->level >= SCAN_MAXCAPTURES) {
+    ms->error = true;
+    return NULL;
+  }
+  ms->capture[ms->level].init = s;
+  ms->capture[ms->level].len = what;
+  ms->level++;
+  const char *res = scan_match(ms, s, p);
+  if (!res)
+    ms->level--;
+  return res;
+}
+
+
+static const char *end_capture(ScanMatch *ms, const char *s, const char *p) {
+  int l = -1;
+  for (int i = ms->level - 1; i >= 0; i--) {
+    if (ms->capture[i].len == CAP_UNFINISHED) {
+      l = i;
+      break;
+    }
+  }
+  if (l < 0) {
+    ms->error = true;
+    return NULL;
+  }
+  ms->capture[l].len = s - ms->capture[l].init;
+  const char *res = scan_match(ms, s, p);
+  if (!res)
+    ms->capture[l].len = CAP_UNFINISHED;
+  return res;
+}
+
+
+static const char *match_capture(ScanMatch *ms, const char *s, int l) {
+  l -= '1';
+  if (l < 0 || l >= ms->level || ms->capture[l].len == CAP_UNFINISHED) {
+    ms->error = true;
+    return NULL;
+  }
+  if (ms->capture[l].len == CAP_POSITION)
+    return NULL;
+  size_t len = ms->capture[l].len;
+  if ((size_t)(ms->src_end - s) >= len && memcmp(ms->capture[l].init, s, len) == 0)
+    return s + len;
+  return NULL;
+}
+
+
+static const char *scan_match(ScanMatch *ms, const char *s, const char *p) {
+  if (ms->matchdepth-- == 0) {
+    ms->error = true;
+    return NULL;
+  }
+  while (p != ms->p_end && s) {
+    const char *ep;
+    switch (*p) {
+      case '(':
+        if (*(p + 1) == ')')
+          s = start_capture(ms, s, p + 2, CAP_POSITION);
+        else
+          s = start_capture(ms, s, p + 1, CAP_UNFINISHED);
+        goto done;
+      case ')':
+        s = end_capture(ms, s, p + 1);
+        goto done;
+      case '$':
+        if (p + 1 != ms->p_end)
+          goto dflt;
+        s = (s == ms->src_end) ? s : NULL;
+        goto done;
+      case L_ESC:
+        switch (*(p + 1)) {
+          case 'b':
+            s = matchbalance(ms, s, p + 2);
+            if (s) {
+              p += 4;
+              continue;
+            }
+            goto done;
+          case 'f': {
+            p += 2;
+            if (*p != '[') {
+              ms->error = true;
+              s = NULL;
+              goto done;
+            }
+            ep = classend(ms, p);
+            if (ms->error) {
+              s = NULL;
+              goto done;
+            }
+            int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+            int current = (s < ms->src_end) ? uchar(*s) : '\0';
+            if (!matchbracketclass(previous, p, ep - 1) && matchbracketclass(current, p, ep - 1)) {
+              p = ep;
+              continue;
+            }
+            s = NULL;
+            goto done;
+          }
+          case '0': case '1': case '2': case '3': case '4':
+          case '5': case '6': case '7': case '8': case '9':
+            s = match_capture(ms, s, uchar(*(p + 1)));
+            if (s) {
+              p += 2;
+              continue;
+            }
+            goto done;
+          default:
+            goto dflt;
+        }
+      default: dflt:
+        ep = classend(ms, p);
+        if (ms->error) {
+          s = NULL;
+          goto done;
+        }
+        if (!singlematch(ms, s, p, ep)) {
+          if (*ep == '*' || *ep == '?' || *ep == '-') {
+            p = ep + 1;
+            continue;
+          }
+          s = NULL;
+        } else {
+          switch (*ep) {
+            case '?': {
+              const char *res = scan_match(ms, s + 1, ep + 1);
+              if (res) {
+                s = res;
+              } else {
+                p = ep + 1;
+                continue;
+              }
+              break;
+            }
+            case '+': s = max_expand(ms, s + 1, p, ep); break;
+            case '*': s = max_expand(ms, s, p, ep); break;
+            case '-': s = min_expand(ms, s, p, ep); break;
+            default:
+              s++;
+              p = ep;
+              continue;
+          }
+        }
+        goto done;
+    }
+  }
+done:
+  ms->matchdepth++;
+  return ms->error ? NULL : s;
+}
+
+
+/* like string.match(s, p) ~= nil, `s` and `p` being zero terminated */
+static bool scan_find(const char *s, size_t ls, const char *p, size_t lp) {
+  ScanMatch ms;
+  bool anchor = *p == '^';
+  if (anchor) {
+    p++;
+    lp--;
+  }
+  ms.src_init = s;
+  ms.src_end = s + ls;
+  ms.p_end = p + lp;
+  ms.error = false;
+  const char *s1 = s;
+  do {
+    ms.level = 0;
+    ms.matchdepth = SCAN_MAXCCALLS;
+    if (scan_match(&ms, s1, p))
+      return true;
+    if (ms.error)
+      return false;
+  } while (s1++ < ms.src_end && !anchor);
+  return false;
+}
+
+
+/* Whether config.ignore_files excludes an entry, only looking at the patterns
+** for directories or for any entry. `path` starts with "/", uses "/" as
+** separator and has room for a "/" after it. */
+static bool scan_ignored(Scanner *S, char *path, size_t path_len, const char *name, size_t name_len, bool dir_patterns) {
+  for (int i = 0; i < S->n_ignore; i++) {
+    ScanIgnore *ig = &S->ignore[i];
+    if (ig->match_dir != dir_patterns)
+      continue;
+    if (ig->match_dir) {
+      /* the name is at the end of the path, both can be followed by "/" */
+      char *test = path;
+      size_t len = path_len;
+      if (!ig->use_path) {
+        test = path + path_len - name_len;
+        len = name_len;
+      }
+      test[len] = '/';
+      test[len + 1] = '\0';
+      bool ignored = scan_find(test, len + 1, ig->pattern, ig->len);
+      test[len] = '\0';
+      if (ignored)
+        return true;
+    } else if (scan_find(ig->use_path ? path : name, ig->use_path ? path_len : name_len, ig->pattern, ig->len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static void *scan_grow(void *ptr, size_t *capacity, size_t needed, size_t size) {
+  if (needed <= *capacity)
+    return ptr;
+  size_t new_capacity = *capacity ? *capacity * 2 : 16;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  void *new_ptr = realloc(ptr, new_capacity * size);
+  if (!new_ptr)
+    return NULL;
+  *capacity = new_capacity;
+  return new_ptr;
+}
+
+
+static bool scan_add(Scanner *S, ScanDir *D, char *match_path, size_t match_len, const char *name, size_t name_len,
+                     int type, bool symlink, int64_t size, int64_t modified) {
+  if (size >= S->size_limit)
+    return true;
+  if (type == 0 && scan_ignored(S, match_path, match_len, name, name_len, true))
+    return true;
+  ScanEntry *entries = scan_grow(D->entries, &D->entries_size, D->n_entries + 1, sizeof(ScanEntry));
+  char *copy = malloc(name_len + 1);
+  if (entries)
+    D->entries = entries;
+  if (!entries || !copy) {
+    free(copy);
+    return false;
+  }
+  memcpy(copy, name, name_len + 1);
+  D->entries[D->n_entries++] = (ScanEntry) {
+    .name = copy, .len = name_len, .type = type, .symlink = symlink,
+    .size = size, .modified = modified, .dir = NULL
+  };
+  return true;
+}
+
+
+/* Lists a directory into its entries. `match_path` is the "/" separated path
+** of the directory, with room for the names of its entries. */
+#ifdef _WIN32
+static bool scan_list(Scanner *S, ScanDir *D, char *match_path, size_t match_len) {
+  size_t len = S->root_len + 1 + D->len + 2;
+  char *pattern = malloc(len + 1);
+  if (!pattern)
+    return false;
+  snprintf(pattern, len + 1, "%s%s%s\\*", S->root, D->len ? "\\" : "", D->path);
+  LPWSTR wpattern = utfconv_utf8towc(pattern);
+  free(pattern);
+  if (!wpattern)
+    return false;
+  WIN32_FIND_DATAW fd;
+  HANDLE find_handle = FindFirstFileExW(wpattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, 0);
+  free(wpattern);
+  if (find_handle == INVALID_HANDLE_VALUE)
+    return false;
+  char name[MAX_PATH * 4];
+  bool ok = true;
+  do {
+    if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0)
+      continue;
+    int name_len = WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1, name, sizeof(name), NULL, NULL);
+    if (name_len == 0)
+      continue;
+    name_len--;
+    memcpy(match_path + match_len + 1, name, name_len + 1);
+    match_path[match_len] = '/';
+    size_t path_len = match_len + 1 + name_len;
+    if (scan_ignored(S, match_path, path_len, name, name_len, false))
+      continue;
+    int type = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? 0 : 1;
+    int64_t size = ((int64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+    int64_t modified = ((((int64_t)fd.ftLastWriteTime.dwHighDateTime << 32) |
+      fd.ftLastWriteTime.dwLowDateTime) - 116444736000000000LL) / 10000000;
+    if (!(ok = scan_add(S, D, match_path, path_len, name, name_len, type, false, size, modified)))
+      break;
+  } while (FindNextFileW(find_handle, &fd));
+  FindClose(find_handle);
+  match_path[match_len] = '\0';
+  return ok;
+}
+#else
+static bool scan_list(Scanner *S, ScanDir *D, char *match_path, size_t match_len) {
+  size_t len = S->root_len + 1 + D->len;
+  char *path = malloc(len + 1);
+  if (!path)
+    return false;
+  snprintf(path, len + 1, "%s%s%s", S->root, D->len ? "/" : "", D->path);
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  free(path);
+  DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+  if (!dir) {
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  bool ok = true;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    const char *name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+    size_t name_len = strlen(name);
+    memcpy(match_path + match_len + 1, name, name_len + 1);
+    match_path[match_len] = '/';
+    size_t path_len = match_len + 1 + name_len;
+    /* patterns for any entry don't need it to be stat'ed */
+    if (scan_ignored(S, match_path, path_len, name, name_len, false))
+      continue;
+    struct stat s;
+    if (fstatat(dirfd(dir), name, &s, 0) < 0)
+      continue;
+    int type;
+    if (S_ISREG(s.st_mode))
+      type = 1;
+    else if (S_ISDIR(s.st_mode))
+      type = 0;
+    else
+      continue;
+    bool symlink = false;
+  #ifdef __linux__
+    if (type == 0) {
+      struct stat ls;
+      if (entry->d_type == DT_LNK)
+        symlink = true;
+      else if (entry->d_type == DT_UNKNOWN && fstatat(dirfd(dir), name, &ls, AT_SYMLINK_NOFOLLOW) == 0)
+        symlink = S_ISLNK(ls.st_mode);
+    }
+  #endif
+    if (!(ok = scan_add(S, D, match_path, path_len, name, name_len, type, symlink, s.st_size, s.st_mtime)))
+      break;
+  }
+  closedir(dir);
+  match_path[match_len] = '\0';
+  return ok;
+}
+#endif
+
+
+static int scan_compare(const void *a, const void *b) {
+  const ScanEntry *e1 = a, *e2 = b;
+  if (system_path_compare(e1->name, e1->len, e1->type, e2->name, e2->len, e2->type))
+    return -1;
+  if (system_path_compare(e2->name, e2->len, e2->type, e1->name, e1->len, e1->type))
+    return 1;
+  return 0;
+}
+
+
+/* adds a directory to list, taking the allocated path */
+static bool scan_push_dir(Scanner *S, char *path, size_t len, ScanDir **dir) {
+  ScanDir *D = path ? calloc(1, sizeof(ScanDir)) : NULL;
+  ScanDir **dirs = scan_grow(S->dirs, &S->dirs_size, S->n_dirs + 1, sizeof(ScanDir*));
+  if (dirs)
+    S->dirs = dirs;
+  ScanDir **stack = scan_grow(S->stack, &S->stack_size, S->n_stack + 1, sizeof(ScanDir*));
+  if (stack)
+    S->stack = stack;
+  if (!D || !dirs || !stack) {
+    free(D);
+    free(path);
+    return false;
+  }
+  D->path = path;
+  D->len = len;
+  S->dirs[S->n_dirs++] = D;
+  S->stack[S->n_stack++] = D;
+  *dir = D;
+  return true;
+}
+
+
+/* lists a directory and queues its subdirectories, returns false if it
+** couldn't be listed */
+static bool scan_process(Scanner *S, ScanDir *D) {
+  /* "/" separated path of the directory, with room for an entry and a "/" */
+  char match_path[4096 + 1024];
+  bool ok = false;
+  if (D->len + 1024 < sizeof(match_path)) {
+    match_path[0] = '/';
+    for (size_t i = 0; i <= D->len; i++)
+      match_path[i + 1] = D->path[i] == PATHSEP ? '/' : D->path[i];
+    ok = scan_list(S, D, match_path, D->len ? D->len + 1 : 0);
+  }
+  if (ok && D->n_entries)
+    qsort(D->entries, D->n_entries, sizeof(ScanEntry), scan_compare);
+  int count = SDL_AtomicAdd(&S->count, D->n_entries) + D->n_entries;
+
+  SDL_LockMutex(S->mutex);
+  D->listed = true;
+  if ((S->max_files && count > S->max_files) || (S->deadline && SDL_GetPerformanceCounter() > S->deadline))
+    S->stop = true;
+  for (size_t i = 0; S->recursive && !S->stop && i < D->n_entries; i++) {
+    ScanEntry *e = &D->entries[i];
+    if (e->type != 0)
+      continue;
+    size_t len = D->len + (D->len ? 1 : 0) + e->len;
+    char *path = malloc(len + 1);
+    if (path)
+      snprintf(path, len + 1, "%s%s%s", D->path, D->len ? PATHSEP_STR : "", e->name);
+    if (!scan_push_dir(S, path, len, &e->dir))
+      S->stop = S->failed = true;
+  }
+  SDL_CondBroadcast(S->cond);
+  SDL_UnlockMutex(S->mutex);
+  return ok;
+}
+
+
+static int scan_worker(void *data) {
+  Scanner *S = data;
+  SDL_LockMutex(S->mutex);
+  for (;;) {
+    while (!S->n_stack && S->busy && !S->stop)
+      SDL_CondWait(S->cond, S->mutex);
+    if (!S->n_stack || S->stop)
+      break;
+    ScanDir *D = S->stack[--S->n_stack];
+    S->busy++;
+    SDL_UnlockMutex(S->mutex);
+    scan_process(S, D);
+    SDL_LockMutex(S->mutex);
+    S->busy--;
+  }
+  SDL_CondBroadcast(S->cond);
+  SDL_UnlockMutex(S->mutex);
+  return 0;
+}
+
+
+/* pushes the entries of a directory and of its listed subdirectories,
+** returns false if some subdirectory wasn't listed */
+static bool scan_push(lua_State *L, ScanDir *D, lua_Integer *n) {
+  bool complete = true;
+  for (size_t i = 0; i < D->n_entries; i++) {
+    ScanEntry *e = &D->entries[i];
+    lua_createtable(L, 0, 5);
+    if (D->len) {
+      lua_pushlstring(L, D->path, D->len);
+      lua_pushliteral(L, PATHSEP_STR);
+      lua_pushlstring(L, e->name, e->len);
+      lua_concat(L, 3);
+    } else {
+      lua_pushlstring(L, e->name, e->len);
+    }
+    lua_setfield(L, -2, "filename");
+    lua_pushstring(L, e->type == 0 ? "dir" : "file");
+    lua_setfield(L, -2, "type");
+    lua_pushinteger(L, e->size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, e->modified);
+    lua_setfield(L, -2, "modified");
+  #ifdef __linux__
+    if (e->type == 0) {
+      lua_pushboolean(L, e->symlink);
+      lua_setfield(L, -2, "symlink");
+    }
+  #endif
+    lua_rawseti(L, -2, ++*n);
+    if (e->dir && e->dir->listed)
+      complete = scan_push(L, e->dir, n) && complete;
+    else if (e->type == 0)
+      complete = false;
+  }
+  return complete;
+}
+
+
+static void scan_free(Scanner *S) {
+  for (size_t i = 0; i < S->n_dirs; i++) {
+    ScanDir *D = S->dirs[i];
+    for (size_t j = 0; j < D->n_entries; j++)
+      free(D->entries[j].name);
+    free(D->entries);
+    free(D->path);
+    free(D);
+  }
+  free(S->dirs);
+  free(S->stack);
+  free(S->ignore);
+  if (S->cond) SDL_DestroyCond(S->cond);
+  if (S->mutex) SDL_DestroyMutex(S->mutex);
+}
+
+
+int system_scan_directory(lua_State *L) {
+  size_t root_len, path_len;
+  const char *root = luaL_checklstring(L, 1, &root_len);
+  const char *path = luaL_checklstring(L, 2, &path_len);
+  if (lua_isnoneornil(L, 3)) {
+    lua_settop(L, 2);
+    lua_newtable(L);
+  } else {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_settop(L, 3);
+  }
+
+  Scanner S = { 0 };
+  S.root = root;
+  S.root_len = root_len;
+  lua_getfield(L, 3, "recursive");
+  S.recursive = lua_toboolean(L, -1);
+  lua_getfield(L, 3, "max_files");
+  S.max_files = luaL_optinteger(L, -1, 0);
+  lua_getfield(L, 3, "max_time");
+  double max_time = luaL_optnumber(L, -1, 0);
+  if (max_time > 0)
+    S.deadline = SDL_GetPerformanceCounter() + (Uint64)(max_time * SDL_GetPerformanceFrequency());
+  lua_getfield(L, 3, "size_limit");
+  lua_Number size_limit = luaL_optnumber(L, -1, 0);
+  S.size_limit = size_limit > 0 && size_limit < (lua_Number)INT64_MAX ? (int64_t)size_limit : INT64_MAX;
+  lua_pop(L, 4);
+
+  /* the patterns stay referenced by the options table during the scan */
+  lua_getfield(L, 3, "ignore");
+  if (lua_istable(L, -1)) {
+    int n = lua_rawlen(L, -1);
+    S.ignore = calloc(n ? n : 1, sizeof(ScanIgnore));
+    if (!S.ignore)
+      return luaL_error(L, "can't allocate the ignore patterns");
+    for (int i = 1; i <= n; i++) {
+      lua_rawgeti(L, -1, i);
+      if (lua_istable(L, -1)) {
+        ScanIgnore *ig = &S.ignore[S.n_ignore];
+        lua_getfield(L, -1, "pattern");
+        lua_getfield(L, -2, "use_path");
+        lua_getfield(L, -3, "match_dir");
+        ig->pattern = (char*)lua_tolstring(L, -3, &ig->len);
+        ig->use_path = lua_toboolean(L, -2);
+        ig->match_dir = lua_toboolean(L, -1);
+        lua_pop(L, 3);
+        if (ig->pattern && ig->len > 0)
+          S.n_ignore++;
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+
+  S.mutex = SDL_CreateMutex();
+  S.cond = SDL_CreateCond();
+  char *top_path = S.mutex && S.cond ? malloc(path_len + 1) : NULL;
+  if (top_path)
+    memcpy(top_path, path, path_len + 1);
+  ScanDir *top = NULL;
+  if (!scan_push_dir(&S, top_path, path_len, &top)) {
+    scan_free(&S);
+    return luaL_error(L, "can't start scanning %s", root);
+  }
+  /* the first directory is listed here, to report if it can't be */
+  S.n_stack = 0;
+  if (!scan_process(&S, top)) {
+  #ifdef _WIN32
+    const char *error = "can't list the directory";
+  #else
+    const char *error = strerror(errno);
+  #endif
+    lua_pushnil(L);
+    lua_pushstring(L, error);
+    scan_free(&S);
+    return 2;
+  }
+
+  SDL_Thread *threads[SCAN_MAX_THREADS];
+  int n_threads = 0;
+  if (S.recursive) {
+    int cpus = SDL_GetCPUCount();
+    for (int i = 1; i < cpus && i < SCAN_MAX_THREADS; i++) {
+      threads[n_threads] = SDL_CreateThread(scan_worker, "scanner", &S);
+      if (threads[n_threads])
+        n_threads++;
+    }
+  }
+  scan_worker(&S);
+  for (int i = 0; i < n_threads; i++)
+    SDL_WaitThread(threads[i], NULL);
+
+  if (S.failed) {
+    scan_free(&S);
+    return luaL_error(L, "not enough memory to scan %s", root);
+  }
+  lua_newtable(L);
+  lua_Integer n = 0;
+  bool complete = scan_push(L, top, &n);
+  scan_free(&S);
+  lua_pushboolean(L, complete);
+  lua_pushinteger(L, SDL_AtomicGet(&S.count));
+  return 3;
+}
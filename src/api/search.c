@@ -0,0 +1,342 @@
+#include "api.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <pcre2.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Native search over a whole document, used by core.doc.search.
+** The text is searched in one piece instead of line by line, so matches can
+** span lines and regexes run in multi-line mode. Plain text is found with
+** memchr on its last byte, or with Boyer-Moore-Horspool over ASCII folded
+** bytes when ignoring case. Positions are only counted for the matches, by
+** jumping from newline to newline with memchr.
+** The text always starts at the beginning of a line and is searched from an
+** offset, so that `^`, `\b` and lookbehinds see the start of the line. It can
+** be a part of the document followed by more text, in which case a match
+** that could go on past its end isn't given and the position from which the
+** next part has to be searched is returned instead. */
+
+#define SEARCH_CHECK_BYTES (1024 * 1024) /* text searched between calls to `cancel` */
+#define SEARCH_CHECK_MATCHES 4096         /* or matches found */
+
+typedef struct {
+  lua_State *L;
+  const char *text;
+  size_t len;
+  /* offset where the search starts, and where the next part of the
+  ** document has to be searched from when `more` is set */
+  size_t start, resume;
+  /* line of the last position asked for, and where it starts in `text` */
+  lua_Integer line;
+  size_t line_start, counted;
+  /* stack indexes of the results table and of the cancel function, 0 if none */
+  int results, cancel;
+  lua_Integer n_results, limit;
+  size_t next_check;
+  bool more, stopped, failed;
+} Search;
+
+typedef struct {
+  const unsigned char *pattern; /* folded */
+  size_t len;
+  size_t skip[256];
+  unsigned char fold[256];
+  bool no_case;
+} SearchPlain;
+
+
+static void search_position(Search *s, size_t offset, lua_Integer *line, lua_Integer *col) {
+  while (s->counted < offset) {
+    const char *nl = memchr(s->text + s->counted, '\n', offset - s->counted);
+    if (!nl) {
+      s->counted = offset;
+      break;
+    }
+    s->line++;
+    s->line_start = s->counted = nl - s->text + 1;
+  }
+  *line = s->line;
+  *col = offset - s->line_start + 1;
+}
+
+
+/* calls `cancel` with the progress, returns false once the search has to stop */
+static bool search_check(Search *s, size_t offset) {
+  s->next_check = offset + SEARCH_CHECK_BYTES;
+  if (!s->cancel) return true;
+  lua_State *L = s->L;
+  lua_pushvalue(L, s->cancel);
+  lua_pushnumber(L, s->len ? (double)offset / s->len : 1.0);
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    /* the error is left on the stack, raised once everything is freed */
+    s->failed = s->stopped = true;
+    return false;
+  }
+  s->stopped = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  return !s->stopped;
+}
+
+
+/* returns false once the search has to stop */
+static bool search_push(Search *s, size_t start, size_t end) {
+  lua_State *L = s->L;
+  lua_Integer line1, col1, line2, col2;
+  search_position(s, start, &line1, &col1);
+  search_position(s, end, &line2, &col2);
+  lua_Integer n = s->n_results * 4;
+  lua_pushinteger(L, line1); lua_rawseti(L, s->results, n + 1);
+  lua_pushinteger(L, col1);  lua_rawseti(L, s->results, n + 2);
+  lua_pushinteger(L, line2); lua_rawseti(L, s->results, n + 3);
+  lua_pushinteger(L, col2);  lua_rawseti(L, s->results, n + 4);
+  s->n_results++;
+  if (s->limit && s->n_results >= s->limit) {
+    s->stopped = true;
+    return false;
+  }
+  if (s->n_results % SEARCH_CHECK_MATCHES == 0 || end >= s->next_check)
+    return search_check(s, end);
+  return true;
+}
+
+
+static void search_plain_init(SearchPlain *p, unsigned char *folded, const char *pattern, size_t len, bool no_case) {
+  for (int i = 0; i < 256; i++)
+    p->fold[i] = no_case && i >= 'A' && i <= 'Z' ? i - 'A' + 'a' : i;
+  for (size_t i = 0; i < len; i++)
+    folded[i] = p->fold[(unsigned char)pattern[i]];
+  for (int i = 0; i < 256; i++)
+    p->skip[i] = len;
+  for (size_t i = 0; i + 1 < len; i++)
+    p->skip[folded[i]] = len - 1 - i;
+  p->pattern = folded;
+  p->len = len;
+  p->no_case = no_case;
+}
+
+
+static bool search_plain_matches(const SearchPlain *p, const unsigned char *t) {
+  if (!p->no_case)
+    return memcmp(t, p->pattern, p->len - 1) == 0;
+  for (size_t i = 0; i + 1 < p->len; i++) {
+    if (p->fold[t[i]] != p->pattern[i])
+      return false;
+  }
+  return true;
+}
+
+
+static void search_plain(Search *s, const SearchPlain *p) {
+  const unsigned char *t = (const unsigned char*)s->text;
+  size_t m = p->len;
+  unsigned char last = p->pattern[m - 1];
+  size_t pos = s->start;
+  /* a match starting in the last m - 1 bytes could end in the next part */
+  s->resume = m <= s->len ? s->len - m + 1 : 0;
+  while (m <= s->len && pos <= s->len - m) {
+    /* the candidates are checked in blocks, to call `cancel` between them */
+    size_t stop = s->len - m;
+    if (stop - pos > SEARCH_CHECK_BYTES)
+      stop = pos + SEARCH_CHECK_BYTES;
+    while (pos <= stop) {
+      if (!p->no_case) {
+        /* jump to the next occurrence of the last byte of the pattern */
+        const unsigned char *c = memchr(t + pos + m - 1, last, stop - pos + 1);
+        if (!c) {
+          pos = stop + 1;
+          break;
+        }
+        pos = c - t - (m - 1);
+      }
+      unsigned char b = p->fold[t[pos + m - 1]];
+      if (b == last && search_plain_matches(p, t + pos)) {
+        if (!search_push(s, pos, pos + m))
+          return;
+        pos += m;
+      } else {
+        pos += p->skip[b];
+      }
+    }
+    if (pos >= s->next_check && !search_check(s, pos))
+      return;
+  }
+}
+
+
+static void search_regex(Search *s, pcre2_code *re, pcre2_match_data *md) {
+  PCRE2_SPTR subject = (PCRE2_SPTR)s->text;
+  size_t offset = s->start;
+  uint32_t options = 0;
+  /* with more text to come, stop at a match that reaches the end */
+  uint32_t partial = s->more ? PCRE2_PARTIAL_HARD : 0;
+  s->resume = s->len;
+  while (offset <= s->len) {
+    int rc = pcre2_match(re, subject, s->len, offset, options | partial, md, NULL);
+    if (rc == PCRE2_ERROR_PARTIAL) {
+      s->resume = pcre2_get_ovector_pointer(md)[0];
+      return;
+    }
+    if (rc == PCRE2_ERROR_NOMATCH) {
+      if (!options) return;
+      /* no other match at the position of an empty one, skip a character */
+      options = 0;
+      offset++;
+      while (offset < s->len && (s->text[offset] & 0xC0) == 0x80)
+        offset++;
+      continue;
+    }
+    if (rc < 0) {
+      PCRE2_UCHAR buffer[120];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      lua_pushfstring(s->L, "regex matching error %d: %s", rc, buffer);
+      s->failed = s->stopped = true;
+      return;
+    }
+    PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(md);
+    if (ovector[0] > ovector[1]) {
+      lua_pushliteral(s->L, "regex matching error: \\K was used in an assertion to "
+        " set the match start after its end");
+      s->failed = s->stopped = true;
+      return;
+    }
+    if (!search_push(s, ovector[0], ovector[1]))
+      return;
+    offset = ovector[1];
+    /* after an empty match, look for a non-empty one at the same position */
+    options = ovector[0] == ovector[1] ? PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED : 0;
+    if (offset >= s->next_check && !search_check(s, offset))
+      return;
+  }
+}
+
+
+/* copies the lines of a table from `line` to `last_line` */
+static const char *search_lines(lua_State *L, int idx, lua_Integer line, lua_Integer last_line, size_t *len) {
+  lua_Integer n = lua_rawlen(L, idx);
+  if (last_line > 0 && last_line < n)
+    n = last_line;
+  size_t total = 0, l;
+  for (lua_Integer i = line; i <= n; i++) {
+    lua_rawgeti(L, idx, i);
+    if (!lua_isstring(L, -1))
+      luaL_error(L, "line %d is not a string", (int)i);
+    lua_tolstring(L, -1, &l);
+    total += l;
+    lua_pop(L, 1);
+  }
+  char *text = lua_newuserdata(L, total ? total : 1);
+  *len = 0;
+  for (lua_Integer i = line; i <= n; i++) {
+    lua_rawgeti(L, idx, i);
+    const char *s = lua_tolstring(L, -1, &l);
+    memcpy(text + *len, s, l);
+    *len += l;
+    lua_pop(L, 1);
+  }
+  return text;
+}
+
+
+static int f_find(lua_State *L) {
+  size_t pattern_len;
+  const char *pattern = luaL_checklstring(L, 2, &pattern_len);
+  if (lua_isnoneornil(L, 3)) {
+    lua_settop(L, 2);
+    lua_newtable(L);
+  } else {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_settop(L, 3);
+  }
+
+  lua_getfield(L, 3, "line");
+  lua_getfield(L, 3, "col");
+  lua_getfield(L, 3, "no_case");
+  lua_getfield(L, 3, "regex");
+  lua_getfield(L, 3, "limit");
+  lua_getfield(L, 3, "cancel");
+  lua_getfield(L, 3, "last_line");
+  lua_getfield(L, 3, "more");
+  Search s = { 0 };
+  s.L = L;
+  lua_Integer line = s.line = luaL_optinteger(L, 4, 1);
+  lua_Integer col = luaL_optinteger(L, 5, 1);
+  luaL_argcheck(L, line >= 1 && col >= 1, 3, "invalid position");
+  bool no_case = lua_toboolean(L, 6);
+  bool regex = lua_toboolean(L, 7);
+  s.limit = luaL_optinteger(L, 8, 0);
+  if (!lua_isnil(L, 9)) {
+    luaL_checktype(L, 9, LUA_TFUNCTION);
+    s.cancel = 9;
+  }
+  lua_Integer last_line = luaL_optinteger(L, 10, 0);
+  s.more = lua_toboolean(L, 11);
+
+  if (lua_type(L, 1) == LUA_TTABLE)
+    s.text = search_lines(L, 1, line, last_line, &s.len);
+  else
+    s.text = luaL_checklstring(L, 1, &s.len);
+  /* the search starts at `col` of the first line */
+  const char *nl = memchr(s.text, '\n', s.len);
+  size_t first_len = nl ? (size_t)(nl - s.text) + 1 : s.len;
+  s.start = (size_t)col - 1 < first_len ? (size_t)col - 1 : first_len;
+  s.resume = s.len;
+  s.next_check = s.start + SEARCH_CHECK_BYTES;
+
+  lua_newtable(L);
+  s.results = lua_gettop(L);
+
+  if (regex) {
+    int errornumber;
+    PCRE2_SIZE erroroffset;
+    uint32_t flags = PCRE2_UTF | PCRE2_MULTILINE | (no_case ? PCRE2_CASELESS : 0);
+#ifdef PCRE2_MATCH_INVALID_UTF
+    flags |= PCRE2_MATCH_INVALID_UTF;
+#endif
+    pcre2_code *re = pcre2_compile((PCRE2_SPTR)pattern, pattern_len, flags,
+      &errornumber, &erroroffset, NULL);
+    if (!re) {
+      PCRE2_UCHAR errmsg[256];
+      pcre2_get_error_message(errornumber, errmsg, sizeof(errmsg));
+      return luaL_error(L, "regex pattern error at offset %d: %s", (int)erroroffset, errmsg);
+    }
+    pcre2_jit_compile(re, PCRE2_JIT_COMPLETE | (s.more ? PCRE2_JIT_PARTIAL_HARD : 0));
+    pcre2_match_data *md = pcre2_match_data_create_from_pattern(re, NULL);
+    search_regex(&s, re, md);
+    pcre2_match_data_free(md);
+    pcre2_code_free(re);
+  } else if (pattern_len > 0) {
+    SearchPlain *p = lua_newuserdata(L, sizeof(SearchPlain) + pattern_len);
+    search_plain_init(p, (unsigned char*)(p + 1), pattern, pattern_len, no_case);
+    search_plain(&s, p);
+  }
+
+  if (s.failed)
+    return lua_error(L);
+  lua_pushvalue(L, s.results);
+  lua_pushboolean(L, !s.stopped);
+  if (!s.more || s.stopped)
+    return 2;
+  /* matches never overlap, the next part starts after the last one */
+  size_t resume = s.resume > s.counted ? s.resume : s.counted;
+  if (resume < s.start)
+    resume = s.start;
+  lua_Integer resume_line, resume_col;
+  search_position(&s, resume, &resume_line, &resume_col);
+  lua_pushinteger(L, resume_line);
+  lua_pushinteger(L, resume_col);
+  return 4;
+}
+
+
+static const luaL_Reg lib[] = {
+  { "find", f_find },
+  { NULL,   NULL   }
+};
+
+int luaopen_native_search(lua_State *L) {
+  luaL_newlib(L, lib);
+  return 1;
+}
@@ -373,6 +373,17 @@ top:
       #endif
       lua_pushstring(L, e.type == SDL_APP_WILLENTERFOREGROUND ? "enteringforeground" : "enteredforeground");
       return 1;
+    case SDL_RENDER_TARGETS_RESET:
+      /* the window content kept in the render target was lost */
+      rencache_invalidate();
+      lua_pushstring(L, "exposed");
+      return 1;
+    case SDL_RENDER_DEVICE_RESET:
+      /* every texture was lost, the glyph pages and the render target too */
+      ren_reset_textures(&window_renderer);
+      rencache_invalidate();
+      lua_pushstring(L, "exposed");
+      return 1;
     case SDL_APP_WILLENTERBACKGROUND:
       lua_pushstring(L, "enteringbackground");
       return 1;
@@ -860,6 +871,133 @@ static int f_list_dir(lua_State *L) {
 }
 
 
+/* Lists a directory as a table of arrays instead of a table per entry, with
+** the type, size and modification time of the entries like f_get_file_info.
+** On Windows they come with the entries, otherwise the type is taken from
+** d_type when possible and the entries are only stat'ed for the rest. */
+static void push_dir_entry(lua_State *L, int n, const char *name, size_t len,
+                           bool dir, bool types_only, lua_Integer size, lua_Integer modified) {
+  lua_pushlstring(L, name, len);
+  lua_rawseti(L, -5, n);
+  lua_pushstring(L, dir ? "dir" : "file");
+  lua_rawseti(L, -4, n);
+  if (!types_only) {
+    lua_pushinteger(L, size);
+    lua_rawseti(L, -3, n);
+    lua_pushinteger(L, modified);
+    lua_rawseti(L, -2, n);
+  }
+}
+
+
+static int f_list_dir_info(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  bool types_only = lua_toboolean(L, 2);
+
+#ifdef _WIN32
+  lua_settop(L, 1);
+  if (path[0] == 0 || strchr("\\/", path[strlen(path) - 1]) != NULL)
+    lua_pushstring(L, "*");
+  else
+    lua_pushstring(L, "/*");
+
+  lua_concat(L, 2);
+  path = lua_tostring(L, -1);
+
+  LPWSTR wpath = utfconv_utf8towc(path);
+  if (wpath == NULL) {
+    lua_pushnil(L);
+    lua_pushstring(L, UTFCONV_ERROR_INVALID_CONVERSION);
+    return 2;
+  }
+
+  WIN32_FIND_DATAW fd;
+  HANDLE find_handle = FindFirstFileExW(wpath, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, 0);
+  free(wpath);
+  if (find_handle == INVALID_HANDLE_VALUE) {
+    lua_pushnil(L);
+    push_win32_error(L, GetLastError());
+    return 2;
+  }
+#else
+  DIR *dir = opendir(path);
+  if (!dir) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+#endif
+
+  lua_createtable(L, 0, 4);
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -3, "names");
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -4, "types");
+  lua_newtable(L);
+  lua_newtable(L);
+  if (!types_only) {
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -6, "sizes");
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -6, "modified");
+  }
+  int n = 0;
+
+#ifdef _WIN32
+  char mbpath[MAX_PATH * 4]; // utf-8 spans 4 bytes at most
+  do
+  {
+    if (wcscmp(fd.cFileName, L".") == 0) { continue; }
+    if (wcscmp(fd.cFileName, L"..") == 0) { continue; }
+
+    int len = WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1, mbpath, MAX_PATH * 4, NULL, NULL);
+    if (len == 0) { break; }
+    lua_Integer size = ((lua_Integer)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+    lua_Integer modified = ((((lua_Integer)fd.ftLastWriteTime.dwHighDateTime << 32) |
+      fd.ftLastWriteTime.dwLowDateTime) - 116444736000000000LL) / 10000000;
+    push_dir_entry(L, ++n, mbpath, len - 1, fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY,
+      types_only, size, modified);
+  } while (FindNextFileW(find_handle, &fd));
+
+  if (GetLastError() != ERROR_NO_MORE_FILES) {
+    lua_pushnil(L);
+    push_win32_error(L, GetLastError());
+    FindClose(find_handle);
+    return 2;
+  }
+
+  FindClose(find_handle);
+#else
+  struct dirent *entry;
+  while ( (entry = readdir(dir)) ) {
+    if (strcmp(entry->d_name, "." ) == 0) { continue; }
+    if (strcmp(entry->d_name, "..") == 0) { continue; }
+    bool is_dir;
+    struct stat s = { 0 };
+  #ifdef DT_UNKNOWN
+    if (types_only && (entry->d_type == DT_REG || entry->d_type == DT_DIR)) {
+      is_dir = entry->d_type == DT_DIR;
+    } else
+  #endif
+    {
+      /* symbolic links are followed, like by f_get_file_info */
+      if (fstatat(dirfd(dir), entry->d_name, &s, 0) < 0) { continue; }
+      if (!S_ISREG(s.st_mode) && !S_ISDIR(s.st_mode)) { continue; }
+      is_dir = S_ISDIR(s.st_mode);
+    }
+    push_dir_entry(L, ++n, entry->d_name, strlen(entry->d_name), is_dir,
+      types_only, s.st_size, s.st_mtime);
+  }
+
+  closedir(dir);
+#endif
+  lua_pop(L, 4);
+  return 1;
+}
+
+
 #ifdef _WIN32
   #define realpath(x, y) _wfullpath(y, x, MAX_PATH)
 #endif
@@ -1247,14 +1385,10 @@ static int f_load_native_plugin(lua_State *L) {
 /* Special purpose filepath compare function. Corresponds to the
    order used in the TreeView view of the project's files. Returns true iff
    path1 < path2 in the TreeView order. */
-static int f_path_compare(lua_State *L) {
-  size_t len1, len2;
-  const char *path1 = luaL_checklstring(L, 1, &len1);
-  const char *type1_s = luaL_checkstring(L, 2);
-  const char *path2 = luaL_checklstring(L, 3, &len2);
-  const char *type2_s = luaL_checkstring(L, 4);
-  int type1 = strcmp(type1_s, "dir") != 0;
-  int type2 = strcmp(type2_s, "dir") != 0;
+/* Whether path1 comes before path2 in the project files list, the types are 0
+   for directories and 1 for files. Also used by the native project scanner. */
+int system_path_compare(const char *path1, size_t len1, int type1,
+                        const char *path2, size_t len2, int type2) {
   /* Find the index of the common part of the path. */
   size_t offset = 0, i, j;
   for (i = 0; i < len1 && i < len2; i++) {
@@ -1274,8 +1408,7 @@ static int f_path_compare(lua_State *L) {
   }
   /* If types are different "dir" types comes before "file" types. */
   if (type1 != type2) {
-    lua_pushboolean(L, type1 < type2);
-    return 1;
+    return type1 < type2;
   }
   /* If types are the same compare the files' path alphabetically. */
   int cfr = -1;
@@ -1325,7 +1458,19 @@ static int f_path_compare(lua_State *L) {
     }
     break;
   }
-  lua_pushboolean(L, cfr);
+  return cfr;
+}
+
+
+static int f_path_compare(lua_State *L) {
+  size_t len1, len2;
+  const char *path1 = luaL_checklstring(L, 1, &len1);
+  const char *type1_s = luaL_checkstring(L, 2);
+  const char *path2 = luaL_checklstring(L, 3, &len2);
+  const char *type2_s = luaL_checkstring(L, 4);
+  int type1 = strcmp(type1_s, "dir") != 0;
+  int type2 = strcmp(type2_s, "dir") != 0;
+  lua_pushboolean(L, system_path_compare(path1, len1, type1, path2, len2, type2));
   return 1;
 }
 
@@ -1339,6 +1484,10 @@ static int f_text_input(lua_State* L) {
 }
 
 
+int system_scan_directory(lua_State *L);
+int system_load_project_index(lua_State *L);
+int system_save_project_index(lua_State *L);
+
 static const luaL_Reg lib[] = {
   { "poll_event",          f_poll_event          },
   { "wait_event",          f_wait_event          },
@@ -1360,6 +1509,7 @@ static const luaL_Reg lib[] = {
   { "chdir",               f_chdir               },
   { "mkdir",               f_mkdir               },
   { "list_dir",            f_list_dir            },
+  { "list_dir_info",       f_list_dir_info       },
   { "absolute_path",       f_absolute_path       },
   { "get_file_info",       f_get_file_info       },
   { "get_clipboard",       f_get_clipboard       },
@@ -1372,6 +1522,9 @@ static const luaL_Reg lib[] = {
   { "set_window_opacity",  f_set_window_opacity  },
   { "load_native_plugin",  f_load_native_plugin  },
   { "path_compare",        f_path_compare        },
+  { "scan_directory",      system_scan_directory },
+  { "load_project_index",  system_load_project_index },
+  { "save_project_index",  system_save_project_index },
   { "get_fs_type",         f_get_fs_type         },
   { "text_input",          f_text_input          },
   { NULL, NULL }
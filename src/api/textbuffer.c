@@ -0,0 +1,1114 @@
+#include "api.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include "../utfconv.h"
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define TEXTBUFFER_SSE2
+  #include <emmintrin.h>
+#endif
+
+/* Native storage for the text of big documents.
+** The text is kept in chunks of a few KB, each one knowing its length and how
+** many newlines it holds. Two Fenwick trees over the chunks give the chunk
+** holding a byte or the n-th newline in O(log n), so an edit only moves the
+** bytes of the chunks it touches instead of the whole document, and lines are
+** only turned into Lua strings when they're asked for.
+** Read-only files without "\r" are mapped in memory instead of being read,
+** their chunks point into the mapping until they're edited, so opening a file
+** only costs a scan for its newlines. Files that can be written are always
+** read: another program truncating a mapped file would crash the editor with
+** SIGBUS, and writing to it would change the text under the newline counts.
+** Lines and columns are 1-based and in bytes like in core.doc, lines include
+** their "\n". */
+
+#define CHUNK_SIZE 16384          /* size of the chunks made from new text */
+#define CHUNK_MAX  (CHUNK_SIZE * 2) /* chunks growing past this are split */
+#define CHUNK_MIN  (CHUNK_SIZE / 8) /* and merged with a neighbour below this */
+#define MAP_MIN_SIZE (CHUNK_MAX * 8) /* smaller files are just read */
+
+typedef struct {
+  char *text;
+  size_t len, size; /* `size` is 0 when `text` points into the file mapping */
+  size_t newlines;
+} TextChunk;
+
+typedef struct {
+  const char *data;
+  size_t len;
+#ifdef _WIN32
+  HANDLE mapping;
+#endif
+} TextMapping;
+
+typedef struct {
+  TextChunk *chunks;
+  size_t n_chunks, chunks_size;
+  size_t *bytes, *newlines; /* Fenwick trees over the chunks, 1-based */
+  size_t tree_size;
+  size_t len, n_newlines;
+  TextMapping map;
+} TextBuffer;
+
+/* position of a byte in the buffer */
+typedef struct {
+  size_t chunk, offset;
+} TextPosition;
+
+
+static void *grow_array(lua_State *L, void *ptr, size_t *capacity, size_t needed, size_t size) {
+  if (needed <= *capacity)
+    return ptr;
+  size_t new_capacity = *capacity ? *capacity : 8;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  void *new_ptr = realloc(ptr, new_capacity * size);
+  if (!new_ptr)
+    luaL_error(L, "not enough memory");
+  *capacity = new_capacity;
+  return new_ptr;
+}
+
+
+static size_t count_newlines(const char *text, size_t len) {
+  size_t count = 0;
+#ifdef TEXTBUFFER_SSE2
+  /* every byte lane counts up to 255 matches before being summed up */
+  const __m128i newline = _mm_set1_epi8('\n');
+  while (len >= 16) {
+    __m128i counts = _mm_setzero_si128();
+    size_t n = len / 16 < 255 ? len / 16 : 255;
+    for (size_t i = 0; i < n; i++, text += 16)
+      counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) text), newline));
+    __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+    count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+    len -= n * 16;
+  }
+#endif
+  const char *end = text + len;
+  while ((text = memchr(text, '\n', end - text))) {
+    count++;
+    text++;
+  }
+  return count;
+}
+
+
+static void rebuild_trees(lua_State *L, TextBuffer *B) {
+  size_t capacity = B->tree_size;
+  B->bytes = grow_array(L, B->bytes, &capacity, B->n_chunks + 1, sizeof(size_t));
+  capacity = B->tree_size;
+  B->newlines = grow_array(L, B->newlines, &capacity, B->n_chunks + 1, sizeof(size_t));
+  B->tree_size = capacity;
+  B->len = B->n_newlines = 0;
+  for (size_t i = 1; i <= B->n_chunks; i++) {
+    B->bytes[i] = B->chunks[i - 1].len;
+    B->newlines[i] = B->chunks[i - 1].newlines;
+    B->len += B->chunks[i - 1].len;
+    B->n_newlines += B->chunks[i - 1].newlines;
+  }
+  for (size_t i = 1; i <= B->n_chunks; i++) {
+    size_t parent = i + (i & -i);
+    if (parent <= B->n_chunks) {
+      B->bytes[parent] += B->bytes[i];
+      B->newlines[parent] += B->newlines[i];
+    }
+  }
+}
+
+
+/* deltas are applied modulo SIZE_MAX + 1, so they can be "negative" */
+static void update_trees(TextBuffer *B, size_t chunk, size_t bytes, size_t newlines) {
+  B->len += bytes;
+  B->n_newlines += newlines;
+  for (size_t i = chunk + 1; i <= B->n_chunks; i += i & -i) {
+    B->bytes[i] += bytes;
+    B->newlines[i] += newlines;
+  }
+}
+
+
+/* sum of the first `chunk` chunks */
+static size_t tree_prefix(const size_t *tree, size_t chunk) {
+  size_t sum = 0;
+  for (size_t i = chunk; i > 0; i -= i & -i)
+    sum += tree[i];
+  return sum;
+}
+
+
+/* finds the chunk holding the element `target` (0-based) counted by the tree,
+** and stores in `target` its index inside the chunk */
+static size_t tree_find(const TextBuffer *B, const size_t *tree, size_t *target) {
+  size_t pos = 0, step = 1;
+  while (step * 2 <= B->n_chunks)
+    step *= 2;
+  for (; step > 0; step /= 2) {
+    if (pos + step <= B->n_chunks && tree[pos + step] <= *target) {
+      pos += step;
+      *target -= tree[pos];
+    }
+  }
+  return pos;
+}
+
+
+/* byte offsets at the end of the buffer are placed at the end of the last chunk */
+static TextPosition locate_offset(const TextBuffer *B, size_t offset) {
+  if (offset >= B->len)
+    return (TextPosition) { B->n_chunks ? B->n_chunks - 1 : 0, B->n_chunks ? B->chunks[B->n_chunks - 1].len : 0 };
+  size_t chunk = tree_find(B, B->bytes, &offset);
+  return (TextPosition) { chunk, offset };
+}
+
+
+/* byte offset of the start of `line`, lines past the end start at the end */
+static size_t line_offset(const TextBuffer *B, size_t line) {
+  if (line <= 1)
+    return 0;
+  if (line - 1 > B->n_newlines)
+    return B->len;
+  size_t target = line - 2;
+  size_t chunk = tree_find(B, B->newlines, &target);
+  const TextChunk *c = &B->chunks[chunk];
+  const char *p = c->text;
+  for (;;) {
+    p = memchr(p, '\n', c->text + c->len - p);
+    if (target-- == 0)
+      break;
+    p++;
+  }
+  return tree_prefix(B->bytes, chunk) + (p - c->text) + 1;
+}
+
+
+static size_t line_count(const TextBuffer *B) {
+  return B->n_newlines + (line_offset(B, B->n_newlines + 1) < B->len);
+}
+
+
+static size_t check_offset(lua_State *L, const TextBuffer *B, int line_idx) {
+  lua_Integer line = luaL_checkinteger(L, line_idx);
+  lua_Integer col = luaL_checkinteger(L, line_idx + 1);
+  luaL_argcheck(L, line >= 1, line_idx, "invalid line");
+  luaL_argcheck(L, col >= 1, line_idx + 1, "invalid column");
+  size_t offset = line_offset(B, line) + col - 1;
+  return offset > B->len ? B->len : offset;
+}
+
+
+/* line holding a byte offset */
+static size_t offset_line(const TextBuffer *B, size_t offset) {
+  if (B->n_chunks == 0)
+    return 1;
+  TextPosition pos = locate_offset(B, offset);
+  return 1 + tree_prefix(B->newlines, pos.chunk) + count_newlines(B->chunks[pos.chunk].text, pos.offset);
+}
+
+
+static void push_position(lua_State *L, const TextBuffer *B, size_t offset) {
+  size_t line = offset_line(B, offset);
+  lua_pushinteger(L, line);
+  lua_pushinteger(L, offset - line_offset(B, line) + 1);
+}
+
+
+#define IS_CONTINUATION(c) (((unsigned char) (c) & 0xc0) == 0x80)
+
+/* moves `n` UTF-8 characters from a byte offset */
+static size_t move_chars(const TextBuffer *B, size_t offset, lua_Integer n) {
+  TextPosition pos = locate_offset(B, offset);
+  for (; n > 0 && offset < B->len; n--) {
+    do {
+      offset++;
+      if (++pos.offset >= B->chunks[pos.chunk].len && pos.chunk + 1 < B->n_chunks)
+        pos = (TextPosition) { pos.chunk + 1, 0 };
+    } while (offset < B->len && IS_CONTINUATION(B->chunks[pos.chunk].text[pos.offset]));
+  }
+  for (; n < 0 && offset > 0; n++) {
+    do {
+      offset--;
+      while (pos.offset == 0)
+        pos = (TextPosition) { pos.chunk - 1, B->chunks[pos.chunk - 1].len };
+      pos.offset--;
+    } while (offset > 0 && IS_CONTINUATION(B->chunks[pos.chunk].text[pos.offset]));
+  }
+  return offset;
+}
+
+
+static void push_range(lua_State *L, const TextBuffer *B, size_t from, size_t to) {
+  if (to <= from) {
+    lua_pushliteral(L, "");
+    return;
+  }
+  TextPosition pos = locate_offset(B, from);
+  const TextChunk *c = &B->chunks[pos.chunk];
+  if (pos.offset + (to - from) <= c->len) {
+    lua_pushlstring(L, c->text + pos.offset, to - from);
+    return;
+  }
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  size_t left = to - from;
+  for (size_t i = pos.chunk; left > 0 && i < B->n_chunks; i++) {
+    size_t start = i == pos.chunk ? pos.offset : 0;
+    size_t n = B->chunks[i].len - start < left ? B->chunks[i].len - start : left;
+    luaL_addlstring(&b, B->chunks[i].text + start, n);
+    left -= n;
+  }
+  luaL_pushresult(&b);
+}
+
+
+/* copies a chunk pointing into the file mapping, so it can be edited */
+static void own_chunk(lua_State *L, TextChunk *c, size_t size) {
+  if (c->size > 0)
+    return;
+  size = size > c->len ? size : c->len;
+  size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+  char *text = malloc(size);
+  if (!text)
+    luaL_error(L, "not enough memory");
+  memcpy(text, c->text, c->len);
+  c->text = text;
+  c->size = size;
+}
+
+
+static void init_chunk(lua_State *L, TextChunk *c, const char *text, size_t len) {
+  c->size = len > CHUNK_SIZE ? len : CHUNK_SIZE;
+  if (!(c->text = malloc(c->size)))
+    luaL_error(L, "not enough memory");
+  memcpy(c->text, text, len);
+  c->len = len;
+  c->newlines = count_newlines(text, len);
+}
+
+
+/* makes room for `n` chunks at `at`, which have to be initialized */
+static void open_chunks(lua_State *L, TextBuffer *B, size_t at, size_t n) {
+  B->chunks = grow_array(L, B->chunks, &B->chunks_size, B->n_chunks + n, sizeof(TextChunk));
+  memmove(&B->chunks[at + n], &B->chunks[at], (B->n_chunks - at) * sizeof(TextChunk));
+  for (size_t i = at; i < at + n; i++)
+    B->chunks[i] = (TextChunk) { 0 };
+  B->n_chunks += n;
+}
+
+
+static void close_chunks(TextBuffer *B, size_t at, size_t n) {
+  for (size_t i = at; i < at + n; i++)
+    if (B->chunks[i].size > 0)
+      free(B->chunks[i].text);
+  memmove(&B->chunks[at], &B->chunks[at + n], (B->n_chunks - at - n) * sizeof(TextChunk));
+  B->n_chunks -= n;
+}
+
+
+/* merges a small chunk into one of its neighbours, or drops it if empty */
+static bool merge_chunk(TextBuffer *B, size_t i) {
+  TextChunk *c = &B->chunks[i];
+  if (c->len == 0) {
+    close_chunks(B, i, 1);
+    return true;
+  }
+  if (c->len >= CHUNK_MIN)
+    return false;
+  TextChunk *prev = i > 0 ? &B->chunks[i - 1] : NULL;
+  TextChunk *next = i + 1 < B->n_chunks ? &B->chunks[i + 1] : NULL;
+  if (prev && prev->len + c->len <= prev->size) {
+    memcpy(prev->text + prev->len, c->text, c->len);
+    prev->len += c->len;
+    prev->newlines += c->newlines;
+    close_chunks(B, i, 1);
+    return true;
+  }
+  if (next && next->len + c->len <= next->size) {
+    memmove(next->text + c->len, next->text, next->len);
+    memcpy(next->text, c->text, c->len);
+    next->len += c->len;
+    next->newlines += c->newlines;
+    close_chunks(B, i, 1);
+    return true;
+  }
+  return false;
+}
+
+
+static void insert_text(lua_State *L, TextBuffer *B, size_t offset, const char *text, size_t len) {
+  if (len == 0)
+    return;
+  if (B->n_chunks == 0) {
+    open_chunks(L, B, 0, 1);
+    init_chunk(L, &B->chunks[0], "", 0);
+    rebuild_trees(L, B);
+  }
+  TextPosition pos = locate_offset(B, offset);
+  TextChunk *c = &B->chunks[pos.chunk];
+  if (c->len + len <= CHUNK_MAX) {
+    own_chunk(L, c, CHUNK_MAX);
+    if (c->len + len > c->size) {
+      char *new_text = realloc(c->text, CHUNK_MAX);
+      if (!new_text)
+        luaL_error(L, "not enough memory");
+      c->text = new_text;
+      c->size = CHUNK_MAX;
+    }
+    memmove(c->text + pos.offset + len, c->text + pos.offset, c->len - pos.offset);
+    memcpy(c->text + pos.offset, text, len);
+    c->len += len;
+    size_t newlines = count_newlines(text, len);
+    c->newlines += newlines;
+    update_trees(B, pos.chunk, len, newlines);
+    return;
+  }
+
+  /* the chunk is split at the insertion point, and the text goes in new
+  ** chunks between the two halves */
+  size_t n_new = (len + CHUNK_SIZE - 1) / CHUNK_SIZE + 1;
+  open_chunks(L, B, pos.chunk + 1, n_new);
+  c = &B->chunks[pos.chunk];
+  for (size_t i = 0; i < n_new - 1; i++) {
+    size_t start = i * CHUNK_SIZE;
+    init_chunk(L, &B->chunks[pos.chunk + 1 + i], text + start, len - start < CHUNK_SIZE ? len - start : CHUNK_SIZE);
+  }
+  if (c->size == 0) {
+    TextChunk *tail = &B->chunks[pos.chunk + n_new];
+    *tail = (TextChunk) { c->text + pos.offset, c->len - pos.offset, 0, 0 };
+    tail->newlines = count_newlines(tail->text, tail->len);
+  } else {
+    init_chunk(L, &B->chunks[pos.chunk + n_new], c->text + pos.offset, c->len - pos.offset);
+  }
+  c->len = pos.offset;
+  c->newlines = count_newlines(c->text, c->len);
+  merge_chunk(B, pos.chunk + n_new);
+  merge_chunk(B, pos.chunk);
+  rebuild_trees(L, B);
+}
+
+
+static void remove_text(lua_State *L, TextBuffer *B, size_t from, size_t to) {
+  if (to <= from)
+    return;
+  TextPosition p1 = locate_offset(B, from);
+  TextPosition p2 = locate_offset(B, to);
+  if (p1.chunk == p2.chunk) {
+    TextChunk *c = &B->chunks[p1.chunk];
+    size_t newlines = count_newlines(c->text + p1.offset, p2.offset - p1.offset);
+    if (c->size == 0 && p1.offset == 0) {
+      c->text += p2.offset;
+    } else {
+      if (p2.offset < c->len)
+        own_chunk(L, c, c->len);
+      memmove(c->text + p1.offset, c->text + p2.offset, c->len - p2.offset);
+    }
+    c->len -= p2.offset - p1.offset;
+    c->newlines -= newlines;
+    if (c->len < CHUNK_MIN && merge_chunk(B, p1.chunk))
+      rebuild_trees(L, B);
+    else
+      update_trees(B, p1.chunk, -(to - from), -newlines);
+    return;
+  }
+  TextChunk *first = &B->chunks[p1.chunk], *last = &B->chunks[p2.chunk];
+  first->len = p1.offset;
+  first->newlines = count_newlines(first->text, first->len);
+  if (last->size == 0)
+    last->text += p2.offset;
+  else
+    memmove(last->text, last->text + p2.offset, last->len - p2.offset);
+  last->len -= p2.offset;
+  last->newlines = count_newlines(last->text, last->len);
+  close_chunks(B, p1.chunk + 1, p2.chunk - p1.chunk - 1);
+  merge_chunk(B, p1.chunk + 1);
+  merge_chunk(B, p1.chunk);
+  rebuild_trees(L, B);
+}
+
+
+/* Appends text to the end of the buffer while loading it, dropping the UTF-8
+** BOM and the "\r" of "\r\n". The trees are rebuilt by finish_loading. */
+typedef struct {
+  TextBuffer *B;
+  bool start, cr, crlf;
+} TextLoader;
+
+static void load_bytes(lua_State *L, TextLoader *loader, const char *text, size_t len) {
+  TextBuffer *B = loader->B;
+  while (len > 0) {
+    if (B->n_chunks == 0 || B->chunks[B->n_chunks - 1].len >= B->chunks[B->n_chunks - 1].size) {
+      open_chunks(L, B, B->n_chunks, 1);
+      init_chunk(L, &B->chunks[B->n_chunks - 1], "", 0);
+    }
+    TextChunk *c = &B->chunks[B->n_chunks - 1];
+    size_t n = c->size - c->len < len ? c->size - c->len : len;
+    memcpy(c->text + c->len, text, n);
+    c->len += n;
+    text += n;
+    len -= n;
+  }
+}
+
+static void load_text(lua_State *L, TextLoader *loader, const char *text, size_t len) {
+  if (loader->start) {
+    loader->start = false;
+    if (len >= 3 && memcmp(text, "\xef\xbb\xbf", 3) == 0) {
+      text += 3;
+      len -= 3;
+    }
+  }
+  const char *end = text + len;
+  while (text < end) {
+    if (loader->cr) {
+      loader->cr = false;
+      if (*text == '\n')
+        loader->crlf = true;
+      else
+        load_bytes(L, loader, "\r", 1);
+    }
+    const char *cr = memchr(text, '\r', end - text);
+    load_bytes(L, loader, text, (cr ? cr : end) - text);
+    if (!cr)
+      break;
+    loader->cr = true;
+    text = cr + 1;
+  }
+}
+
+static void finish_loading(lua_State *L, TextLoader *loader) {
+  TextBuffer *B = loader->B;
+  /* like core.doc, a "\r" ending the last line is dropped too */
+  const TextChunk *last = B->n_chunks ? &B->chunks[B->n_chunks - 1] : NULL;
+  if (loader->cr || !last || last->len == 0 || last->text[last->len - 1] != '\n')
+    load_bytes(L, loader, "\n", 1);
+  loader->crlf |= loader->cr;
+  for (size_t i = 0; i < B->n_chunks; i++)
+    B->chunks[i].newlines = count_newlines(B->chunks[i].text, B->chunks[i].len);
+  rebuild_trees(L, B);
+}
+
+
+static bool map_file(const char *filename, TextMapping *map) {
+#ifdef _WIN32
+  LPWSTR wfilename = utfconv_utf8towc(filename);
+  if (!wfilename)
+    return false;
+  HANDLE file = CreateFileW(wfilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  free(wfilename);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  BY_HANDLE_FILE_INFORMATION info;
+  HANDLE mapping = NULL;
+  if (GetFileSizeEx(file, &size) && size.QuadPart >= MAP_MIN_SIZE && (ULONGLONG) size.QuadPart <= SIZE_MAX
+      && GetFileInformationByHandle(file, &info) && (info.dwFileAttributes & FILE_ATTRIBUTE_READONLY))
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping)
+    return false;
+  const char *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    return false;
+  }
+  *map = (TextMapping) { data, size.QuadPart, mapping };
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && !(st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))
+      && st.st_size >= MAP_MIN_SIZE && (uintmax_t) st.st_size <= SIZE_MAX)
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  *map = (TextMapping) { data, st.st_size };
+#endif
+  return true;
+}
+
+
+static void unmap_file(TextMapping *map) {
+  if (!map->data)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(map->data);
+  CloseHandle(map->mapping);
+#else
+  munmap((void*) map->data, map->len);
+#endif
+  map->data = NULL;
+}
+
+
+/* the chunks point into the mapping, only the newlines are counted */
+static void load_mapping(lua_State *L, TextBuffer *B, size_t start) {
+  size_t n = (B->map.len - start + CHUNK_MAX - 1) / CHUNK_MAX;
+  open_chunks(L, B, 0, n);
+  for (size_t i = 0; i < n; i++) {
+    size_t offset = start + i * CHUNK_MAX;
+    size_t len = B->map.len - offset < CHUNK_MAX ? B->map.len - offset : CHUNK_MAX;
+    B->chunks[i] = (TextChunk) { (char*) B->map.data + offset, len, 0, 0 };
+  }
+  TextLoader loader = { B, false, false, false };
+  finish_loading(L, &loader);
+}
+
+
+static TextBuffer *new_buffer(lua_State *L) {
+  TextBuffer *B = lua_newuserdata(L, sizeof(TextBuffer));
+  memset(B, 0, sizeof(TextBuffer));
+  luaL_setmetatable(L, API_TYPE_TEXT_BUFFER);
+  return B;
+}
+
+
+static int f_new(lua_State *L) {
+  size_t len;
+  const char *text = luaL_optlstring(L, 1, "", &len);
+  TextLoader loader = { new_buffer(L), true, false, false };
+  load_text(L, &loader, text, len);
+  finish_loading(L, &loader);
+  lua_pushboolean(L, loader.crlf);
+  return 2;
+}
+
+
+static int f_load(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  TextBuffer *B = new_buffer(L);
+  if (map_file(filename, &B->map)) {
+    /* "\r\n" have to be replaced, those files are read instead */
+    size_t start = B->map.len >= 3 && memcmp(B->map.data, "\xef\xbb\xbf", 3) == 0 ? 3 : 0;
+    if (!memchr(B->map.data + start, '\r', B->map.len - start)) {
+      load_mapping(L, B, start);
+      lua_pushboolean(L, 0);
+      return 2;
+    }
+    unmap_file(&B->map);
+  }
+#ifdef _WIN32
+  LPWSTR wfilename = utfconv_utf8towc(filename);
+  if (!wfilename)
+    return luaL_error(L, UTFCONV_ERROR_INVALID_CONVERSION);
+  FILE *fp = _wfopen(wfilename, L"rb");
+  free(wfilename);
+#else
+  FILE *fp = fopen(filename, "rb");
+#endif
+  if (!fp) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to open file '%s': %s", filename, strerror(errno));
+    return 2;
+  }
+  TextLoader loader = { B, true, false, false };
+  char block[65536];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), fp)) > 0)
+    load_text(L, &loader, block, n);
+  bool failed = ferror(fp);
+  fclose(fp);
+  if (failed) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to read file '%s'", filename);
+    return 2;
+  }
+  finish_loading(L, &loader);
+  lua_pushboolean(L, loader.crlf);
+  return 2;
+}
+
+
+/* Saving writes a temporary file next to the target, which is synced and
+** renamed over it, so a crash or a full disk never leaves a truncated file.
+** Files that can't be replaced this way (hard links, special files, read-only
+** directories) are written in place. The text goes through an output block,
+** converted with iconv on the way when a charset is given. */
+#define WRITE_BLOCK 65536
+
+typedef struct {
+  lua_State *L;
+  FILE *fp;
+  char *path;           /* file being saved, symlinks resolved */
+  char *temp;           /* temporary file, NULL when writing in place */
+  SDL_iconv_t cd;       /* (SDL_iconv_t) -1 without conversion */
+  bool crlf, failed;
+  int progress;         /* stack index of the callback, 0 if none */
+  double reported;
+  char pending[4];      /* UTF-8 sequence cut at the end of the last text */
+  size_t n_pending;
+  char error[512];
+  size_t out_len;
+  char out[WRITE_BLOCK];
+} TextWriter;
+
+
+static bool writer_fail(TextWriter *W, const char *fmt, ...) {
+  if (!W->failed) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(W->error, sizeof(W->error), fmt, args);
+    va_end(args);
+    W->failed = true;
+  }
+  return false;
+}
+
+
+/* reads the options and decides where to write, nothing is opened yet */
+static bool writer_init(TextWriter *W, lua_State *L, const char *filename, int options) {
+  memset(W, 0, offsetof(TextWriter, out));
+  W->L = L;
+  W->cd = (SDL_iconv_t) -1;
+  const char *charset = NULL;
+  if (lua_istable(L, options)) {
+    lua_getfield(L, options, "crlf");
+    W->crlf = lua_toboolean(L, -1);
+    lua_getfield(L, options, "charset");
+    charset = lua_tostring(L, -1);
+    lua_getfield(L, options, "progress");
+    if (lua_isfunction(L, -1))
+      W->progress = lua_gettop(L);
+    else
+      lua_pop(L, 1);
+  }
+  if (charset && strcmp(charset, "UTF-8") != 0) {
+    W->cd = SDL_iconv_open(charset, "UTF-8");
+    if (W->cd == (SDL_iconv_t) -1)
+      return writer_fail(W, "unsupported charset '%s'", charset);
+  }
+#ifdef _WIN32
+  /* a mapped file can't be replaced, the buffer is copied first */
+  if (!(W->path = strdup(filename)) || !(W->temp = malloc(strlen(filename) + 32)))
+    return writer_fail(W, "not enough memory to save '%s'", filename);
+  sprintf(W->temp, "%s.%lu-%lu.tmp", filename, GetCurrentProcessId(), GetTickCount());
+#else
+  struct stat st;
+  bool exists = stat(filename, &st) == 0;
+  W->path = exists ? realpath(filename, NULL) : strdup(filename);
+  if (!W->path)
+    return writer_fail(W, "unable to save '%s': %s", filename, strerror(errno));
+  /* replacing a hard link would separate it from its other names */
+  if (exists && (!S_ISREG(st.st_mode) || st.st_nlink > 1))
+    return true;
+  const char *base = strrchr(W->path, '/');
+  base = base ? base + 1 : W->path;
+  if (!(W->temp = malloc(strlen(W->path) + 32)))
+    return writer_fail(W, "not enough memory to save '%s'", filename);
+  for (int i = 0; !W->fp; i++) {
+    sprintf(W->temp, "%.*s.%s.%ld-%d.tmp", (int) (base - W->path), W->path, base, (long) getpid(), i);
+    int fd = open(W->temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 && errno == EEXIST && i < 100)
+      continue;
+    if (fd < 0) {
+      /* no permission to create files in the directory */
+      free(W->temp);
+      W->temp = NULL;
+      break;
+    }
+    if (exists) {
+      fchmod(fd, st.st_mode & 07777);
+      if (fchown(fd, st.st_uid, st.st_gid) != 0) {}
+    }
+    if (!(W->fp = fdopen(fd, "wb"))) {
+      writer_fail(W, "unable to save '%s': %s", filename, strerror(errno));
+      close(fd);
+      unlink(W->temp);
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+
+static bool writer_open(TextWriter *W) {
+  if (W->fp)
+    return true;
+#ifdef _WIN32
+  const char *name = W->temp ? W->temp : W->path;
+  LPWSTR wname = utfconv_utf8towc(name);
+  if (!wname)
+    return writer_fail(W, "unable to save '%s': %s", name, UTFCONV_ERROR_INVALID_CONVERSION);
+  W->fp = _wfopen(wname, L"wb");
+  free(wname);
+#else
+  W->fp = fopen(W->temp ? W->temp : W->path, "wb");
+#endif
+  if (!W->fp)
+    return writer_fail(W, "unable to open file '%s': %s", W->path, strerror(errno));
+  return true;
+}
+
+
+static bool writer_flush(TextWriter *W) {
+  if (W->out_len > 0 && fwrite(W->out, 1, W->out_len, W->fp) != W->out_len)
+    return writer_fail(W, "unable to write file '%s': %s", W->path, strerror(errno));
+  W->out_len = 0;
+  return true;
+}
+
+
+static bool write_bytes(TextWriter *W, const char *text, size_t len) {
+  if (W->out_len + len > WRITE_BLOCK) {
+    if (!writer_flush(W))
+      return false;
+    if (len > WRITE_BLOCK)
+      return fwrite(text, 1, len, W->fp) == len || writer_fail(W, "unable to write file '%s': %s", W->path, strerror(errno));
+  }
+  memcpy(W->out + W->out_len, text, len);
+  W->out_len += len;
+  return true;
+}
+
+
+static bool convert_bytes(TextWriter *W, const char *text, size_t len) {
+  while (len > 0) {
+    char *out = W->out + W->out_len;
+    size_t out_left = WRITE_BLOCK - W->out_len;
+    size_t rc = SDL_iconv(W->cd, &text, &len, &out, &out_left);
+    W->out_len = out - W->out;
+    if (rc == SDL_ICONV_E2BIG) {
+      if (!writer_flush(W))
+        return false;
+    } else if (rc == SDL_ICONV_EINVAL && len < sizeof(W->pending)) {
+      memcpy(W->pending, text, len);
+      W->n_pending = len;
+      return true;
+    } else if (rc == SDL_ICONV_EINVAL || rc == SDL_ICONV_EILSEQ || rc == SDL_ICONV_ERROR) {
+      return writer_fail(W, "the text of '%s' can't be converted to its encoding", W->path);
+    }
+  }
+  return true;
+}
+
+
+static bool write_converted(TextWriter *W, const char *text, size_t len) {
+  if (W->cd == (SDL_iconv_t) -1)
+    return write_bytes(W, text, len);
+  if (W->n_pending > 0) {
+    /* completes the character cut between two chunks */
+    char seq[sizeof(W->pending) * 2];
+    size_t n = W->n_pending;
+    memcpy(seq, W->pending, n);
+    while (len > 0 && n < sizeof(seq) && IS_CONTINUATION(*text)) {
+      seq[n++] = *text++;
+      len--;
+    }
+    W->n_pending = 0;
+    if (!convert_bytes(W, seq, n))
+      return false;
+  }
+  return convert_bytes(W, text, len);
+}
+
+
+static bool writer_write(TextWriter *W, const char *text, size_t len) {
+  const char *end = text + len;
+  while (W->crlf && text < end) {
+    const char *nl = memchr(text, '\n', end - text);
+    if (!nl)
+      break;
+    if (!write_converted(W, text, nl - text) || !write_converted(W, "\r\n", 2))
+      return false;
+    text = nl + 1;
+  }
+  return write_converted(W, text, end - text);
+}
+
+
+/* calls the progress callback every percent */
+static bool writer_progress(TextWriter *W, double done) {
+  if (!W->progress || done < W->reported + 0.01)
+    return true;
+  W->reported = done;
+  lua_pushvalue(W->L, W->progress);
+  lua_pushnumber(W->L, done);
+  if (lua_pcall(W->L, 1, 0, 0) != LUA_OK) {
+    writer_fail(W, "%s", lua_tostring(W->L, -1));
+    lua_pop(W->L, 1);
+    return false;
+  }
+  return true;
+}
+
+
+/* syncs and moves the temporary file in place, or removes it on failure */
+static bool writer_close(TextWriter *W) {
+  bool ok = !W->failed;
+  if (W->fp) {
+    if (ok && W->cd != (SDL_iconv_t) -1) {
+      if (W->n_pending > 0) {
+        ok = writer_fail(W, "the text of '%s' ends with an incomplete character", W->path);
+      } else {
+        /* stateful encodings go back to their initial state */
+        char *out = W->out + W->out_len;
+        size_t out_left = WRITE_BLOCK - W->out_len;
+        SDL_iconv(W->cd, NULL, NULL, &out, &out_left);
+        W->out_len = out - W->out;
+      }
+    }
+    ok = ok && writer_flush(W);
+#ifdef _WIN32
+    if (ok && (fflush(W->fp) != 0 || _commit(_fileno(W->fp)) != 0))
+#else
+    if (ok && (fflush(W->fp) != 0 || fsync(fileno(W->fp)) != 0))
+#endif
+      ok = writer_fail(W, "unable to write file '%s': %s", W->path, strerror(errno));
+    if (fclose(W->fp) != 0 && ok)
+      ok = writer_fail(W, "unable to write file '%s': %s", W->path, strerror(errno));
+  }
+  if (W->temp && W->fp) {
+#ifdef _WIN32
+    LPWSTR wtemp = utfconv_utf8towc(W->temp), wpath = utfconv_utf8towc(W->path);
+    if (ok && !(wtemp && wpath && MoveFileExW(wtemp, wpath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)))
+      ok = writer_fail(W, "unable to replace file '%s'", W->path);
+    if (!ok && wtemp)
+      _wremove(wtemp);
+    free(wtemp);
+    free(wpath);
+#else
+    if (ok && rename(W->temp, W->path) != 0)
+      ok = writer_fail(W, "unable to replace file '%s': %s", W->path, strerror(errno));
+    if (!ok) {
+      unlink(W->temp);
+    } else {
+      /* makes the rename itself durable */
+      const char *base = strrchr(W->path, '/');
+      char *dir = base ? strndup(W->path, base - W->path + 1) : strdup(".");
+      int fd = dir ? open(dir, O_RDONLY) : -1;
+      if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+      }
+      free(dir);
+    }
+#endif
+  }
+  if (W->cd != (SDL_iconv_t) -1)
+    SDL_iconv_close(W->cd);
+  free(W->path);
+  free(W->temp);
+  return ok;
+}
+
+
+static int push_save_result(lua_State *L, TextWriter *W) {
+  if (writer_close(W)) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  lua_pushnil(L);
+  lua_pushstring(L, W->error);
+  return 2;
+}
+
+
+static int f_save(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  const char *filename = luaL_checkstring(L, 2);
+  TextWriter W;
+  bool ok = writer_init(&W, L, filename, 3);
+  /* the mapped file is kept alive by a rename, not when it is rewritten */
+  if (ok && B->map.data && !(W.temp && W.fp)) {
+    for (size_t i = 0; i < B->n_chunks; i++)
+      own_chunk(L, &B->chunks[i], 0);
+    unmap_file(&B->map);
+  }
+  if (ok && writer_open(&W)) {
+    const char *bom = NULL;
+    size_t bom_len = 0;
+    if (lua_istable(L, 3)) {
+      lua_getfield(L, 3, "bom");
+      bom = lua_tolstring(L, -1, &bom_len);
+      lua_pop(L, 1);
+    }
+    bool written = !bom || write_bytes(&W, bom, bom_len);
+    for (size_t i = 0; written && i < B->n_chunks; i++)
+      written = writer_write(&W, B->chunks[i].text, B->chunks[i].len)
+        && writer_progress(&W, (double) (i + 1) / B->n_chunks);
+  }
+  return push_save_result(L, &W);
+}
+
+
+static int f_save_lines(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const char *filename = luaL_checkstring(L, 2);
+  lua_Integer n_lines = luaL_len(L, 1);
+  TextWriter W;
+  if (writer_init(&W, L, filename, 3) && writer_open(&W)) {
+    const char *bom = NULL;
+    size_t bom_len = 0;
+    if (lua_istable(L, 3)) {
+      lua_getfield(L, 3, "bom");
+      bom = lua_tolstring(L, -1, &bom_len);
+      lua_pop(L, 1);
+    }
+    bool written = !bom || write_bytes(&W, bom, bom_len);
+    for (lua_Integer i = 1; written && i <= n_lines; i++) {
+      size_t len;
+      lua_geti(L, 1, i);
+      const char *line = lua_tolstring(L, -1, &len);
+      written = line ? writer_write(&W, line, len) : writer_fail(&W, "line %d is not a string", (int) i);
+      lua_pop(L, 1);
+      written = written && writer_progress(&W, (double) i / n_lines);
+    }
+  }
+  return push_save_result(L, &W);
+}
+
+
+static int f_get_line(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  lua_Integer line = luaL_checkinteger(L, 2);
+  if (line < 1 || (size_t) line > line_count(B))
+    return 0;
+  push_range(L, B, line_offset(B, line), line_offset(B, line + 1));
+  return 1;
+}
+
+
+static int f_get_line_length(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  lua_Integer line = luaL_checkinteger(L, 2);
+  if (line < 1 || (size_t) line > line_count(B))
+    return 0;
+  lua_pushinteger(L, line_offset(B, line + 1) - line_offset(B, line));
+  return 1;
+}
+
+
+static int f_get_line_count(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  lua_pushinteger(L, line_count(B));
+  return 1;
+}
+
+
+static int f_get_length(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  lua_pushinteger(L, B->len);
+  return 1;
+}
+
+
+static int f_get_text(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  if (lua_isnoneornil(L, 2)) {
+    push_range(L, B, 0, B->len);
+    return 1;
+  }
+  size_t from = check_offset(L, B, 2), to = check_offset(L, B, 4);
+  push_range(L, B, from, to);
+  return 1;
+}
+
+
+static int f_insert(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  size_t offset = check_offset(L, B, 2);
+  size_t len;
+  const char *text = luaL_checklstring(L, 4, &len);
+  insert_text(L, B, offset, text, len);
+  /* lines added, and length of the text after its last newline */
+  const char *last = text + len;
+  while (last > text && last[-1] != '\n')
+    last--;
+  lua_pushinteger(L, count_newlines(text, len));
+  lua_pushinteger(L, text + len - last);
+  return 2;
+}
+
+
+static int f_remove(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  size_t from = check_offset(L, B, 2), to = check_offset(L, B, 4);
+  remove_text(L, B, from, to);
+  return 0;
+}
+
+
+static int f_get_offset(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  lua_pushinteger(L, check_offset(L, B, 2) + 1);
+  return 1;
+}
+
+
+static int f_get_position(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  lua_Integer offset = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, offset >= 1, 2, "invalid offset");
+  push_position(L, B, (size_t) offset - 1 > B->len ? B->len : (size_t) offset - 1);
+  return 2;
+}
+
+
+static int f_utf8_offset(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  size_t offset = check_offset(L, B, 2);
+  push_position(L, B, move_chars(B, offset, luaL_checkinteger(L, 4)));
+  return 2;
+}
+
+
+static int f_gc(lua_State *L) {
+  TextBuffer *B = luaL_checkudata(L, 1, API_TYPE_TEXT_BUFFER);
+  for (size_t i = 0; i < B->n_chunks; i++)
+    if (B->chunks[i].size > 0)
+      free(B->chunks[i].text);
+  free(B->chunks);
+  free(B->bytes);
+  free(B->newlines);
+  unmap_file(&B->map);
+  return 0;
+}
+
+
+static const luaL_Reg lib[] = {
+  { "new",             f_new             },
+  { "load",            f_load            },
+  { "save_lines",      f_save_lines      },
+  { "save",            f_save            },
+  { "get_line",        f_get_line        },
+  { "get_line_length", f_get_line_length },
+  { "get_line_count",  f_get_line_count  },
+  { "get_length",      f_get_length      },
+  { "get_text",        f_get_text        },
+  { "insert",          f_insert          },
+  { "remove",          f_remove          },
+  { "get_offset",      f_get_offset      },
+  { "get_position",    f_get_position    },
+  { "utf8_offset",     f_utf8_offset     },
+  { "__gc",            f_gc              },
+  { NULL,              NULL              }
+};
+
+
+int luaopen_textbuffer(lua_State *L) {
+  luaL_newmetatable(L, API_TYPE_TEXT_BUFFER);
+  luaL_setfuncs(L, lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  return 1;
+}
@@ -0,0 +1,1102 @@
+#include "api.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <SDL.h>
+#include <pcre2.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Native implementation of core.tokenizer.tokenize.
+** A syntax is compiled once, together with every subsyntax it can enter, into
+** a NativeTokenizer: Lua patterns go through the same matcher as
+** string.ufind, regexes are compiled once with pcre2, symbols are kept in a
+** hash table and token types are interned. Positions are tracked in bytes
+** instead of characters and tokens are merged in a C buffer, so Lua strings
+** are only created for the final tokens. The Lua implementation in
+** data/core/tokenizer.lua is the reference, both return the same tokens and
+** states. */
+
+#define TOKENIZER_MAX_CAPTURES 32
+#define TOKENIZER_MAX_PATTERNS 255 /* pattern indexes are stored in bytes */
+
+/* token types interned by every tokenizer */
+#define TOKEN_NORMAL     0
+#define TOKEN_INCOMPLETE 1
+
+int utf8extra_find(lua_State *L, const char *s, size_t len, size_t init,
+                   const char *p, size_t plen, int anchor, int plain,
+                   size_t *start, size_t *end, size_t *captures, int max_captures);
+int utf8extra_isspace_span(const char *s, const char *e);
+int utf8extra_nospecials(const char *p, size_t plen);
+
+typedef struct {
+  char *code;
+  size_t len;
+  pcre2_code *re;
+  bool whole_line;
+  bool plain;
+} TokenizerMatcher;
+
+typedef struct {
+  TokenizerMatcher matchers[2]; /* start and end of a pair, single patterns only use the first */
+  bool is_regex, is_pair;
+  bool type_is_table;
+  char escape[4];
+  int escape_len;
+  int *types;
+  int n_types;
+  int syntax; /* subsyntax entered by the pattern, -1 if none */
+} TokenizerPattern;
+
+typedef struct {
+  char *text;
+  size_t len;
+  int type;
+} TokenizerSymbol;
+
+typedef struct {
+  TokenizerPattern *patterns;
+  int n_patterns;
+  TokenizerSymbol *symbols;
+  size_t symbols_mask;
+} TokenizerSyntax;
+
+typedef struct {
+  int type;
+  size_t start, end;
+  bool space;
+} TokenizerToken;
+
+typedef struct {
+  int syntax, pattern, n_types, n_results;
+} TokenizerReport;
+
+typedef struct {
+  size_t start, end;
+  int n_captures;
+  size_t captures[TOKENIZER_MAX_CAPTURES];
+} TokenizerMatch;
+
+typedef struct {
+  int syntax;                   /* syntax we're currently in */
+  const TokenizerPattern *subsyntax; /* pattern that entered it, NULL at the top level */
+  int pattern;                  /* pair we're in, 0 if none */
+  size_t level;                 /* how many subsyntaxes deep we are, starting at 1 */
+} TokenizerPosition;
+
+typedef struct {
+  char *name;
+  size_t len;
+} TokenizerType;
+
+/* Buffers used while tokenizing, reused from one call to the next. Every
+** thread tokenizes with its own context. */
+typedef struct {
+  pcre2_match_data *match_data;
+  TokenizerToken *tokens;
+  size_t n_tokens, tokens_size, first;
+  unsigned char *state;
+  size_t state_len, state_size;
+  TokenizerReport *reports;
+  size_t n_reports, reports_size;
+} TokenizerContext;
+
+typedef struct {
+  TokenizerSyntax *syntaxes;
+  size_t n_syntaxes, syntaxes_size;
+  TokenizerType *types;
+  size_t n_types, types_size;
+  TokenizerContext ctx;
+} NativeTokenizer;
+
+
+static void *grow_array(lua_State *L, void *ptr, size_t *capacity, size_t needed, size_t size) {
+  if (needed <= *capacity)
+    return ptr;
+  size_t n = *capacity ? *capacity : 16;
+  while (n < needed)
+    n *= 2;
+  void *new_ptr = realloc(ptr, n * size);
+  if (!new_ptr)
+    luaL_error(L, "not enough memory");
+  *capacity = n;
+  return new_ptr;
+}
+
+
+static char *copy_string(lua_State *L, const char *s, size_t len) {
+  char *copy = malloc(len + 1);
+  if (!copy)
+    luaL_error(L, "not enough memory");
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+
+static size_t hash_symbol(const char *s, size_t len) {
+  size_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char) s[i]) * 16777619u;
+  return h;
+}
+
+
+/* Returns the id of the token type with the given name, the `env` table of
+** the tokenizer maps names to ids. */
+static int intern_type(lua_State *L, NativeTokenizer *T, int env, const char *name, size_t len) {
+  lua_getfield(L, env, "types");
+  lua_pushlstring(L, name, len);
+  lua_rawget(L, -2);
+  if (lua_isinteger(L, -1)) {
+    int id = lua_tointeger(L, -1);
+    lua_pop(L, 2);
+    return id;
+  }
+  lua_pop(L, 1);
+  T->types = grow_array(L, T->types, &T->types_size, T->n_types + 1, sizeof(TokenizerType));
+  T->types[T->n_types].name = copy_string(L, name, len);
+  T->types[T->n_types].len = len;
+  int id = T->n_types++;
+  lua_pushlstring(L, name, len);
+  lua_pushinteger(L, id);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  return id;
+}
+
+
+static int check_type(lua_State *L, NativeTokenizer *T, int env, int idx, int pattern) {
+  size_t len;
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL: return TOKEN_NORMAL;
+    case LUA_TSTRING: {
+      const char *name = lua_tolstring(L, idx, &len);
+      return intern_type(L, T, env, name, len);
+    }
+    default: return luaL_error(L, "pattern #%d has an invalid token type", pattern);
+  }
+}
+
+
+static int compile_syntax(lua_State *L, NativeTokenizer *T, int env, int get_syntax, int syntax);
+
+static void compile_matcher(lua_State *L, TokenizerMatcher *matcher, bool is_regex, int code_idx, int whole_line, int n, int pattern) {
+  size_t len;
+  if (lua_type(L, code_idx) != LUA_TSTRING)
+    luaL_error(L, "pattern #%d is not a string", pattern);
+  const char *code = lua_tolstring(L, code_idx, &len);
+  /* the Lua tokenizer strips the '^' of whole line patterns once and
+  ** remembers it in `whole_line` */
+  int wl = -1;
+  if (lua_istable(L, whole_line)) {
+    lua_rawgeti(L, whole_line, n + 1);
+    if (!lua_isnil(L, -1))
+      wl = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  if (wl < 0) {
+    wl = len > 0 && code[0] == '^';
+    if (wl) {
+      code++;
+      len--;
+    }
+  }
+  matcher->whole_line = wl;
+  matcher->code = copy_string(L, code, len);
+  matcher->len = len;
+  if (is_regex) {
+    int errornumber;
+    PCRE2_SIZE erroroffset;
+    matcher->re = pcre2_compile((PCRE2_SPTR) matcher->code, len, PCRE2_UTF, &errornumber, &erroroffset, NULL);
+    if (!matcher->re) {
+      PCRE2_UCHAR errmsg[256];
+      pcre2_get_error_message(errornumber, errmsg, sizeof(errmsg));
+      luaL_error(L, "regex pattern error at offset %d: %s", (int) erroroffset, errmsg);
+    }
+    pcre2_jit_compile(matcher->re, PCRE2_JIT_COMPLETE);
+  } else {
+    matcher->plain = utf8extra_nospecials(matcher->code, len);
+  }
+}
+
+
+static void compile_pattern(lua_State *L, NativeTokenizer *T, int env, int get_syntax, int syntax_id, int n, int idx) {
+  TokenizerPattern *p = &T->syntaxes[syntax_id].patterns[n];
+  p->syntax = -1;
+  if (!lua_istable(L, idx))
+    luaL_error(L, "pattern #%d is not a table", n + 1);
+
+  lua_getfield(L, idx, "pattern");
+  p->is_regex = !lua_toboolean(L, -1);
+  if (p->is_regex) {
+    lua_pop(L, 1);
+    lua_getfield(L, idx, "regex");
+  }
+  int target = lua_gettop(L);
+  p->is_pair = lua_istable(L, target);
+  lua_getfield(L, idx, "whole_line");
+  int whole_line = lua_gettop(L);
+  for (int i = 0; i < (p->is_pair ? 2 : 1); i++) {
+    if (p->is_pair)
+      lua_rawgeti(L, target, i + 1);
+    else
+      lua_pushvalue(L, target);
+    compile_matcher(L, &p->matchers[i], p->is_regex, lua_gettop(L), whole_line, i, n + 1);
+    lua_pop(L, 1);
+  }
+  if (p->is_pair) {
+    /* only the first character of the escape is compared */
+    lua_rawgeti(L, target, 3);
+    if (lua_type(L, -1) == LUA_TSTRING) {
+      size_t len;
+      const unsigned char *escape = (const unsigned char*) lua_tolstring(L, -1, &len);
+      if (len > 0) {
+        int char_len = escape[0] < 0xC0 ? 1 : escape[0] < 0xE0 ? 2 : escape[0] < 0xF0 ? 3 : 4;
+        p->escape_len = char_len < (int) len ? char_len : (int) len;
+        memcpy(p->escape, escape, p->escape_len);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+
+  lua_getfield(L, idx, "type");
+  if (lua_istable(L, -1)) {
+    int types = lua_gettop(L);
+    p->type_is_table = true;
+    p->n_types = lua_rawlen(L, types);
+    p->types = calloc(p->n_types > 0 ? p->n_types : 1, sizeof(int));
+    if (!p->types)
+      luaL_error(L, "not enough memory");
+    for (int i = 0; i < p->n_types; i++) {
+      lua_rawgeti(L, types, i + 1);
+      p->types[i] = check_type(L, T, env, -1, n + 1);
+      lua_pop(L, 1);
+    }
+  } else {
+    p->n_types = 1;
+    p->types = calloc(1, sizeof(int));
+    if (!p->types)
+      luaL_error(L, "not enough memory");
+    p->types[0] = check_type(L, T, env, -1, n + 1);
+  }
+  lua_pop(L, 1);
+
+  /* compiling the subsyntax may move the syntaxes, `p` can't be used after */
+  lua_getfield(L, idx, "syntax");
+  if (!lua_isnil(L, -1)) {
+    if (!lua_istable(L, -1)) {
+      lua_pushvalue(L, get_syntax);
+      lua_insert(L, -2);
+      lua_call(L, 1, 1);
+      if (!lua_istable(L, -1))
+        luaL_error(L, "pattern #%d has an invalid subsyntax", n + 1);
+    }
+    int subsyntax = compile_syntax(L, T, env, get_syntax, lua_gettop(L));
+    T->syntaxes[syntax_id].patterns[n].syntax = subsyntax;
+  }
+  lua_pop(L, 1);
+}
+
+
+static void compile_symbols(lua_State *L, NativeTokenizer *T, int env, TokenizerSyntax *syn, int symbols) {
+  size_t count = 0, size = 8;
+  lua_pushnil(L);
+  while (lua_next(L, symbols)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TSTRING)
+      count++;
+    lua_pop(L, 1);
+  }
+  if (count == 0)
+    return;
+  while (size < count * 2)
+    size *= 2;
+  syn->symbols = calloc(size, sizeof(TokenizerSymbol));
+  if (!syn->symbols)
+    luaL_error(L, "not enough memory");
+  syn->symbols_mask = size - 1;
+  lua_pushnil(L);
+  while (lua_next(L, symbols)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TSTRING) {
+      size_t len, type_len;
+      const char *text = lua_tolstring(L, -2, &len);
+      const char *type = lua_tolstring(L, -1, &type_len);
+      size_t h = hash_symbol(text, len) & syn->symbols_mask;
+      while (syn->symbols[h].text)
+        h = (h + 1) & syn->symbols_mask;
+      syn->symbols[h].type = intern_type(L, T, env, type, type_len);
+      syn->symbols[h].len = len;
+      syn->symbols[h].text = copy_string(L, text, len);
+    }
+    lua_pop(L, 1);
+  }
+}
+
+
+/* Compiles the syntax table at `syntax` unless it was already compiled,
+** returns its index in T->syntaxes. */
+static int compile_syntax(lua_State *L, NativeTokenizer *T, int env, int get_syntax, int syntax) {
+  luaL_checkstack(L, 16, "too many nested subsyntaxes");
+  lua_getfield(L, env, "ids");
+  lua_pushvalue(L, syntax);
+  lua_rawget(L, -2);
+  if (lua_isinteger(L, -1)) {
+    int id = lua_tointeger(L, -1);
+    lua_pop(L, 2);
+    return id;
+  }
+  lua_pop(L, 1);
+  int id = T->n_syntaxes;
+  T->syntaxes = grow_array(L, T->syntaxes, &T->syntaxes_size, id + 1, sizeof(TokenizerSyntax));
+  memset(&T->syntaxes[id], 0, sizeof(TokenizerSyntax));
+  T->n_syntaxes++;
+  lua_pushvalue(L, syntax);
+  lua_pushinteger(L, id);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  lua_getfield(L, env, "syntaxes");
+  lua_pushvalue(L, syntax);
+  lua_rawseti(L, -2, id + 1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, syntax, "patterns");
+  int patterns = lua_gettop(L);
+  if (!lua_istable(L, patterns))
+    luaL_error(L, "syntax has no patterns");
+  int n_patterns = lua_rawlen(L, patterns);
+  if (n_patterns > TOKENIZER_MAX_PATTERNS)
+    luaL_error(L, "syntax has more than %d patterns", TOKENIZER_MAX_PATTERNS);
+  if (n_patterns > 0) {
+    T->syntaxes[id].patterns = calloc(n_patterns, sizeof(TokenizerPattern));
+    if (!T->syntaxes[id].patterns)
+      luaL_error(L, "not enough memory");
+    T->syntaxes[id].n_patterns = n_patterns;
+  }
+  for (int n = 0; n < n_patterns; n++) {
+    lua_rawgeti(L, patterns, n + 1);
+    compile_pattern(L, T, env, get_syntax, id, n, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, syntax, "symbols");
+  if (lua_istable(L, -1))
+    compile_symbols(L, T, env, &T->syntaxes[id], lua_gettop(L));
+  lua_pop(L, 1);
+  return id;
+}
+
+
+static bool match_pattern(lua_State *L, const TokenizerMatcher *matcher, const char *text, size_t len, size_t offset, bool anchored, TokenizerMatch *m) {
+  int n = utf8extra_find(L, text, len, offset, matcher->code, matcher->len,
+    anchored, !anchored && matcher->plain,
+    &m->start, &m->end, m->captures, TOKENIZER_MAX_CAPTURES);
+  m->n_captures = n;
+  return n >= 0;
+}
+
+
+/* Like regex.find the subject starts at `offset`, unmatched groups are
+** reported at the end of the match. */
+static bool match_regex(lua_State *L, TokenizerContext *ctx, const TokenizerMatcher *matcher, const char *text, size_t len, size_t offset, bool anchored, TokenizerMatch *m) {
+  int rc = pcre2_match(matcher->re, (PCRE2_SPTR) (text + offset), len - offset, 0,
+    anchored ? PCRE2_ANCHORED : 0, ctx->match_data, NULL);
+  if (rc < 0) {
+    if (rc != PCRE2_ERROR_NOMATCH) {
+      PCRE2_UCHAR buffer[120];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      luaL_error(L, "regex matching error %d: %s", rc, buffer);
+    }
+    return false;
+  }
+  /* 0 means that the groups didn't all fit in the match data */
+  if (rc == 0)
+    rc = TOKENIZER_MAX_CAPTURES + 1;
+  PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(ctx->match_data);
+  if (ovector[0] > ovector[1])
+    luaL_error(L, "regex matching error: \\K was used in an assertion to "
+      " set the match start after its end");
+  m->start = offset + ovector[0];
+  m->end = offset + ovector[1];
+  m->n_captures = rc > 1 ? rc - 1 : 0;
+  if (m->n_captures > TOKENIZER_MAX_CAPTURES)
+    m->n_captures = TOKENIZER_MAX_CAPTURES;
+  for (int i = 0; i < m->n_captures; i++) {
+    PCRE2_SIZE capture = ovector[(i + 1) * 2];
+    m->captures[i] = capture == PCRE2_UNSET ? m->end : offset + capture;
+  }
+  return true;
+}
+
+
+static bool is_escaped(const char *text, size_t pos, const TokenizerPattern *p) {
+  int count = 0;
+  while (pos >= (size_t) p->escape_len && memcmp(text + pos - p->escape_len, p->escape, p->escape_len) == 0) {
+    pos -= p->escape_len;
+    count++;
+  }
+  return count % 2 == 1;
+}
+
+
+static bool find_text(lua_State *L, TokenizerContext *ctx, const char *text, size_t len, const TokenizerPattern *p, size_t offset, bool at_start, bool close, TokenizerMatch *m) {
+  const TokenizerMatcher *matcher = &p->matchers[close && p->is_pair ? 1 : 0];
+  bool anchored = at_start || matcher->whole_line;
+  for (;;) {
+    /* if the pattern contained '^', allow matching only the whole line */
+    if (matcher->whole_line && offset > 0)
+      return false;
+    bool found = p->is_regex
+      ? match_regex(L, ctx, matcher, text, len, offset, anchored, m)
+      : match_pattern(L, matcher, text, len, offset, anchored, m);
+    if (!found)
+      return false;
+    if (p->escape_len == 0 || !is_escaped(text, m->start, p))
+      return true;
+    /* the match is escaped, the end of a pair is searched again after it */
+    if (at_start || !close)
+      return false;
+    offset = m->end;
+  }
+}
+
+
+static int lookup_symbol(const TokenizerSyntax *syn, const char *text, size_t len, int type) {
+  if (!syn->symbols)
+    return type;
+  size_t h = hash_symbol(text, len) & syn->symbols_mask;
+  for (; syn->symbols[h].text; h = (h + 1) & syn->symbols_mask) {
+    if (syn->symbols[h].len == len && memcmp(syn->symbols[h].text, text, len) == 0)
+      return syn->symbols[h].type;
+  }
+  return type;
+}
+
+
+/* Tokens of the same type, and tokens following whitespace, are merged.
+** Tokens before ctx->first belong to previous lines and are left alone. */
+static void push_token(lua_State *L, TokenizerContext *ctx, const char *text, int type, size_t start, size_t end) {
+  if (end <= start)
+    return;
+  bool space = utf8extra_isspace_span(text + start, text + end);
+  if (ctx->n_tokens > ctx->first) {
+    TokenizerToken *prev = &ctx->tokens[ctx->n_tokens - 1];
+    if (prev->type == type || (prev->space && type != TOKEN_INCOMPLETE)) {
+      prev->type = type;
+      prev->end = end;
+      prev->space = prev->space && space;
+      return;
+    }
+  }
+  ctx->tokens = grow_array(L, ctx->tokens, &ctx->tokens_size, ctx->n_tokens + 1, sizeof(TokenizerToken));
+  ctx->tokens[ctx->n_tokens++] = (TokenizerToken) { type, start, end, space };
+}
+
+
+static void push_tokens(lua_State *L, TokenizerContext *ctx, const char *text, size_t len, const TokenizerSyntax *syn, const TokenizerPattern *p, const TokenizerMatch *m) {
+  if (m->n_captures == 0) {
+    int type = lookup_symbol(syn, text + m->start, m->end - m->start, p->types[0]);
+    push_token(L, ctx, text, type, m->start, m->end);
+    return;
+  }
+  /* captures split the match in consecutive spans, one per token type */
+  for (int i = 0; i <= m->n_captures; i++) {
+    size_t start = i == 0 ? m->start : m->captures[i - 1];
+    size_t end = i == m->n_captures ? m->end : m->captures[i];
+    if (end > len)
+      end = len;
+    if (end > start) {
+      int type = p->type_is_table && i < p->n_types ? p->types[i] : TOKEN_NORMAL;
+      push_token(L, ctx, text, lookup_symbol(syn, text + start, end - start, type), start, end);
+    }
+  }
+}
+
+
+/* Bad patterns are reported to Lua once the tokens are built */
+static void check_results(lua_State *L, TokenizerContext *ctx, int syntax, int n, const TokenizerPattern *p, const TokenizerMatch *m) {
+  int n_results = m->n_captures + 2;
+  if ((n_results == 2 && p->type_is_table) || n_results - 1 != p->n_types) {
+    for (size_t r = 0; r < ctx->n_reports; r++) {
+      if (ctx->reports[r].syntax == syntax && ctx->reports[r].pattern == n + 1)
+        return;
+    }
+    ctx->reports = grow_array(L, ctx->reports, &ctx->reports_size, ctx->n_reports + 1, sizeof(TokenizerReport));
+    ctx->reports[ctx->n_reports++] = (TokenizerReport) { syntax, n + 1, p->n_types, n_results };
+  }
+}
+
+
+static void retrieve_syntax_state(const NativeTokenizer *T, TokenizerContext *ctx, TokenizerPosition *pos) {
+  const TokenizerSyntax *syn = &T->syntaxes[0];
+  pos->syntax = 0;
+  pos->subsyntax = NULL;
+  pos->pattern = ctx->state_len > 0 ? ctx->state[0] : 0;
+  pos->level = 1;
+  if (pos->pattern > syn->n_patterns) {
+    pos->pattern = 0;
+    return;
+  }
+  if (pos->pattern == 0)
+    return;
+  for (size_t i = 0; i < ctx->state_len; i++) {
+    int target = ctx->state[i];
+    if (target == 0)
+      break;
+    if (target > syn->n_patterns) {
+      pos->pattern = 0;
+      break;
+    }
+    const TokenizerPattern *p = &syn->patterns[target - 1];
+    if (p->syntax >= 0) {
+      pos->subsyntax = p;
+      pos->syntax = p->syntax;
+      pos->pattern = 0;
+      pos->level = i + 2;
+      syn = &T->syntaxes[p->syntax];
+    } else {
+      pos->pattern = target;
+      break;
+    }
+  }
+}
+
+
+static void set_subsyntax_pattern_idx(lua_State *L, TokenizerContext *ctx, TokenizerPosition *pos, int pattern) {
+  pos->pattern = pattern;
+  if (pos->level > ctx->state_len) {
+    ctx->state = grow_array(L, ctx->state, &ctx->state_size, ctx->state_len + 1, 1);
+    ctx->state[ctx->state_len++] = pattern;
+  } else {
+    ctx->state[pos->level - 1] = pattern;
+  }
+}
+
+
+static void push_subsyntax(lua_State *L, TokenizerContext *ctx, TokenizerPosition *pos, const TokenizerPattern *p, int pattern) {
+  set_subsyntax_pattern_idx(L, ctx, pos, pattern);
+  pos->level++;
+  pos->subsyntax = p;
+  pos->syntax = p->syntax;
+  pos->pattern = 0;
+}
+
+
+static void pop_subsyntax(lua_State *L, const NativeTokenizer *T, TokenizerContext *ctx, TokenizerPosition *pos) {
+  pos->level--;
+  if (ctx->state_len > pos->level)
+    ctx->state_len = pos->level;
+  set_subsyntax_pattern_idx(L, ctx, pos, 0);
+  retrieve_syntax_state(T, ctx, pos);
+}
+
+
+static size_t next_char(const char *text, size_t len, size_t i) {
+  for (i++; i < len && (text[i] & 0xC0) == 0x80; i++);
+  return i < len ? i : len;
+}
+
+
+/* Tokenizes `text` from byte `i` into ctx->tokens, starting from the state in
+** ctx->state. Returns the position where it ran out of time, or `len`.
+** The compiled syntaxes are only read, so that the background thread can
+** share them. */
+static size_t tokenize(lua_State *L, const NativeTokenizer *T, TokenizerContext *ctx, const char *text, size_t len, size_t i, double time_limit) {
+  const Uint64 start_time = SDL_GetPerformanceCounter();
+  const Uint64 max_time = time_limit * SDL_GetPerformanceFrequency();
+  size_t starting_i = i;
+  TokenizerPosition pos;
+  TokenizerMatch m, sm;
+  if (!ctx->match_data && !(ctx->match_data = pcre2_match_data_create(TOKENIZER_MAX_CAPTURES + 1, NULL)))
+    luaL_error(L, "not enough memory");
+  retrieve_syntax_state(T, ctx, &pos);
+  while (i < len) {
+    /* every 200 bytes, check if we're out of time */
+    if (i - starting_i > 200) {
+      starting_i = i;
+      if (time_limit > 0 && SDL_GetPerformanceCounter() - start_time > max_time) {
+        push_token(L, ctx, text, TOKEN_INCOMPLETE, i, len);
+        return i;
+      }
+    }
+    /* continue trying to match the end pattern of a pair */
+    if (pos.pattern > 0) {
+      const TokenizerPattern *p = &T->syntaxes[pos.syntax].patterns[pos.pattern - 1];
+      bool found = find_text(L, ctx, text, len, p, i, false, true, &m);
+      int type = p->types[0];
+      /* ending the subsyntax takes precedence over ending the delimiter */
+      if (pos.subsyntax && find_text(L, ctx, text, len, pos.subsyntax, i, false, true, &sm)
+          && (!found || sm.start < m.start)) {
+        push_token(L, ctx, text, type, i, sm.start);
+        i = sm.start;
+      } else if (found) {
+        push_token(L, ctx, text, type, i, m.end);
+        set_subsyntax_pattern_idx(L, ctx, &pos, 0);
+        i = m.end;
+      } else {
+        push_token(L, ctx, text, type, i, len);
+        break;
+      }
+    }
+    /* general end of syntax check */
+    while (pos.subsyntax) {
+      if (!find_text(L, ctx, text, len, pos.subsyntax, i, true, true, &m))
+        break;
+      push_tokens(L, ctx, text, len, &T->syntaxes[pos.syntax], pos.subsyntax, &m);
+      pop_subsyntax(L, T, ctx, &pos);
+      i = m.end;
+    }
+    /* find matching pattern */
+    const TokenizerSyntax *syn = &T->syntaxes[pos.syntax];
+    bool matched = false;
+    for (int n = 0; n < syn->n_patterns; n++) {
+      const TokenizerPattern *p = &syn->patterns[n];
+      if (!find_text(L, ctx, text, len, p, i, true, false, &m))
+        continue;
+      check_results(L, ctx, pos.syntax, n, p, &m);
+      push_tokens(L, ctx, text, len, syn, p, &m);
+      if (p->is_pair) {
+        if (p->syntax >= 0)
+          push_subsyntax(L, ctx, &pos, p, n + 1);
+        else
+          set_subsyntax_pattern_idx(L, ctx, &pos, n + 1);
+      }
+      i = m.end;
+      matched = true;
+      break;
+    }
+    /* consume character if we didn't match */
+    if (!matched) {
+      size_t next = next_char(text, len, i);
+      push_token(L, ctx, text, TOKEN_NORMAL, i, next);
+      i = next;
+    }
+  }
+  return len;
+}
+
+
+static int f_compile(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  lua_settop(L, 3);
+  NativeTokenizer *T = lua_newuserdata(L, sizeof(NativeTokenizer));
+  memset(T, 0, sizeof(NativeTokenizer));
+  luaL_setmetatable(L, API_TYPE_NATIVE_TOKENIZER);
+  lua_newtable(L);
+  int env = lua_gettop(L);
+  lua_pushvalue(L, 3);
+  lua_setfield(L, env, "report");
+  lua_newtable(L);
+  lua_setfield(L, env, "ids");
+  lua_newtable(L);
+  lua_setfield(L, env, "syntaxes");
+  lua_newtable(L);
+  lua_setfield(L, env, "types");
+  lua_pushvalue(L, env);
+  lua_setuservalue(L, 4);
+  intern_type(L, T, env, "normal", 6);
+  intern_type(L, T, env, "incomplete", 10);
+  compile_syntax(L, T, env, 2, 1);
+  lua_settop(L, 4);
+  return 1;
+}
+
+
+static void store_tokens(lua_State *L, const NativeTokenizer *T, int res, size_t n, const TokenizerToken *tokens, size_t n_tokens, const char *text) {
+  for (size_t t = 0; t < n_tokens; t++) {
+    const TokenizerType *type = &T->types[tokens[t].type];
+    lua_pushlstring(L, type->name, type->len);
+    lua_rawseti(L, res, ++n);
+    lua_pushlstring(L, text + tokens[t].start, tokens[t].end - tokens[t].start);
+    lua_rawseti(L, res, ++n);
+  }
+}
+
+
+static void call_reports(lua_State *L, int env, const TokenizerContext *ctx) {
+  for (size_t r = 0; r < ctx->n_reports; r++) {
+    TokenizerReport report = ctx->reports[r];
+    lua_getfield(L, env, "report");
+    lua_getfield(L, env, "syntaxes");
+    lua_rawgeti(L, -1, report.syntax + 1);
+    lua_replace(L, -2);
+    lua_pushinteger(L, report.pattern);
+    lua_pushinteger(L, report.n_types);
+    lua_pushinteger(L, report.n_results);
+    lua_call(L, 4, 0);
+  }
+}
+
+
+static void reset_context(lua_State *L, TokenizerContext *ctx, const char *state, size_t state_len) {
+  ctx->n_tokens = ctx->first = 0;
+  ctx->n_reports = 0;
+  ctx->state = grow_array(L, ctx->state, &ctx->state_size, state_len, 1);
+  memcpy(ctx->state, state, state_len);
+  ctx->state_len = state_len;
+}
+
+
+static void free_context(TokenizerContext *ctx) {
+  if (ctx->match_data)
+    pcre2_match_data_free(ctx->match_data);
+  free(ctx->tokens);
+  free(ctx->state);
+  free(ctx->reports);
+}
+
+
+static int f_tokenize(lua_State *L) {
+  NativeTokenizer *T = luaL_checkudata(L, 1, API_TYPE_NATIVE_TOKENIZER);
+  TokenizerContext *ctx = &T->ctx;
+  size_t len, state_len;
+  const char *text = luaL_checklstring(L, 2, &len);
+  const char *state = luaL_checklstring(L, 3, &state_len);
+  lua_Integer resume_i = luaL_optinteger(L, 5, 1);
+  double time_limit = luaL_optnumber(L, 6, 0);
+  luaL_argcheck(L, resume_i >= 1 && (size_t) resume_i <= len + 1, 5, "invalid resume position");
+  size_t i = resume_i - 1;
+  lua_settop(L, 6);
+  if (lua_isnil(L, 4)) {
+    lua_newtable(L);
+    lua_replace(L, 4);
+  }
+  luaL_checktype(L, 4, LUA_TTABLE);
+  lua_getuservalue(L, 1);
+  int env = lua_gettop(L);
+  reset_context(L, ctx, state, state_len);
+
+  /* when resuming, the last token is moved back to the buffer to keep
+  ** merging the following ones into it */
+  size_t n = lua_rawlen(L, 4);
+  if (i > 0 && n >= 2) {
+    lua_rawgeti(L, 4, n - 1);
+    lua_rawgeti(L, 4, n);
+    size_t type_len, token_len;
+    const char *type = lua_tolstring(L, -2, &type_len);
+    const char *token = lua_tolstring(L, -1, &token_len);
+    if (type && token && token_len <= i && memcmp(text + i - token_len, token, token_len) == 0) {
+      ctx->tokens = grow_array(L, ctx->tokens, &ctx->tokens_size, 1, sizeof(TokenizerToken));
+      ctx->tokens[0] = (TokenizerToken) {
+        intern_type(L, T, env, type, type_len), i - token_len, i,
+        utf8extra_isspace_span(token, token + token_len)
+      };
+      ctx->n_tokens = 1;
+      lua_pushnil(L);
+      lua_rawseti(L, 4, n);
+      lua_pushnil(L);
+      lua_rawseti(L, 4, n - 1);
+      n -= 2;
+    }
+    lua_pop(L, 2);
+  }
+
+  size_t incomplete = tokenize(L, T, ctx, text, len, i, time_limit);
+  store_tokens(L, T, 4, n, ctx->tokens, ctx->n_tokens, text);
+  call_reports(L, env, ctx);
+
+  lua_pushvalue(L, 4);
+  lua_pushlstring(L, (const char*) ctx->state, ctx->state_len);
+  if (incomplete < len) {
+    lua_pushinteger(L, incomplete + 1);
+    return 3;
+  }
+  return 2;
+}
+
+
+/* Background tokenizing.
+** Jobs tokenize a range of lines on a single worker thread, which has its own
+** lua_State so that pattern errors raised by the matchers can be caught. The
+** job keeps a copy of the lines and of the resulting tokens, which are only
+** turned into Lua tables when the main thread asks for them. */
+
+enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED, JOB_CANCELLED };
+
+typedef struct TokenizerJob {
+  const NativeTokenizer *T;
+  TokenizerContext ctx;
+  char *text;
+  size_t *lines;       /* offset of every line in `text`, n_lines + 1 entries */
+  size_t *line_tokens; /* index of the first token of every line in ctx.tokens */
+  unsigned char *states;
+  size_t *line_states; /* offset of the state at the end of every line in `states` */
+  size_t states_size;
+  int n_lines;
+  int status;
+  SDL_atomic_t cancel;
+  char error[256];
+  struct TokenizerJob *next;
+} TokenizerJob;
+
+static struct {
+  SDL_Thread *thread;
+  SDL_mutex *mutex;
+  SDL_cond *job_added, *job_finished;
+  TokenizerJob *first, *last;
+} worker;
+
+
+static int run_job(lua_State *L) {
+  TokenizerJob *job = lua_touserdata(L, 1);
+  TokenizerContext *ctx = &job->ctx;
+  size_t states_len = 0;
+  for (int l = 0; l < job->n_lines && !SDL_AtomicGet(&job->cancel); l++) {
+    ctx->first = ctx->n_tokens;
+    job->line_tokens[l] = ctx->n_tokens;
+    tokenize(L, job->T, ctx, job->text + job->lines[l], job->lines[l + 1] - job->lines[l], 0, 0);
+    job->states = grow_array(L, job->states, &job->states_size, states_len + ctx->state_len, 1);
+    memcpy(job->states + states_len, ctx->state, ctx->state_len);
+    job->line_states[l] = states_len;
+    states_len += ctx->state_len;
+  }
+  job->line_tokens[job->n_lines] = ctx->n_tokens;
+  job->line_states[job->n_lines] = states_len;
+  return 0;
+}
+
+
+static int worker_thread(void *data) {
+  lua_State *L = luaL_newstate();
+  SDL_LockMutex(worker.mutex);
+  for (;;) {
+    while (!worker.first)
+      SDL_CondWait(worker.job_added, worker.mutex);
+    TokenizerJob *job = worker.first;
+    worker.first = job->next;
+    if (!worker.first)
+      worker.last = NULL;
+    job->status = JOB_RUNNING;
+    SDL_UnlockMutex(worker.mutex);
+
+    lua_pushcfunction(L, run_job);
+    lua_pushlightuserdata(L, job);
+    bool failed = lua_pcall(L, 1, 0, 0) != LUA_OK;
+    if (failed) {
+      const char *msg = lua_tostring(L, -1);
+      snprintf(job->error, sizeof(job->error), "%s", msg ? msg : "unknown error");
+    }
+    lua_settop(L, 0);
+
+    SDL_LockMutex(worker.mutex);
+    if (SDL_AtomicGet(&job->cancel))
+      job->status = JOB_CANCELLED;
+    else
+      job->status = failed ? JOB_FAILED : JOB_DONE;
+    SDL_CondBroadcast(worker.job_finished);
+  }
+  return 0;
+}
+
+
+/* Takes the job out of the queue, or waits for the worker to be done with it */
+static void cancel_job(TokenizerJob *job) {
+  SDL_LockMutex(worker.mutex);
+  SDL_AtomicSet(&job->cancel, 1);
+  if (job->status == JOB_QUEUED) {
+    TokenizerJob *prev = NULL;
+    for (TokenizerJob *it = worker.first; it != job; it = it->next)
+      prev = it;
+    if (prev)
+      prev->next = job->next;
+    else
+      worker.first = job->next;
+    if (worker.last == job)
+      worker.last = prev;
+  }
+  while (job->status == JOB_RUNNING)
+    SDL_CondWait(worker.job_finished, worker.mutex);
+  job->status = JOB_CANCELLED;
+  SDL_UnlockMutex(worker.mutex);
+}
+
+
+static int f_tokenize_lines(lua_State *L) {
+  NativeTokenizer *T = luaL_checkudata(L, 1, API_TYPE_NATIVE_TOKENIZER);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  int first = luaL_checkinteger(L, 3);
+  int last = luaL_checkinteger(L, 4);
+  size_t state_len;
+  const char *state = luaL_checklstring(L, 5, &state_len);
+  luaL_argcheck(L, first >= 1 && last >= first - 1, 4, "invalid range of lines");
+
+  if (!worker.thread) {
+    if (!worker.mutex) {
+      worker.mutex = SDL_CreateMutex();
+      worker.job_added = SDL_CreateCond();
+      worker.job_finished = SDL_CreateCond();
+    }
+    worker.thread = SDL_CreateThread(worker_thread, "tokenizer", NULL);
+    if (!worker.thread)
+      return luaL_error(L, "unable to start the tokenizer thread: %s", SDL_GetError());
+    SDL_DetachThread(worker.thread);
+  }
+
+  TokenizerJob *job = lua_newuserdata(L, sizeof(TokenizerJob));
+  memset(job, 0, sizeof(TokenizerJob));
+  job->status = JOB_CANCELLED;
+  luaL_setmetatable(L, API_TYPE_TOKENIZER_JOB);
+  lua_pushvalue(L, 1);
+  lua_setuservalue(L, -2);
+  job->T = T;
+  job->n_lines = last - first + 1;
+  job->lines = malloc((job->n_lines + 1) * sizeof(size_t));
+  job->line_tokens = malloc((job->n_lines + 1) * sizeof(size_t));
+  job->line_states = malloc((job->n_lines + 1) * sizeof(size_t));
+  if (!job->lines || !job->line_tokens || !job->line_states)
+    return luaL_error(L, "not enough memory");
+  size_t text_len = 0;
+  for (int l = 0; l < job->n_lines; l++) {
+    lua_geti(L, 2, first + l);
+    size_t len = 0;
+    if (!lua_tolstring(L, -1, &len))
+      return luaL_error(L, "line %d is not a string", first + l);
+    job->lines[l] = text_len;
+    text_len += len;
+    lua_pop(L, 1);
+  }
+  job->lines[job->n_lines] = text_len;
+  if (!(job->text = malloc(text_len + 1)))
+    return luaL_error(L, "not enough memory");
+  for (int l = 0; l < job->n_lines; l++) {
+    lua_geti(L, 2, first + l);
+    memcpy(job->text + job->lines[l], lua_tostring(L, -1), job->lines[l + 1] - job->lines[l]);
+    lua_pop(L, 1);
+  }
+  reset_context(L, &job->ctx, state, state_len);
+
+  SDL_LockMutex(worker.mutex);
+  job->status = JOB_QUEUED;
+  if (worker.last)
+    worker.last->next = job;
+  else
+    worker.first = job;
+  worker.last = job;
+  SDL_CondSignal(worker.job_added);
+  SDL_UnlockMutex(worker.mutex);
+  return 1;
+}
+
+
+static int f_job_result(lua_State *L) {
+  TokenizerJob *job = luaL_checkudata(L, 1, API_TYPE_TOKENIZER_JOB);
+  SDL_LockMutex(worker.mutex);
+  int status = job->status;
+  SDL_UnlockMutex(worker.mutex);
+  switch (status) {
+    case JOB_QUEUED:
+    case JOB_RUNNING:
+      return 0;
+    case JOB_CANCELLED:
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "cancelled");
+      return 2;
+    case JOB_FAILED:
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, job->error);
+      return 2;
+  }
+  lua_getuservalue(L, 1);
+  const NativeTokenizer *T = lua_touserdata(L, -1);
+  lua_getuservalue(L, -1);
+  int env = lua_gettop(L);
+  lua_createtable(L, job->n_lines, 0);
+  lua_createtable(L, job->n_lines, 0);
+  for (int l = 0; l < job->n_lines; l++) {
+    size_t first = job->line_tokens[l], count = job->line_tokens[l + 1] - first;
+    lua_createtable(L, count * 2, 0);
+    store_tokens(L, T, lua_gettop(L), 0, job->ctx.tokens + first, count, job->text + job->lines[l]);
+    lua_rawseti(L, -3, l + 1);
+    lua_pushlstring(L, (const char*) job->states + job->line_states[l], job->line_states[l + 1] - job->line_states[l]);
+    lua_rawseti(L, -2, l + 1);
+  }
+  call_reports(L, env, &job->ctx);
+  return 2;
+}
+
+
+static int f_job_cancel(lua_State *L) {
+  TokenizerJob *job = luaL_checkudata(L, 1, API_TYPE_TOKENIZER_JOB);
+  if (worker.thread)
+    cancel_job(job);
+  return 0;
+}
+
+
+static int f_job_gc(lua_State *L) {
+  TokenizerJob *job = luaL_checkudata(L, 1, API_TYPE_TOKENIZER_JOB);
+  if (worker.thread)
+    cancel_job(job);
+  free_context(&job->ctx);
+  free(job->text);
+  free(job->lines);
+  free(job->line_tokens);
+  free(job->states);
+  free(job->line_states);
+  return 0;
+}
+
+
+static int f_gc(lua_State *L) {
+  NativeTokenizer *T = luaL_checkudata(L, 1, API_TYPE_NATIVE_TOKENIZER);
+  for (size_t s = 0; s < T->n_syntaxes; s++) {
+    TokenizerSyntax *syn = &T->syntaxes[s];
+    for (int n = 0; n < syn->n_patterns; n++) {
+      TokenizerPattern *p = &syn->patterns[n];
+      for (int i = 0; i < 2; i++) {
+        free(p->matchers[i].code);
+        if (p->matchers[i].re)
+          pcre2_code_free(p->matchers[i].re);
+      }
+      free(p->types);
+    }
+    free(syn->patterns);
+    if (syn->symbols) {
+      for (size_t i = 0; i <= syn->symbols_mask; i++)
+        free(syn->symbols[i].text);
+      free(syn->symbols);
+    }
+  }
+  free(T->syntaxes);
+  for (size_t t = 0; t < T->n_types; t++)
+    free(T->types[t].name);
+  free(T->types);
+  free_context(&T->ctx);
+  return 0;
+}
+
+
+static const luaL_Reg lib[] = {
+  { "compile",        f_compile        },
+  { "tokenize",       f_tokenize       },
+  { "tokenize_lines", f_tokenize_lines },
+  { "__gc",           f_gc             },
+  { NULL,             NULL             }
+};
+
+
+static const luaL_Reg job_lib[] = {
+  { "result", f_job_result },
+  { "cancel", f_job_cancel },
+  { "__gc",   f_job_gc     },
+  { NULL,     NULL         }
+};
+
+
+int luaopen_native_tokenizer(lua_State *L) {
+  luaL_newmetatable(L, API_TYPE_TOKENIZER_JOB);
+  luaL_setfuncs(L, job_lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  luaL_newmetatable(L, API_TYPE_NATIVE_TOKENIZER);
+  luaL_setfuncs(L, lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  return 1;
+}
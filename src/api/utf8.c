@@ -1264,6 +1264,71 @@ static int Lutf8_gsub (lua_State *L) {
 }
 
 
+/* C interface used by the native tokenizer */
+
+/* Behaves like find_aux with byte offsets instead of character indexes.
+ * Returns the number of captures, or -1 when there is no match. The match
+ * spans [*start, *end) and every capture is reported by its starting byte. */
+int utf8extra_find (lua_State *L, const char *s, size_t len, size_t init,
+                    const char *p, size_t plen, int anchor, int plain,
+                    size_t *start, size_t *end, size_t *captures, int max_captures) {
+  const char *es = s + len, *ep = p + plen, *pinit = s + init;
+  if (plain) {
+    const char *s2 = lmemfind(pinit, es-pinit, p, plen);
+    if (s2) {
+      const char *e2 = s2 + plen;
+      if (iscont(e2)) e2 = utf8_next(e2, es);
+      *start = s2 - s;
+      *end = e2 - s;
+      return 0;
+    }
+  } else {
+    MatchState ms;
+    ms.L = L;
+    ms.matchdepth = MAXCCALLS;
+    ms.src_init = s;
+    ms.src_end = es;
+    ms.p_end = ep;
+    do {
+      const char *res;
+      ms.level = 0;
+      assert(ms.matchdepth == MAXCCALLS);
+      if ((res=match(&ms, pinit, p)) != NULL) {
+        int i;
+        if (ms.level > max_captures)
+          luaL_error(L, "too many captures");
+        for (i = 0; i < ms.level; i++) {
+          if (ms.capture[i].len == CAP_UNFINISHED)
+            luaL_error(L, "unfinished capture");
+          captures[i] = ms.capture[i].init - s;
+        }
+        *start = pinit - s;
+        *end = res - s;
+        return ms.level;
+      }
+      if (pinit == es) break;
+      pinit = utf8_next(pinit, es);
+    } while (pinit <= es && !anchor);
+  }
+  return -1;
+}
+
+/* Returns whether the text only contains characters matched by %s */
+int utf8extra_isspace_span (const char *s, const char *e) {
+  while (s < e) {
+    utfint ch = 0;
+    if ((s = utf8_decode(s, &ch, 0)) == NULL || !utf8_isspace(ch))
+      return 0;
+  }
+  return 1;
+}
+
+/* check whether a pattern given to utf8extra_find can use a plain search */
+int utf8extra_nospecials (const char *p, size_t plen) {
+  return nospecials(p, p + plen);
+}
+
+
 /* lua module import interface */
 
 #if LUA_VERSION_NUM >= 502
@@ -276,6 +276,8 @@ init_lua:
     goto init_lua;
   }
 
+  // stop the render threads, they draw to the window surface
+  rencache_set_render_threads(1);
   // This allows the window to be destroyed before lite-xl is done with
   // reaping child processes
   ren_free_window_resources(&window_renderer);
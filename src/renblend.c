@@ -0,0 +1,158 @@
+#include <SDL.h>
+#include "renblend.h"
+
+/* Vectorized glyph compositing used by ren_draw_text.
+** Every channel is blended as (c * a + d * (255 - a)) / 255 where `a` is the
+** glyph coverage scaled by the color alpha. Divisions by 255 are replaced by
+** the usual (x + 128 + ((x + 128) >> 8)) >> 8 approximation, so that the whole
+** computation fits in 16 bit lanes. */
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define RENBLEND_SSE2
+  #include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_AMD64)
+  #if defined(__GNUC__) || defined(__clang__)
+    #define RENBLEND_AVX2
+    #define RENBLEND_TARGET_AVX2 __attribute__((target("avx2")))
+  #elif defined(_MSC_VER)
+    #define RENBLEND_AVX2
+    #define RENBLEND_TARGET_AVX2
+  #endif
+  #ifdef RENBLEND_AVX2
+    #include <immintrin.h>
+  #endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+  #define RENBLEND_NEON
+  #include <arm_neon.h>
+#endif
+
+
+static inline unsigned div255(unsigned x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+
+void ren_blend_span_scalar(uint32_t *dst, const uint32_t *coverage, int count, uint32_t color, uint8_t alpha) {
+  for (int i = 0; i < count; ++i) {
+    uint32_t d = dst[i], s = coverage[i], out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      unsigned a = div255(((s >> shift) & 0xff) * alpha);
+      unsigned c = (color >> shift) & 0xff, dc = (d >> shift) & 0xff;
+      out |= div255(c * a + dc * (255 - a)) << shift;
+    }
+    dst[i] = out;
+  }
+}
+
+
+#ifdef RENBLEND_SSE2
+static inline __m128i div255_sse2(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i blend_sse2(__m128i d, __m128i s, __m128i c, __m128i alpha) {
+  __m128i a = div255_sse2(_mm_mullo_epi16(s, alpha));
+  __m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+  return div255_sse2(_mm_add_epi16(_mm_mullo_epi16(c, a), _mm_mullo_epi16(d, ia)));
+}
+
+/* 4 pixels per iteration */
+static void blend_span_sse2(uint32_t *dst, const uint32_t *coverage, int count, uint32_t color, uint8_t alpha) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+  const __m128i a = _mm_set1_epi16(alpha);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i*) (coverage + i));
+    __m128i lo = blend_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), c, a);
+    __m128i hi = blend_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), c, a);
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+  }
+  ren_blend_span_scalar(dst + i, coverage + i, count - i, color, alpha);
+}
+#endif
+
+
+#ifdef RENBLEND_AVX2
+static inline RENBLEND_TARGET_AVX2 __m256i div255_avx2(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static inline RENBLEND_TARGET_AVX2 __m256i blend_avx2(__m256i d, __m256i s, __m256i c, __m256i alpha) {
+  __m256i a = div255_avx2(_mm256_mullo_epi16(s, alpha));
+  __m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+  return div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(c, a), _mm256_mullo_epi16(d, ia)));
+}
+
+/* 8 pixels per iteration, unpack and pack both work per 128 bit lane so the
+** pixel order is preserved */
+static RENBLEND_TARGET_AVX2 void blend_span_avx2(uint32_t *dst, const uint32_t *coverage, int count, uint32_t color, uint8_t alpha) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i c = _mm256_unpacklo_epi8(_mm256_set1_epi32(color), zero);
+  const __m256i a = _mm256_set1_epi16(alpha);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i*) (coverage + i));
+    __m256i lo = blend_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero), c, a);
+    __m256i hi = blend_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero), c, a);
+    _mm256_storeu_si256((__m256i*) (dst + i), _mm256_packus_epi16(lo, hi));
+  }
+  ren_blend_span_scalar(dst + i, coverage + i, count - i, color, alpha);
+}
+#endif
+
+
+#ifdef RENBLEND_NEON
+static inline uint16x8_t div255_neon(uint16x8_t x) {
+  x = vaddq_u16(x, vdupq_n_u16(128));
+  return vshrq_n_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), 8);
+}
+
+static inline uint8x8_t blend_neon(uint8x8_t d, uint8x8_t s, uint8x8_t c, uint8x8_t alpha) {
+  uint16x8_t a = div255_neon(vmull_u8(s, alpha));
+  uint16x8_t ia = vsubq_u16(vdupq_n_u16(255), a);
+  uint16x8_t out = vmlaq_u16(vmulq_u16(vmovl_u8(c), a), vmovl_u8(d), ia);
+  return vmovn_u16(div255_neon(out));
+}
+
+/* 4 pixels per iteration */
+static void blend_span_neon(uint32_t *dst, const uint32_t *coverage, int count, uint32_t color, uint8_t alpha) {
+  const uint8x8_t c = vreinterpret_u8_u32(vdup_n_u32(color));
+  const uint8x8_t a = vdup_n_u8(alpha);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint8x16_t d = vld1q_u8((const uint8_t*) (dst + i));
+    uint8x16_t s = vld1q_u8((const uint8_t*) (coverage + i));
+    uint8x8_t lo = blend_neon(vget_low_u8(d), vget_low_u8(s), c, a);
+    uint8x8_t hi = blend_neon(vget_high_u8(d), vget_high_u8(s), c, a);
+    vst1q_u8((uint8_t*) (dst + i), vcombine_u8(lo, hi));
+  }
+  ren_blend_span_scalar(dst + i, coverage + i, count - i, color, alpha);
+}
+#endif
+
+
+RenBlendSpan ren_blend_get_span(void) {
+#ifdef RENBLEND_AVX2
+  if (SDL_HasAVX2())
+    return blend_span_avx2;
+#endif
+#ifdef RENBLEND_SSE2
+  if (SDL_HasSSE2())
+    return blend_span_sse2;
+#endif
+#ifdef RENBLEND_NEON
+  if (SDL_HasNEON())
+    return blend_span_neon;
+#endif
+  return NULL;
+}
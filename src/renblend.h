@@ -0,0 +1,19 @@
+#ifndef RENBLEND_H
+#define RENBLEND_H
+
+#include <stdint.h>
+
+/* Blends `count` pixels of the packed `color` into `dst`. `coverage` holds one
+** word per pixel with the glyph coverage of every channel stored in the same
+** byte position as that channel in the destination pixel format. */
+typedef void (*RenBlendSpan)(uint32_t *dst, const uint32_t *coverage, int count, uint32_t color, uint8_t alpha);
+
+/* Portable implementation, used for the leftover pixels of the vectorized
+** implementations and when none of them is available. */
+void ren_blend_span_scalar(uint32_t *dst, const uint32_t *coverage, int count, uint32_t color, uint8_t alpha);
+
+/* Picks the fastest span blender supported by the running CPU, returns NULL
+** when no vectorized implementation is available. */
+RenBlendSpan ren_blend_get_span(void);
+
+#endif
@@ -1,10 +1,13 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 
 #ifdef _MSC_VER
+  #include <intrin.h>
   #ifndef alignof
     #define alignof _Alignof
   #endif
@@ -24,12 +27,13 @@
 ** of hash values, take the cells that have changed since the previous frame,
 ** merge them into dirty rectangles and redraw only those regions */
 
-#define CELLS_X 80
-#define CELLS_Y 50
-#define CELL_SIZE 96
+#define CELL_SIZE_MIN 16 /* in pixels */
+#define CELLS_MAX 8192
 #define CMD_BUF_RESIZE_RATE 1.2
 #define CMD_BUF_INIT_SIZE (1024 * 512)
 #define COMMAND_BARE_SIZE offsetof(Command, command)
+#define RENDER_THREADS_MAX 16
+#define RENDER_THREADS_AUTO_MAX 4
 
 enum CommandType { SET_CLIP, DRAW_TEXT, DRAW_RECT };
 
@@ -60,36 +64,140 @@ typedef struct {
   RenColor color;
 } DrawRectCommand;
 
-static unsigned cells_buf1[CELLS_X * CELLS_Y];
-static unsigned cells_buf2[CELLS_X * CELLS_Y];
-static unsigned *cells_prev = cells_buf1;
-static unsigned *cells = cells_buf2;
-static RenRect rect_buf[CELLS_X * CELLS_Y / 2];
+/* a drawing command that is visible on screen, along with the clip rect it
+** has to be drawn with */
+typedef struct {
+  Command *cmd;
+  RenRect clip;
+  RenRect area;
+} VisibleCommand;
+
+/* the grid is sized from the window at the start of every frame: cells are
+** kept small enough for small updates like a caret blink to redraw only a few
+** pixels, but never so many that hashing large commands becomes expensive */
+static int cells_x, cells_y, cell_size;
+static double cells_scale;
+static uint64_t *cells_buf1;
+static uint64_t *cells_buf2;
+static uint64_t *cells_prev;
+static uint64_t *cells;
+/* dirty rects, plus one more slot for the scrolled region, which is updated
+** without being redrawn */
+static RenRect *rect_buf;
+/* commands are binned per dirty rect, so that each rect only replays the
+** commands touching it: bin_buf[bin_start[i]..bin_start[i + 1]] holds the
+** indexes in visible_buf of the commands overlapping rect_buf[i] */
+static int *cell_rect;
+static int *bin_start;
+static int *bin_count;
+static int *bin_seen;
+static int *bin_buf;
+static size_t bin_buf_size;
+static VisibleCommand *visible_buf;
+static size_t visible_buf_size;
+static int visible_count;
+static bool bins_valid;
 size_t command_buf_size = 0;
 uint8_t *command_buf = NULL;
+/* the commands of the previous frame are kept around to handle scrolling */
+size_t prev_command_buf_size = 0;
+uint8_t *prev_command_buf = NULL;
+static int prev_command_buf_idx;
 static bool resize_issue;
 static int command_buf_idx;
 static RenRect screen_rect;
 static RenRect last_clip_rect;
 static bool show_debug;
+/* cells_prev doesn't describe what is on screen, every cell will be redrawn */
+static bool cells_invalid = true;
+
+/* a region whose content moved since the previous frame. Its pixels are moved
+** in place, then the cells it covers are compared against the commands of the
+** previous frame moved by the same amount: only the cells that don't match and
+** the newly exposed strip are redrawn. Cells partially covered by the region
+** compare the part inside and the part outside of it separately. */
+static struct {
+  RenRect rect, moved;
+  int dx, dy;
+  bool pending;
+  int x1, y1, x2, y2;
+  uint64_t *inside[2];
+  uint64_t *outside[2];
+} scroll;
+
+/* dirty rects never overlap, so they can be redrawn in parallel. Every worker
+** draws through its own view of the window surface, with its own clip rect */
+typedef struct {
+  SDL_Thread *thread;
+  RenSurface view;
+  unsigned generation;
+} RenderWorker;
+
+static struct {
+  RenderWorker list[RENDER_THREADS_MAX];
+  int count;
+  SDL_mutex *mutex;
+  SDL_cond *start_cond, *done_cond;
+  unsigned generation;
+  int busy;
+  bool quit;
+  SDL_atomic_t next_rect;
+  int rect_count;
+} workers;
+
+/* ring buffer with the stats of the last frames */
+static struct {
+  RenCacheStats frames[RENCACHE_STATS_FRAMES];
+  int next, count;
+} stats;
 
 static inline int rencache_min(int a, int b) { return a < b ? a : b; }
 static inline int rencache_max(int a, int b) { return a > b ? a : b; }
 
 
-/* 32bit fnv-1a hash */
-#define HASH_INITIAL 2166136261
+/* 64bit hash consuming 16 bytes per round, modeled after wyhash: each round
+** folds the 128bit product of the input words mixed with the running state */
+#define HASH_INITIAL 0x243f6a8885a308d3ull
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+
+static inline uint64_t hash_mum(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t) a * b;
+  return (uint64_t) r ^ (uint64_t) (r >> 64);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+  uint64_t hi, lo = _umul128(a, b, &hi);
+  return lo ^ hi;
+#else
+  uint64_t a_lo = (uint32_t) a, a_hi = a >> 32, b_lo = (uint32_t) b, b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+  uint64_t cross = (lo_lo >> 32) + (uint32_t) hi_lo + lo_hi;
+  uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+  return ((cross << 32) | (uint32_t) lo_lo) ^ hi;
+#endif
+}
 
-static void hash(unsigned *h, const void *data, int size) {
-  const unsigned char *p = data;
-  while (size--) {
-    *h = (*h ^ *p++) * 16777619;
+static inline uint64_t hash_read(const uint8_t *p, int size) {
+  uint64_t v = 0;
+  memcpy(&v, p, size);
+  return v;
+}
+
+static void hash(uint64_t *h, const void *data, int size) {
+  const uint8_t *p = data;
+  uint64_t seed = *h ^ HASH_P0;
+  int n = size;
+  for (; n > 16; n -= 16, p += 16) {
+    seed = hash_mum(hash_read(p, 8) ^ HASH_P1, hash_read(p + 8, 8) ^ seed);
   }
+  uint64_t a = hash_read(p, rencache_min(n, 8));
+  uint64_t b = n > 8 ? hash_read(p + 8, n - 8) : 0;
+  *h = hash_mum(HASH_P1 ^ (uint64_t) size, hash_mum(a ^ HASH_P1, b ^ seed));
 }
 
 
 static inline int cell_idx(int x, int y) {
-  return x + y * CELLS_X;
+  return x + y * cells_x;
 }
 
 
@@ -130,6 +238,24 @@ static bool expand_command_buffer() {
   return true;
 }
 
+static bool reserve_buffer(void **buf, size_t *size, size_t needed, size_t item_size) {
+  if (needed <= *size) {
+    return true;
+  }
+  size_t new_size = *size ? *size : 1024;
+  while (new_size < needed) {
+    new_size *= 2;
+  }
+  void *new_buf = realloc(*buf, new_size * item_size);
+  if (!new_buf) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to resize binning buffer (%zu)\n", new_size);
+    return false;
+  }
+  *buf = new_buf;
+  *size = new_size;
+  return true;
+}
+
 static void* push_command(enum CommandType type, int size) {
   if (resize_issue) {
     // Don't push new commands as we had problems resizing the command buffer.
@@ -214,29 +340,82 @@ double rencache_draw_text(RenWindow *window_renderer, RenFont **fonts, const cha
 
 
 void rencache_invalidate(void) {
-  memset(cells_prev, 0xff, sizeof(cells_buf1));
+  if (cells_prev) {
+    memset(cells_prev, 0xff, sizeof(uint64_t) * cells_x * cells_y);
+  }
+  cells_invalid = true;
+}
+
+
+void rencache_scroll_rect(RenRect rect, int dx, int dy) {
+  /* only one region is handled per frame, any other is simply redrawn */
+  if (scroll.pending || (dx == 0 && dy == 0)) { return; }
+  scroll.rect = intersect_rects(rect, screen_rect);
+  scroll.dx = dx;
+  scroll.dy = dy;
+  scroll.pending = true;
+}
+
+
+static void* grid_alloc(void *ptr, size_t count, size_t item_size) {
+  ptr = realloc(ptr, count * item_size);
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: unable to allocate the rencache cell grid\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+
+static void resize_cell_grid(int w, int h, double scale) {
+  /* the smallest cells that keep the grid under CELLS_MAX */
+  cell_size = rencache_max(ceil(fmax(CELL_SIZE_MIN / scale, sqrt((double) w * h / CELLS_MAX))), 1);
+  cells_x = w / cell_size + 1;
+  cells_y = h / cell_size + 1;
+  cells_scale = scale;
+
+  /* merged rects can't touch, not even by a corner */
+  int n = cells_x * cells_y, max_rects = ((cells_x + 1) / 2) * ((cells_y + 1) / 2);
+  cells_buf1 = grid_alloc(cells_buf1, n, sizeof(uint64_t));
+  cells_buf2 = grid_alloc(cells_buf2, n, sizeof(uint64_t));
+  cells_prev = cells_buf1;
+  cells = cells_buf2;
+  cell_rect = grid_alloc(cell_rect, n, sizeof(int));
+  rect_buf = grid_alloc(rect_buf, max_rects + 1, sizeof(RenRect));
+  bin_start = grid_alloc(bin_start, max_rects + 1, sizeof(int));
+  bin_count = grid_alloc(bin_count, max_rects, sizeof(int));
+  bin_seen = grid_alloc(bin_seen, max_rects, sizeof(int));
+  for (int i = 0; i < 2; i++) {
+    scroll.inside[i] = grid_alloc(scroll.inside[i], n, sizeof(uint64_t));
+    scroll.outside[i] = grid_alloc(scroll.outside[i], n, sizeof(uint64_t));
+  }
+  for (int i = 0; i < n; i++) {
+    cells[i] = HASH_INITIAL;
+  }
 }
 
 
 void rencache_begin_frame(RenWindow *window_renderer) {
-  /* reset all cells if the screen width/height has changed */
+  /* reset all cells if the screen width/height or scale has changed */
   int w, h;
   resize_issue = false;
   ren_get_size(window_renderer, &w, &h);
-  if (screen_rect.width != w || h != screen_rect.height) {
+  double scale = renwin_get_surface(window_renderer).scale_x;
+  if (screen_rect.width != w || h != screen_rect.height || scale != cells_scale) {
     screen_rect.width = w;
     screen_rect.height = h;
+    resize_cell_grid(w, h, scale);
     rencache_invalidate();
   }
   last_clip_rect = screen_rect;
 }
 
 
-static void update_overlapping_cells(RenRect r, unsigned h) {
-  int x1 = r.x / CELL_SIZE;
-  int y1 = r.y / CELL_SIZE;
-  int x2 = (r.x + r.width) / CELL_SIZE;
-  int y2 = (r.y + r.height) / CELL_SIZE;
+static void update_overlapping_cells(RenRect r, uint64_t h) {
+  int x1 = r.x / cell_size;
+  int y1 = r.y / cell_size;
+  int x2 = (r.x + r.width) / cell_size;
+  int y2 = (r.y + r.height) / cell_size;
 
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
@@ -247,6 +426,104 @@ static void update_overlapping_cells(RenRect r, unsigned h) {
 }
 
 
+static void hash_scroll_part(uint64_t *h, uint64_t cmd_hash, RenRect area, RenRect clip, RenRect part) {
+  area = intersect_rects(area, part);
+  if (area.width == 0 || area.height == 0) { return; }
+  clip = intersect_rects(clip, part);
+  hash(h, &cmd_hash, sizeof(cmd_hash));
+  hash(h, &area, sizeof(area));
+  hash(h, &clip, sizeof(clip));
+}
+
+
+/* Hashes what the commands draw in each cell covered by the scrolled region,
+** moved by (dx, dy). Unlike update_overlapping_cells, commands are hashed with
+** their area and clip rect cut to the part of the cell being hashed, so that a
+** clip rect or a background which didn't move still matches. */
+static void hash_scroll_cells(uint8_t *buf, int buf_idx, int dx, int dy, uint64_t *inside, uint64_t *outside) {
+  for (int y = scroll.y1; y <= scroll.y2; y++) {
+    for (int x = scroll.x1; x <= scroll.x2; x++) {
+      if (inside) { inside[cell_idx(x, y)] = HASH_INITIAL; }
+      if (outside) { outside[cell_idx(x, y)] = HASH_INITIAL; }
+    }
+  }
+
+  RenRect cr = { screen_rect.x + dx, screen_rect.y + dy, screen_rect.width, screen_rect.height };
+  for (Command *cmd = (Command*) buf; (uint8_t*) cmd < buf + buf_idx; cmd = (Command*) ((uint8_t*) cmd + cmd->size)) {
+    RenRect rect = cmd->command[0];
+    rect.x += dx;
+    rect.y += dy;
+    if (cmd->type == SET_CLIP) { cr = rect; continue; }
+    RenRect area = intersect_rects(rect, cr);
+    if (area.width == 0 || area.height == 0) { continue; }
+
+    uint64_t h = HASH_INITIAL;
+    hash(&h, &cmd->type, sizeof(cmd->type));
+    if (cmd->type == DRAW_TEXT) {
+      DrawTextCommand tcmd;
+      memcpy(&tcmd, cmd->command, sizeof(tcmd));
+      tcmd.rect = rect;
+      tcmd.text_x += dx;
+      hash(&h, &tcmd, sizeof(tcmd));
+      hash(&h, ((DrawTextCommand*) cmd->command)->text, tcmd.len);
+    } else {
+      hash(&h, &((DrawRectCommand*) cmd->command)->color, sizeof(RenColor));
+    }
+
+    int x1 = rencache_max(area.x / cell_size, scroll.x1);
+    int y1 = rencache_max(area.y / cell_size, scroll.y1);
+    int x2 = rencache_min((area.x + area.width) / cell_size, scroll.x2);
+    int y2 = rencache_min((area.y + area.height) / cell_size, scroll.y2);
+    for (int y = y1; y <= y2; y++) {
+      for (int x = x1; x <= x2; x++) {
+        int idx = cell_idx(x, y);
+        RenRect cell = { x * cell_size, y * cell_size, cell_size, cell_size };
+        if (inside) { hash_scroll_part(&inside[idx], h, area, cr, intersect_rects(cell, scroll.moved)); }
+        if (outside) {
+          /* the part of the cell outside of the region, as up to 4 bands */
+          RenRect in = intersect_rects(cell, scroll.rect);
+          int in_x2 = in.x + in.width, in_y2 = in.y + in.height;
+          hash_scroll_part(&outside[idx], h, area, cr, (RenRect) { cell.x, cell.y, cell_size, in.y - cell.y });
+          hash_scroll_part(&outside[idx], h, area, cr, (RenRect) { cell.x, in_y2, cell_size, cell.y + cell_size - in_y2 });
+          hash_scroll_part(&outside[idx], h, area, cr, (RenRect) { cell.x, in.y, in.x - cell.x, in.height });
+          hash_scroll_part(&outside[idx], h, area, cr, (RenRect) { in_x2, in.y, cell.x + cell_size - in_x2, in.height });
+        }
+      }
+    }
+  }
+}
+
+
+/* moves the pixels of the scrolled region, returns false if it couldn't be done */
+static bool apply_scroll(RenSurface *rs) {
+  RenRect r = scroll.rect;
+  scroll.moved = intersect_rects(r, (RenRect) { r.x + scroll.dx, r.y + scroll.dy, r.width, r.height });
+  if (cells_invalid || scroll.moved.width == 0 || scroll.moved.height == 0) { return false; }
+  if (!ren_scroll_rect(rs, r, scroll.dx, scroll.dy)) { return false; }
+
+  scroll.x1 = r.x / cell_size;
+  scroll.y1 = r.y / cell_size;
+  scroll.x2 = rencache_min((r.x + r.width - 1) / cell_size, cells_x - 1);
+  scroll.y2 = rencache_min((r.y + r.height - 1) / cell_size, cells_y - 1);
+  hash_scroll_cells(command_buf, command_buf_idx, 0, 0, scroll.inside[0], scroll.outside[0]);
+  hash_scroll_cells(prev_command_buf, prev_command_buf_idx, scroll.dx, scroll.dy, scroll.inside[1], NULL);
+  hash_scroll_cells(prev_command_buf, prev_command_buf_idx, 0, 0, NULL, scroll.outside[1]);
+  return true;
+}
+
+
+static bool scrolled_cell_changed(int x, int y) {
+  int idx = cell_idx(x, y);
+  if (scroll.inside[0][idx] != scroll.inside[1][idx] || scroll.outside[0][idx] != scroll.outside[1][idx]) {
+    return true;
+  }
+  /* the part of the cell exposed by the scroll always needs to be drawn */
+  RenRect in = intersect_rects((RenRect) { x * cell_size, y * cell_size, cell_size, cell_size }, scroll.rect);
+  RenRect m = scroll.moved;
+  return in.x < m.x || in.y < m.y || in.x + in.width > m.x + m.width || in.y + in.height > m.y + m.height;
+}
+
+
 static void push_rect(RenRect r, int *count) {
   /* try to merge with existing rectangle */
   for (int i = *count - 1; i >= 0; i--) {
@@ -261,85 +538,418 @@ static void push_rect(RenRect r, int *count) {
 }
 
 
+/* a merged rect can grow over one pushed before it, keep merging until every
+** rect is disjoint so each pixel is drawn by a single rect */
+static void merge_overlapping_rects(int *count) {
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (int i = 0; i < *count; i++) {
+      for (int j = *count - 1; j > i; j--) {
+        if (rects_overlap(rect_buf[i], rect_buf[j])) {
+          rect_buf[i] = merge_rects(rect_buf[i], rect_buf[j]);
+          rect_buf[j] = rect_buf[--(*count)];
+          merged = true;
+        }
+      }
+    }
+  }
+}
+
+
+static void push_visible_command(Command *cmd, RenRect clip, RenRect area) {
+  if (!bins_valid) { return; }
+  if (cmd->type == DRAW_TEXT) {
+    /* glyphs may overhang the text rect (italics, descenders) */
+    int pad = area.height / 2;
+    area = intersect_rects((RenRect) { area.x - pad, area.y - pad, area.width + pad * 2, area.height + pad * 2 }, clip);
+  }
+  if (!reserve_buffer((void**) &visible_buf, &visible_buf_size, visible_count + 1, sizeof(VisibleCommand))) {
+    bins_valid = false;
+    return;
+  }
+  visible_buf[visible_count++] = (VisibleCommand) { cmd, clip, area };
+}
+
+
+static inline void bin_command_to_rect(int v, int i, bool fill) {
+  /* commands are binned in order, so each one is added only once per rect */
+  if (bin_seen[i] == v) { return; }
+  bin_seen[i] = v;
+  if (fill) { bin_buf[bin_start[i] + bin_count[i]] = v; }
+  bin_count[i]++;
+}
+
+
+static void bin_visible_command(int v, int rect_count, bool fill) {
+  RenRect r = visible_buf[v].area;
+  int x1 = rencache_max(r.x / cell_size, 0);
+  int y1 = rencache_max(r.y / cell_size, 0);
+  int x2 = rencache_min((r.x + r.width) / cell_size, cells_x - 1);
+  int y2 = rencache_min((r.y + r.height) / cell_size, cells_y - 1);
+
+  if ((x2 - x1 + 1) * (y2 - y1 + 1) > rect_count) {
+    /* covers more cells than there are rects, test the rects directly */
+    for (int i = 0; i < rect_count; i++) {
+      RenRect rr = rect_buf[i];
+      if (x1 < rr.x + rr.width && rr.x <= x2 && y1 < rr.y + rr.height && rr.y <= y2)
+        bin_command_to_rect(v, i, fill);
+    }
+    return;
+  }
+
+  for (int y = y1; y <= y2; y++) {
+    for (int x = x1; x <= x2; x++) {
+      int i = cell_rect[cell_idx(x, y)];
+      if (i >= 0)
+        bin_command_to_rect(v, i, fill);
+    }
+  }
+}
+
+
+/* rects must still be in cell units */
+static void bin_visible_commands(int rect_count) {
+  if (!bins_valid) { return; }
+  for (int i = 0; i < cells_x * cells_y; i++)
+    cell_rect[i] = -1;
+  for (int i = 0; i < rect_count; i++) {
+    RenRect r = rect_buf[i];
+    for (int y = r.y; y < r.y + r.height; y++)
+      for (int x = r.x; x < r.x + r.width; x++)
+        cell_rect[cell_idx(x, y)] = i;
+  }
+
+  /* count the commands of each rect first, then fill the bins */
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < rect_count; i++) {
+      bin_seen[i] = -1;
+      bin_count[i] = 0;
+    }
+    for (int v = 0; v < visible_count; v++)
+      bin_visible_command(v, rect_count, pass == 1);
+    if (pass == 0) {
+      bin_start[0] = 0;
+      for (int i = 0; i < rect_count; i++)
+        bin_start[i + 1] = bin_start[i] + bin_count[i];
+      if (!reserve_buffer((void**) &bin_buf, &bin_buf_size, bin_start[rect_count], sizeof(int))) {
+        bins_valid = false;
+        return;
+      }
+    }
+  }
+}
+
+
+static void set_surface_clip_rect(RenSurface *rs, RenRect r) {
+  SDL_Rect clip = {
+    .x = r.x * rs->scale_x, .y = r.y * rs->scale_y,
+    .w = r.width * rs->scale_x, .h = r.height * rs->scale_y
+  };
+  if (rs->renderer)
+    SDL_RenderSetClipRect(rs->renderer, &clip);
+  else
+    SDL_SetClipRect(rs->surface, &clip);
+}
+
+
+static void draw_command(RenSurface *rs, Command *cmd) {
+  DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
+  DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
+  switch (cmd->type) {
+    case DRAW_RECT:
+      ren_draw_rect(rs, rcmd->rect, rcmd->color);
+      break;
+    case DRAW_TEXT:
+      ren_draw_text(rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color, tcmd->tab_size);
+      break;
+    default:
+      break;
+  }
+}
+
+
+static void draw_region(RenSurface *rs, int idx) {
+  RenRect r = rect_buf[idx];
+  set_surface_clip_rect(rs, r);
+
+  if (bins_valid) {
+    /* only replay the commands binned to this rect */
+    RenRect clip = r;
+    for (int i = bin_start[idx]; i < bin_start[idx + 1]; i++) {
+      VisibleCommand *vcmd = &visible_buf[bin_buf[i]];
+      RenRect cr = intersect_rects(vcmd->clip, r);
+      if (memcmp(&cr, &clip, sizeof(RenRect)) != 0) {
+        clip = cr;
+        set_surface_clip_rect(rs, clip);
+      }
+      draw_command(rs, vcmd->cmd);
+    }
+  } else {
+    Command *cmd = NULL;
+    while (next_command(&cmd)) {
+      if (cmd->type == SET_CLIP)
+        set_surface_clip_rect(rs, intersect_rects(cmd->command[0], r));
+      else
+        draw_command(rs, cmd);
+    }
+  }
+
+  if (show_debug) {
+    set_surface_clip_rect(rs, r);
+    RenColor color = { rand(), rand(), rand(), 50 };
+    ren_draw_rect(rs, r, color);
+  }
+}
+
+
+static void draw_pending_rects(RenSurface *rs) {
+  int i;
+  while ((i = SDL_AtomicAdd(&workers.next_rect, 1)) < workers.rect_count)
+    draw_region(rs, i);
+}
+
+
+static void free_worker_views(void) {
+  for (int i = 0; i < workers.count; i++) {
+    SDL_FreeSurface(workers.list[i].view.surface);
+    workers.list[i].view.surface = NULL;
+  }
+}
+
+
+static bool create_worker_views(RenSurface *rs) {
+  SDL_Surface *surface = rs->surface;
+  /* renderer calls must stay on the main thread */
+  if (!surface)
+    return false;
+  SDL_PixelFormat *format = surface->format;
+  /* ren_draw_rect only blends without shared state on 8 bit channels */
+  if (format->BytesPerPixel != 4 || format->Rmask != 0xFFu << format->Rshift
+      || format->Gmask != 0xFFu << format->Gshift || format->Bmask != 0xFFu << format->Bshift)
+    return false;
+  for (int i = 0; i < workers.count; i++) {
+    RenSurface *view = &workers.list[i].view;
+    *view = *rs;
+    view->surface = SDL_CreateRGBSurfaceWithFormatFrom(surface->pixels,
+      surface->w, surface->h, format->BitsPerPixel, surface->pitch, format->format);
+    if (!view->surface) {
+      free_worker_views();
+      return false;
+    }
+  }
+  return true;
+}
+
+
+static int render_worker(void *data) {
+  RenderWorker *worker = data;
+  SDL_LockMutex(workers.mutex);
+  while (true) {
+    while (!workers.quit && workers.generation == worker->generation)
+      SDL_CondWait(workers.start_cond, workers.mutex);
+    if (workers.quit)
+      break;
+    worker->generation = workers.generation;
+    SDL_UnlockMutex(workers.mutex);
+
+    draw_pending_rects(&worker->view);
+
+    SDL_LockMutex(workers.mutex);
+    if (--workers.busy == 0)
+      SDL_CondSignal(workers.done_cond);
+  }
+  SDL_UnlockMutex(workers.mutex);
+  return 0;
+}
+
+
+void rencache_set_render_threads(int count) {
+  /* the main thread also draws, so it is not counted as a worker */
+  if (count <= 0)
+    count = rencache_min(SDL_GetCPUCount(), RENDER_THREADS_AUTO_MAX);
+  count = rencache_max(0, rencache_min(count, RENDER_THREADS_MAX + 1) - 1);
+  if (count == workers.count)
+    return;
+
+  if (!workers.mutex) {
+    workers.mutex = SDL_CreateMutex();
+    workers.start_cond = SDL_CreateCond();
+    workers.done_cond = SDL_CreateCond();
+  }
+
+  /* stop the current workers */
+  SDL_LockMutex(workers.mutex);
+  workers.quit = true;
+  SDL_CondBroadcast(workers.start_cond);
+  SDL_UnlockMutex(workers.mutex);
+  for (int i = 0; i < workers.count; i++)
+    SDL_WaitThread(workers.list[i].thread, NULL);
+  workers.quit = false;
+  workers.count = 0;
+
+  for (int i = 0; i < count; i++) {
+    RenderWorker *worker = &workers.list[i];
+    /* set before starting, a frame may be dispatched before the thread runs */
+    worker->generation = workers.generation;
+    worker->thread = SDL_CreateThread(render_worker, "rencache worker", worker);
+    if (!worker->thread) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to create render thread: %s\n", SDL_GetError());
+      break;
+    }
+    workers.count++;
+  }
+}
+
+
+int rencache_get_stats(RenCacheStats *frames, int max) {
+  /* the most recent frames, oldest first */
+  int count = rencache_min(max, stats.count);
+  for (int i = 0; i < count; i++)
+    frames[i] = stats.frames[(stats.next - count + i + RENCACHE_STATS_FRAMES) % RENCACHE_STATS_FRAMES];
+  return count;
+}
+
+
+#ifdef RENCACHE_RECORD
+/* When built with -DRENCACHE_RECORD, the commands hashed every frame are
+** appended to the file named by LITE_RENCACHE_RECORD, along with the cells
+** they cover, for scripts/rencache-hash-bench.c to replay. Every record is
+** five int32: the first and last cell covered and the size of the command
+** that follows; frames start with a record of size 0 holding the grid size. */
+static FILE *record_file;
+
+static void record(int32_t x1, int32_t y1, int32_t x2, int32_t y2, const void *data, uint32_t size) {
+  if (!record_file) {
+    const char *path = getenv("LITE_RENCACHE_RECORD");
+    if (!path || !(record_file = fopen(path, "wb")))
+      return;
+  }
+  int32_t header[5] = { x1, y1, x2, y2, (int32_t) size };
+  fwrite(header, sizeof(header), 1, record_file);
+  if (size > 0)
+    fwrite(data, 1, size, record_file);
+}
+#endif
+
+
 void rencache_end_frame(RenWindow *window_renderer) {
+  RenCacheStats *frame_stats = &stats.frames[stats.next];
+  *frame_stats = (RenCacheStats) { .command_bytes = command_buf_idx };
+  const double frequency = SDL_GetPerformanceFrequency();
+  uint64_t start_time = SDL_GetPerformanceCounter();
+
   /* update cells from commands */
   Command *cmd = NULL;
   RenRect cr = screen_rect;
+  visible_count = 0;
+  bins_valid = true;
+#ifdef RENCACHE_RECORD
+  record(cells_x, cells_y, 0, 0, NULL, 0);
+#endif
   while (next_command(&cmd)) {
+    frame_stats->commands++;
     /* cmd->command[0] should always be the Command rect */
     if (cmd->type == SET_CLIP) { cr = cmd->command[0]; }
     RenRect r = intersect_rects(cmd->command[0], cr);
     if (r.width == 0 || r.height == 0) { continue; }
-    unsigned h = HASH_INITIAL;
+    uint64_t h = HASH_INITIAL;
     hash(&h, cmd, cmd->size);
     update_overlapping_cells(r, h);
+#ifdef RENCACHE_RECORD
+    record(r.x / cell_size, r.y / cell_size, (r.x + r.width) / cell_size, (r.y + r.height) / cell_size, cmd, cmd->size);
+#endif
+    if (cmd->type != SET_CLIP) { push_visible_command(cmd, cr, r); }
   }
 
+  /* move the pixels of the scrolled region before anything gets redrawn */
+  RenSurface rs = renwin_get_surface(window_renderer);
+  bool scrolled = scroll.pending && apply_scroll(&rs);
+
   /* push rects for all cells changed from last frame, reset cells */
   int rect_count = 0;
-  int max_x = screen_rect.width / CELL_SIZE + 1;
-  int max_y = screen_rect.height / CELL_SIZE + 1;
-  for (int y = 0; y < max_y; y++) {
-    for (int x = 0; x < max_x; x++) {
+  for (int y = 0; y < cells_y; y++) {
+    for (int x = 0; x < cells_x; x++) {
       /* compare previous and current cell for change */
       int idx = cell_idx(x, y);
-      if (cells[idx] != cells_prev[idx]) {
+      bool in_scroll = scrolled && x >= scroll.x1 && x <= scroll.x2 && y >= scroll.y1 && y <= scroll.y2;
+      if (in_scroll ? scrolled_cell_changed(x, y) : cells[idx] != cells_prev[idx]) {
         push_rect((RenRect) { x, y, 1, 1 }, &rect_count);
       }
       cells_prev[idx] = HASH_INITIAL;
     }
   }
 
+  merge_overlapping_rects(&rect_count);
+  bin_visible_commands(rect_count);
+
   /* expand rects from cells to pixels */
   for (int i = 0; i < rect_count; i++) {
     RenRect *r = &rect_buf[i];
-    r->x *= CELL_SIZE;
-    r->y *= CELL_SIZE;
-    r->width *= CELL_SIZE;
-    r->height *= CELL_SIZE;
+    r->x *= cell_size;
+    r->y *= cell_size;
+    r->width *= cell_size;
+    r->height *= cell_size;
     *r = intersect_rects(*r, screen_rect);
+    frame_stats->pixels += (uint64_t) (r->width * rs.scale_x) * (uint64_t) (r->height * rs.scale_y);
   }
+  frame_stats->rects = rect_count;
+  uint64_t hash_end_time = SDL_GetPerformanceCounter();
 
-  RenSurface rs = renwin_get_surface(window_renderer);
   /* redraw updated regions */
-  for (int i = 0; i < rect_count; i++) {
-    /* draw */
-    RenRect r = rect_buf[i];
-    ren_set_clip_rect(window_renderer, r);
-
-    cmd = NULL;
-    while (next_command(&cmd)) {
-      SetClipCommand *ccmd = (SetClipCommand*)&cmd->command;
-      DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
-      DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
-      switch (cmd->type) {
-        case SET_CLIP:
-          ren_set_clip_rect(window_renderer, intersect_rects(ccmd->rect, r));
-          break;
-        case DRAW_RECT:
-          ren_draw_rect(&rs, rcmd->rect, rcmd->color);
-          break;
-        case DRAW_TEXT:
-          ren_font_group_set_tab_size(tcmd->fonts, tcmd->tab_size);
-          ren_draw_text(&rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color);
-          break;
-      }
-    }
-
-    if (show_debug) {
-      RenColor color = { rand(), rand(), rand(), 50 };
-      ren_draw_rect(&rs, r, color);
-    }
+  if (workers.count > 0 && rect_count > 1 && create_worker_views(&rs)) {
+    SDL_LockMutex(workers.mutex);
+    SDL_AtomicSet(&workers.next_rect, 0);
+    workers.rect_count = rect_count;
+    workers.busy = workers.count;
+    workers.generation++;
+    SDL_CondBroadcast(workers.start_cond);
+    SDL_UnlockMutex(workers.mutex);
+
+    draw_pending_rects(&rs);
+
+    SDL_LockMutex(workers.mutex);
+    while (workers.busy > 0)
+      SDL_CondWait(workers.done_cond, workers.mutex);
+    SDL_UnlockMutex(workers.mutex);
+    free_worker_views();
+  } else {
+    for (int i = 0; i < rect_count; i++)
+      draw_region(&rs, i);
+  }
+  renwin_clip_to_surface(window_renderer);
+  /* nothing is being drawn anymore, glyphs can be evicted */
+  ren_glyph_cache_end_frame();
+  uint64_t draw_end_time = SDL_GetPerformanceCounter();
+
+  /* update dirty rects, along with the moved pixels */
+  if (scrolled) {
+    rect_buf[rect_count++] = scroll.moved;
   }
-
-  /* update dirty rects */
   if (rect_count > 0) {
     ren_update_rects(window_renderer, rect_buf, rect_count);
   }
 
+  frame_stats->hash_time = (hash_end_time - start_time) / frequency;
+  frame_stats->draw_time = (draw_end_time - hash_end_time) / frequency;
+  frame_stats->present_time = (SDL_GetPerformanceCounter() - draw_end_time) / frequency;
+  stats.next = (stats.next + 1) % RENCACHE_STATS_FRAMES;
+  stats.count = rencache_min(stats.count + 1, RENCACHE_STATS_FRAMES);
+
   /* swap cell buffer and reset */
-  unsigned *tmp = cells;
+  uint64_t *tmp = cells;
   cells = cells_prev;
   cells_prev = tmp;
+  cells_invalid = false;
+  scroll.pending = false;
+
+  /* keep this frame's commands, they describe what is now on screen */
+  uint8_t *buf = prev_command_buf;
+  size_t buf_size = prev_command_buf_size;
+  prev_command_buf = command_buf;
+  prev_command_buf_size = command_buf_size;
+  prev_command_buf_idx = command_buf_idx;
+  command_buf = buf;
+  command_buf_size = buf_size;
   command_buf_idx = 0;
 }
@@ -5,12 +5,26 @@
 #include <lua.h>
 #include "renderer.h"
 
+#define RENCACHE_STATS_FRAMES 120
+
+/* work done by rencache_end_frame for a single frame, times are in seconds */
+typedef struct {
+  int commands;
+  size_t command_bytes;
+  int rects;
+  uint64_t pixels;
+  double hash_time, draw_time, present_time;
+} RenCacheStats;
+
 void  rencache_show_debug(bool enable);
 void  rencache_set_clip_rect(RenRect rect);
 void  rencache_draw_rect(RenRect rect, RenColor color);
+void  rencache_scroll_rect(RenRect rect, int dx, int dy);
 double rencache_draw_text(RenWindow *window_renderer, RenFont **font, const char *text, size_t len, double x, double y, RenColor color);
 void  rencache_invalidate(void);
 void  rencache_begin_frame(RenWindow *window_renderer);
 void  rencache_end_frame(RenWindow *window_renderer);
+void  rencache_set_render_threads(int count);
+int   rencache_get_stats(RenCacheStats *frames, int max);
 
 #endif
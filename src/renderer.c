@@ -17,16 +17,28 @@
 
 #include "renderer.h"
 #include "renwindow.h"
+#include "renblend.h"
 
-#define MAX_GLYPHSET 256
-#define MAX_LOADABLE_GLYPHSETS 1024
+#define GLYPH_TABLE_INIT_SIZE 256
+#define GLYPH_BLOCK_SIZE 128
 #define SUBPIXEL_BITMAPS_CACHED 3
+#define BLEND_SPAN_MAX 256
+#define GLYPH_PAGE_SIZE 256
+#define GLYPH_ATLAS_DEFAULT_BUDGET (16 * 1024 * 1024)
+#define WIDTH_CACHE_SIZE 4096
+#define WIDTH_CACHE_MAX_LEN 4096
+#define WIDTH_CACHE_MAX_BYTES (8 * 1024 * 1024)
+#define WIDTH_CACHE_ALIGN 64
 
 RenWindow window_renderer = {0};
 static FT_Library library;
 
 // draw_rect_surface is used as a 1x1 surface to simplify ren_draw_rect with blending
 static SDL_Surface *draw_rect_surface;
+// vectorized glyph blending, NULL if the CPU doesn't support any
+static RenBlendSpan blend_span;
+// glyphs may be loaded from the rencache worker threads
+static SDL_mutex *glyph_mutex;
 
 static void* check_alloc(void *ptr) {
   if (!ptr) {
@@ -38,22 +50,69 @@ static void* check_alloc(void *ptr) {
 
 /************************* Fonts *************************/
 
+typedef struct GlyphPage GlyphPage;
+
 typedef struct {
+  // key of the glyph in the table of its font
+  unsigned int codepoint;
+  unsigned char subpixel_idx;
   unsigned short x0, x1, y0, y1, loaded;
   short bitmap_left, bitmap_top;
   float xadvance;
+  // atlas page holding the bitmap, NULL until the glyph is rasterized or after its page got evicted
+  GlyphPage *page;
+  SDL_atomic_t ready;
 } GlyphMetric;
 
-typedef struct {
-  SDL_Surface* surface;
-  GlyphMetric metrics[MAX_GLYPHSET];
-} GlyphSet;
+/* Open addressing table of the glyphs loaded by a font, keyed by codepoint and
+** subpixel position. Glyphs are looked up without locking: a table is never
+** modified once it was replaced by a bigger one, the old one being kept until
+** the end of the frame, and glyphs are only published once their key is set. */
+typedef struct GlyphTable {
+  struct GlyphTable *retired_next;
+  size_t mask, count;
+  GlyphMetric *slots[];
+} GlyphTable;
+
+// glyph metrics are allocated in blocks, which are freed along with the glyph cache of the font
+typedef struct GlyphBlock {
+  struct GlyphBlock *next;
+  int count;
+  GlyphMetric metrics[GLYPH_BLOCK_SIZE];
+} GlyphBlock;
+
+/* Glyph bitmaps of a font are packed in shelves into atlas pages. Pages are the
+** eviction unit: once the pages of all fonts go over budget the least recently
+** drawn ones are released along with every glyph they hold. */
+struct GlyphPage {
+  SDL_Surface *surface;
+  struct RenFont *font;
+  GlyphPage *prev, *next;
+  GlyphMetric **glyphs;
+  int glyph_count, glyph_capacity;
+  int shelf_x, shelf_y, shelf_height;
+  SDL_atomic_t last_used;
+  // copy of the surface used when drawing on the GPU, rows in [dirty_y0, dirty_y1) are not uploaded yet
+  SDL_Texture *texture;
+  int dirty_y0, dirty_y1;
+};
+
+static struct {
+  GlyphPage *pages;
+  size_t size, budget;
+  SDL_atomic_t frame;
+} glyph_atlas = { NULL, 0, GLYPH_ATLAS_DEFAULT_BUDGET };
+
+// glyph tables replaced since the end of the last frame, they may still be read
+static GlyphTable *retired_glyph_tables;
 
 typedef struct RenFont {
   FT_Face face;
-  GlyphSet* sets[SUBPIXEL_BITMAPS_CACHED][MAX_LOADABLE_GLYPHSETS];
+  GlyphTable *glyphs;
+  GlyphBlock *glyph_blocks;
+  GlyphPage* page;
   float size, space_advance, tab_advance;
-  unsigned short max_height, baseline, height;
+  unsigned short baseline, height;
   ERenFontAntialiasing antialiasing;
   ERenFontHinting hinting;
   unsigned char style;
@@ -65,6 +124,33 @@ typedef struct RenFont {
   char path[];
 } RenFont;
 
+typedef struct {
+  uint64_t hash;
+  unsigned generation;
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  float tab_advance;
+  double scale;
+  char *text;
+  size_t len, capacity;
+  double *widths;
+  int count;
+} WidthCacheEntry;
+
+static struct {
+  WidthCacheEntry entries[WIDTH_CACHE_SIZE];
+  // texts too long to be worth caching, or that don't fit in the budget, are measured here
+  WidthCacheEntry scratch;
+  // bytes allocated by the entries, scratch excluded
+  size_t bytes;
+  // bumped whenever glyph metrics change or a font is freed
+  unsigned generation;
+} width_cache = { .generation = 1 };
+
+static inline bool is_byte_aligned_32bpp(SDL_PixelFormat *format) {
+  return format->BytesPerPixel == 4
+    && !(format->Rshift % 8) && !(format->Gshift % 8) && !(format->Bshift % 8);
+}
+
 static const char* utf8_to_codepoint(const char *p, unsigned *dst) {
   const unsigned char *up = (unsigned char*)p;
   unsigned res, n;
@@ -123,97 +209,279 @@ static int font_set_style(FT_Outline* outline, int x_translation, unsigned char
   return 0;
 }
 
-static void font_load_glyphset(RenFont* font, int idx) {
+static void atlas_free_page(GlyphPage *page) {
+  for (int i = 0; i < page->glyph_count; ++i)
+    SDL_AtomicSetPtr((void**) &page->glyphs[i]->page, NULL);
+  if (page->font->page == page)
+    page->font->page = NULL;
+  if (page->prev)
+    page->prev->next = page->next;
+  else
+    glyph_atlas.pages = page->next;
+  if (page->next)
+    page->next->prev = page->prev;
+  glyph_atlas.size -= (size_t) page->surface->pitch * page->surface->h;
+  if (page->texture)
+    SDL_DestroyTexture(page->texture);
+  SDL_FreeSurface(page->surface);
+  free(page->glyphs);
+  free(page);
+}
+
+static GlyphPage* atlas_new_page(RenFont *font, int w, int h) {
+  GlyphPage *page = check_alloc(calloc(1, sizeof(GlyphPage)));
+  // glyphs bigger than a page get a page of their own
+  page->surface = check_alloc(SDL_CreateRGBSurface(0, w > GLYPH_PAGE_SIZE ? w : GLYPH_PAGE_SIZE, h > GLYPH_PAGE_SIZE ? h : GLYPH_PAGE_SIZE,
+    font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 24 : 8, 0, 0, 0, 0));
+  page->font = font;
+  page->next = glyph_atlas.pages;
+  if (page->next)
+    page->next->prev = page;
+  glyph_atlas.pages = page;
+  glyph_atlas.size += (size_t) page->surface->pitch * page->surface->h;
+  SDL_AtomicSet(&page->last_used, SDL_AtomicGet(&glyph_atlas.frame));
+  return page;
+}
+
+// reserves a w x h area in the current page of the font, moving to a new shelf or page when it doesn't fit
+static GlyphPage* atlas_alloc(RenFont *font, int w, int h, int *x, int *y) {
+  GlyphPage *page = font->page;
+  if (page && (page->shelf_x + w > page->surface->w || (h > page->shelf_height && page->shelf_x > 0))) {
+    page->shelf_y += page->shelf_height;
+    page->shelf_x = page->shelf_height = 0;
+  }
+  if (!page || w > page->surface->w || page->shelf_y + h > page->surface->h)
+    page = font->page = atlas_new_page(font, w, h);
+  *x = page->shelf_x;
+  *y = page->shelf_y;
+  page->shelf_x += w;
+  page->shelf_height = h > page->shelf_height ? h : page->shelf_height;
+  return page;
+}
+
+static void atlas_mark_dirty(GlyphPage *page, int y, int h) {
+  if (page->dirty_y1 <= page->dirty_y0) {
+    page->dirty_y0 = y;
+    page->dirty_y1 = y + h;
+  } else {
+    page->dirty_y0 = y < page->dirty_y0 ? y : page->dirty_y0;
+    page->dirty_y1 = y + h > page->dirty_y1 ? y + h : page->dirty_y1;
+  }
+}
+
+/* Returns the texture of the page, uploading the glyphs rasterized since the
+** last call. Texels are white with the coverage as alpha so that they can be
+** tinted with the color mod; subpixel coverage is averaged to grayscale. */
+static SDL_Texture* atlas_get_texture(GlyphPage *page, SDL_Renderer *renderer) {
+  SDL_Surface *surface = page->surface;
+  if (!page->texture) {
+    page->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, surface->w, surface->h);
+    if (!page->texture)
+      return NULL;
+    SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_BLEND);
+    atlas_mark_dirty(page, 0, surface->h);
+  }
+  if (page->dirty_y1 > page->dirty_y0) {
+    int h = page->dirty_y1 - page->dirty_y0, bytes_per_pixel = surface->format->BytesPerPixel;
+    uint32_t *texels = check_alloc(malloc((size_t) surface->w * h * sizeof(uint32_t)));
+    for (int y = 0; y < h; ++y) {
+      uint8_t *src = (uint8_t*) surface->pixels + (page->dirty_y0 + y) * surface->pitch;
+      for (int x = 0; x < surface->w; ++x, src += bytes_per_pixel) {
+        uint32_t coverage = bytes_per_pixel == 3 ? (src[0] + src[1] + src[2]) / 3 : src[0];
+        texels[y * surface->w + x] = coverage << 24 | 0xFFFFFF;
+      }
+    }
+    SDL_UpdateTexture(page->texture, &(SDL_Rect){ 0, page->dirty_y0, surface->w, h }, texels, surface->w * sizeof(uint32_t));
+    free(texels);
+    page->dirty_y0 = page->dirty_y1 = 0;
+  }
+  return page->texture;
+}
+
+// destroys the textures of every page, they're created and filled again when next drawn
+static void atlas_drop_textures(void) {
+  for (GlyphPage *page = glyph_atlas.pages; page; page = page->next) {
+    if (page->texture)
+      SDL_DestroyTexture(page->texture);
+    page->texture = NULL;
+  }
+}
+
+static inline bool glyph_has_bitmap(GlyphMetric *metric) {
+  return metric->loaded && metric->x1 > metric->x0 && metric->y1 > metric->y0;
+}
+
+// rasterizes a single glyph into the atlas, must be called with glyph_mutex held
+static void font_load_glyph(RenFont* font, unsigned int codepoint, int subpixel_idx, GlyphMetric* metric) {
+  if (SDL_AtomicGet(&metric->ready) && (!glyph_has_bitmap(metric) || SDL_AtomicGetPtr((void**) &metric->page)))
+    return;
   unsigned int render_option = font_set_render_options(font), load_option = font_set_load_options(font);
   int bitmaps_cached = font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? SUBPIXEL_BITMAPS_CACHED : 1;
   unsigned int byte_width = font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 3 : 1;
-  for (int j = 0, pen_x = 0; j < bitmaps_cached; ++j) {
-    GlyphSet* set = check_alloc(calloc(1, sizeof(GlyphSet)));
-    font->sets[j][idx] = set;
-    for (int i = 0; i < MAX_GLYPHSET; ++i) {
-      int glyph_index = FT_Get_Char_Index(font->face, i + idx * MAX_GLYPHSET);
-      if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, load_option | FT_LOAD_BITMAP_METRICS_ONLY)
-        || font_set_style(&font->face->glyph->outline, j * (64 / SUBPIXEL_BITMAPS_CACHED), font->style) || FT_Render_Glyph(font->face->glyph, render_option)) {
-        continue;
-      }
-      FT_GlyphSlot slot = font->face->glyph;
-      int glyph_width = slot->bitmap.width / byte_width;
-      if (font->antialiasing == FONT_ANTIALIASING_NONE)
-        glyph_width *= 8;
-      set->metrics[i] = (GlyphMetric){ pen_x, pen_x + glyph_width, 0, slot->bitmap.rows, true, slot->bitmap_left, slot->bitmap_top, (slot->advance.x + slot->lsb_delta - slot->rsb_delta) / 64.0f};
-      pen_x += glyph_width;
-      font->max_height = slot->bitmap.rows > font->max_height ? slot->bitmap.rows : font->max_height;
-      // In order to fix issues with monospacing; we need the unhinted xadvance; as FreeType doesn't correctly report the hinted advance for spaces on monospace fonts (like RobotoMono). See #843.
-      if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, (load_option | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT)
-        || font_set_style(&font->face->glyph->outline, j * (64 / SUBPIXEL_BITMAPS_CACHED), font->style) || FT_Render_Glyph(font->face->glyph, render_option)) {
-        continue;
-      }
-      slot = font->face->glyph;
-      set->metrics[i].xadvance = slot->advance.x / 64.0f;
+  int glyph_index = FT_Get_Char_Index(font->face, codepoint);
+  // In order to fix issues with monospacing; we need the unhinted xadvance; as FreeType doesn't correctly report the hinted advance for spaces on monospace fonts (like RobotoMono). See #843.
+  float xadvance = 0;
+  bool unhinted = glyph_index && !FT_Load_Glyph(font->face, glyph_index, (load_option | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT);
+  if (unhinted)
+    xadvance = font->face->glyph->advance.x / 64.0f;
+  if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, load_option)
+    || font_set_style(&font->face->glyph->outline, subpixel_idx * (64 / bitmaps_cached), font->style) || FT_Render_Glyph(font->face->glyph, render_option)) {
+    SDL_AtomicSet(&metric->ready, 1);
+    return;
+  }
+  FT_GlyphSlot slot = font->face->glyph;
+  int glyph_width = slot->bitmap.width / byte_width;
+  if (font->antialiasing == FONT_ANTIALIASING_NONE)
+    glyph_width *= 8;
+  if (!unhinted)
+    xadvance = (slot->advance.x + slot->lsb_delta - slot->rsb_delta) / 64.0f;
+  int x = 0, y = 0;
+  GlyphPage *page = NULL;
+  if (glyph_width > 0 && slot->bitmap.rows > 0) {
+    page = atlas_alloc(font, glyph_width, slot->bitmap.rows, &x, &y);
+    uint8_t* pixels = page->surface->pixels;
+    for (unsigned int line = 0; line < slot->bitmap.rows; ++line) {
+      int target_offset = page->surface->pitch * (y + line) + x * byte_width;
+      int source_offset = line * slot->bitmap.pitch;
+      if (font->antialiasing == FONT_ANTIALIASING_NONE) {
+        for (unsigned int column = 0; column < slot->bitmap.width; ++column) {
+          int current_source_offset = source_offset + (column / 8);
+          int source_pixel = slot->bitmap.buffer[current_source_offset];
+          pixels[++target_offset] = ((source_pixel >> (7 - (column % 8))) & 0x1) << 7;
+        }
+      } else
+        memcpy(&pixels[target_offset], &slot->bitmap.buffer[source_offset], slot->bitmap.width);
     }
-    if (pen_x == 0)
-      continue;
-    set->surface = check_alloc(SDL_CreateRGBSurface(0, pen_x, font->max_height, font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 24 : 8, 0, 0, 0, 0));
-    uint8_t* pixels = set->surface->pixels;
-    for (int i = 0; i < MAX_GLYPHSET; ++i) {
-      int glyph_index = FT_Get_Char_Index(font->face, i + idx * MAX_GLYPHSET);
-      if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, load_option))
-        continue;
-      FT_GlyphSlot slot = font->face->glyph;
-      font_set_style(&slot->outline, (64 / bitmaps_cached) * j, font->style);
-      if (FT_Render_Glyph(slot, render_option))
-        continue;
-      for (unsigned int line = 0; line < slot->bitmap.rows; ++line) {
-        int target_offset = set->surface->pitch * line + set->metrics[i].x0 * byte_width;
-        int source_offset = line * slot->bitmap.pitch;
-        if (font->antialiasing == FONT_ANTIALIASING_NONE) {
-          for (unsigned int column = 0; column < slot->bitmap.width; ++column) {
-            int current_source_offset = source_offset + (column / 8);
-            int source_pixel = slot->bitmap.buffer[current_source_offset];
-            pixels[++target_offset] = ((source_pixel >> (7 - (column % 8))) & 0x1) << 7;
-          }
-        } else
-          memcpy(&pixels[target_offset], &slot->bitmap.buffer[source_offset], slot->bitmap.width);
-      }
+    if (page->glyph_count == page->glyph_capacity) {
+      page->glyph_capacity = page->glyph_capacity ? page->glyph_capacity * 2 : 64;
+      page->glyphs = check_alloc(realloc(page->glyphs, page->glyph_capacity * sizeof(GlyphMetric*)));
+    }
+    page->glyphs[page->glyph_count++] = metric;
+    atlas_mark_dirty(page, y, slot->bitmap.rows);
+  }
+  metric->x0 = x;
+  metric->x1 = x + glyph_width;
+  metric->y0 = y;
+  metric->y1 = y + slot->bitmap.rows;
+  metric->loaded = true;
+  metric->bitmap_left = slot->bitmap_left;
+  metric->bitmap_top = slot->bitmap_top;
+  metric->xadvance = xadvance;
+  // only publish the glyph once it is complete, other threads may be reading it
+  SDL_AtomicSetPtr((void**) &metric->page, page);
+  SDL_AtomicSet(&metric->ready, 1);
+}
+
+static inline size_t glyph_hash(unsigned int codepoint, int subpixel_idx) {
+  uint64_t key = (uint64_t) codepoint * SUBPIXEL_BITMAPS_CACHED + subpixel_idx;
+  return (size_t) ((key * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static GlyphMetric* font_find_glyph(RenFont* font, unsigned int codepoint, int subpixel_idx) {
+  GlyphTable *table = SDL_AtomicGetPtr((void**) &font->glyphs);
+  if (!table)
+    return NULL;
+  for (size_t i = glyph_hash(codepoint, subpixel_idx) & table->mask;; i = (i + 1) & table->mask) {
+    GlyphMetric *metric = SDL_AtomicGetPtr((void**) &table->slots[i]);
+    if (!metric || (metric->codepoint == codepoint && metric->subpixel_idx == subpixel_idx))
+      return metric;
+  }
+}
+
+static void glyph_table_insert(GlyphTable *table, GlyphMetric *metric) {
+  size_t i = glyph_hash(metric->codepoint, metric->subpixel_idx) & table->mask;
+  while (table->slots[i])
+    i = (i + 1) & table->mask;
+  SDL_AtomicSetPtr((void**) &table->slots[i], metric);
+  table->count++;
+}
+
+// adds an empty glyph to the table of the font, must be called with glyph_mutex held
+static GlyphMetric* font_add_glyph(RenFont* font, unsigned int codepoint, int subpixel_idx) {
+  GlyphMetric *metric = font_find_glyph(font, codepoint, subpixel_idx);
+  if (metric)
+    return metric;
+  GlyphTable *table = font->glyphs;
+  // keep the table at most half full
+  if (!table || (table->count + 1) * 2 > table->mask + 1) {
+    size_t size = table ? (table->mask + 1) * 2 : GLYPH_TABLE_INIT_SIZE;
+    GlyphTable *grown = check_alloc(calloc(1, sizeof(GlyphTable) + size * sizeof(GlyphMetric*)));
+    grown->mask = size - 1;
+    if (table) {
+      for (size_t i = 0; i <= table->mask; ++i)
+        if (table->slots[i])
+          glyph_table_insert(grown, table->slots[i]);
+      table->retired_next = retired_glyph_tables;
+      retired_glyph_tables = table;
     }
+    SDL_AtomicSetPtr((void**) &font->glyphs, grown);
+    table = grown;
+  }
+  if (!font->glyph_blocks || font->glyph_blocks->count == GLYPH_BLOCK_SIZE) {
+    GlyphBlock *block = check_alloc(calloc(1, sizeof(GlyphBlock)));
+    block->next = font->glyph_blocks;
+    font->glyph_blocks = block;
   }
+  metric = &font->glyph_blocks->metrics[font->glyph_blocks->count++];
+  metric->codepoint = codepoint;
+  metric->subpixel_idx = subpixel_idx;
+  glyph_table_insert(table, metric);
+  return metric;
 }
 
-static GlyphSet* font_get_glyphset(RenFont* font, unsigned int codepoint, int subpixel_idx) {
-  int idx = (codepoint >> 8) % MAX_LOADABLE_GLYPHSETS;
-  if (!font->sets[font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? subpixel_idx : 0][idx])
-    font_load_glyphset(font, idx);
-  return font->sets[font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? subpixel_idx : 0][idx];
+/* Glyphs are loaded one at a time, the first time they are measured or drawn.
+** When `page` is given the bitmap is also brought back into the atlas if it
+** was evicted, and its page is marked as used in the current frame. */
+static GlyphMetric* font_get_glyph(RenFont* font, unsigned int codepoint, int subpixel_idx, GlyphPage** page) {
+  if (font->antialiasing != FONT_ANTIALIASING_SUBPIXEL)
+    subpixel_idx = 0;
+  GlyphMetric* metric = font_find_glyph(font, codepoint, subpixel_idx);
+  if (!metric || !SDL_AtomicGet(&metric->ready) || (page && glyph_has_bitmap(metric) && !SDL_AtomicGetPtr((void**) &metric->page))) {
+    SDL_LockMutex(glyph_mutex);
+    if (!metric)
+      metric = font_add_glyph(font, codepoint, subpixel_idx);
+    font_load_glyph(font, codepoint, subpixel_idx, metric);
+    SDL_UnlockMutex(glyph_mutex);
+  }
+  if (page) {
+    int frame = SDL_AtomicGet(&glyph_atlas.frame);
+    *page = SDL_AtomicGetPtr((void**) &metric->page);
+    if (*page && SDL_AtomicGet(&(*page)->last_used) != frame)
+      SDL_AtomicSet(&(*page)->last_used, frame);
+  }
+  return metric;
 }
 
-static RenFont* font_group_get_glyph(GlyphSet** set, GlyphMetric** metric, RenFont** fonts, unsigned int codepoint, int bitmap_index) {
+static RenFont* font_group_get_glyph(GlyphMetric** metric, GlyphPage** page, RenFont** fonts, unsigned int codepoint, int bitmap_index) {
   if (!metric) {
     return NULL;
   }
   if (bitmap_index < 0)
     bitmap_index += SUBPIXEL_BITMAPS_CACHED;
   for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
-    *set = font_get_glyphset(fonts[i], codepoint, bitmap_index);
-    *metric = &(*set)->metrics[codepoint % 256];
+    *metric = font_get_glyph(fonts[i], codepoint, bitmap_index, page);
     if ((*metric)->loaded || codepoint < 0xFF)
       return fonts[i];
   }
   if (*metric && !(*metric)->loaded && codepoint > 0xFF && codepoint != 0x25A1)
-    return font_group_get_glyph(set, metric, fonts, 0x25A1, bitmap_index);
+    return font_group_get_glyph(metric, page, fonts, 0x25A1, bitmap_index);
   return fonts[0];
 }
 
 static void font_clear_glyph_cache(RenFont* font) {
-  for (int i = 0; i < SUBPIXEL_BITMAPS_CACHED; ++i) {
-    for (int j = 0; j < MAX_GLYPHSET; ++j) {
-      if (font->sets[i][j]) {
-        if (font->sets[i][j]->surface)
-          SDL_FreeSurface(font->sets[i][j]->surface);
-        free(font->sets[i][j]);
-        font->sets[i][j] = NULL;
-      }
-    }
+  width_cache.generation++;
+  for (GlyphPage *page = glyph_atlas.pages, *next; page; page = next) {
+    next = page->next;
+    if (page->font == font)
+      atlas_free_page(page);
+  }
+  free(font->glyphs);
+  font->glyphs = NULL;
+  for (GlyphBlock *block = font->glyph_blocks, *next; block; block = next) {
+    next = block->next;
+    free(block);
   }
+  font->glyph_blocks = NULL;
 }
 
 RenFont* ren_font_load(RenWindow *window_renderer, const char* path, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style) {
@@ -527,14 +795,12 @@ int ren_font_get_metadata(
 }
 
 void ren_font_group_set_tab_size(RenFont **fonts, int n) {
-  for (int j = 0; j < FONT_FALLBACK_MAX && fonts[j]; ++j) {
-    for (int i = 0; i < (fonts[j]->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? SUBPIXEL_BITMAPS_CACHED : 1); ++i)
-      font_get_glyphset(fonts[j], '\t', i)->metrics['\t'].xadvance = fonts[j]->space_advance * n;
-  }
+  for (int j = 0; j < FONT_FALLBACK_MAX && fonts[j]; ++j)
+    fonts[j]->tab_advance = fonts[j]->space_advance * n;
 }
 
 int ren_font_group_get_tab_size(RenFont **fonts) {
-  float advance = font_get_glyphset(fonts[0], '\t', 0)->metrics['\t'].xadvance;
+  float advance = fonts[0]->tab_advance;
   if (fonts[0]->space_advance) {
     advance /= fonts[0]->space_advance;
   }
@@ -555,8 +821,9 @@ void ren_font_group_set_size(RenWindow *window_renderer, RenFont **fonts, float
     fonts[i]->height = (short)((face->height / (float)face->units_per_EM) * size);
     fonts[i]->baseline = (short)((face->ascender / (float)face->units_per_EM) * size);
     FT_Load_Char(face, ' ', font_set_load_options(fonts[i]));
+    float tab_size = fonts[i]->space_advance ? fonts[i]->tab_advance / fonts[i]->space_advance : 2;
     fonts[i]->space_advance = face->glyph->advance.x / 64.0f;
-    fonts[i]->tab_advance = fonts[i]->space_advance * 2;
+    fonts[i]->tab_advance = fonts[i]->space_advance * tab_size;
   }
 }
 
@@ -564,34 +831,232 @@ int ren_font_group_get_height(RenFont **fonts) {
   return fonts[0]->height;
 }
 
-double ren_font_group_get_width(RenWindow *window_renderer, RenFont **fonts, const char *text, size_t len) {
+static uint64_t width_cache_hash(RenFont **fonts, float tab_advance, double scale, const char *text, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i)
+    h = (h ^ (unsigned char) text[i]) * 1099511628211ULL;
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i)
+    h = (h ^ (uintptr_t) fonts[i]) * 1099511628211ULL;
+  h = (h ^ (uint64_t) (tab_advance * 64)) * 1099511628211ULL;
+  return (h ^ (uint64_t) (scale * 64)) * 1099511628211ULL;
+}
+
+static bool width_cache_match(WidthCacheEntry *entry, uint64_t hash, RenFont **fonts, float tab_advance, double scale, const char *text, size_t len) {
+  if (entry->generation != width_cache.generation || entry->hash != hash || entry->len != len
+    || entry->tab_advance != tab_advance || entry->scale != scale || memcmp(entry->text, text, len))
+    return false;
+  for (int i = 0; i < FONT_FALLBACK_MAX; ++i) {
+    if (entry->fonts[i] != fonts[i])
+      return false;
+    if (!fonts[i])
+      break;
+  }
+  return true;
+}
+
+/* Returns the widths of every prefix of the text, one per codepoint. Results
+** are cached per font group, tab size and text, as the docview measures the
+** same tokens over and over. */
+static WidthCacheEntry* font_group_get_prefix_widths(RenWindow *window_renderer, RenFont **fonts, const char *text, size_t len) {
+  const double surface_scale = renwin_get_surface(window_renderer).scale_x;
+  const float tab_advance = fonts[0]->tab_advance;
+  uint64_t hash = width_cache_hash(fonts, tab_advance, surface_scale, text, len);
+  WidthCacheEntry *entry = len <= WIDTH_CACHE_MAX_LEN ? &width_cache.entries[hash % WIDTH_CACHE_SIZE] : &width_cache.scratch;
+  if (width_cache_match(entry, hash, fonts, tab_advance, surface_scale, text, len))
+    return entry;
+
+  /* entries are sized to their text, so that a slot which held a long line
+  ** doesn't keep its buffers, and all of them stay within a budget */
+  size_t capacity = entry == &width_cache.scratch ? (len + 1 > entry->capacity ? len + 1 : entry->capacity)
+    : (len / WIDTH_CACHE_ALIGN + 1) * WIDTH_CACHE_ALIGN;
+  if (entry != &width_cache.scratch && capacity != entry->capacity) {
+    size_t bytes = width_cache.bytes - entry->capacity * (1 + sizeof(double)) + capacity * (1 + sizeof(double));
+    if (capacity > entry->capacity && bytes > WIDTH_CACHE_MAX_BYTES) {
+      entry = &width_cache.scratch;
+      capacity = len + 1 > entry->capacity ? len + 1 : entry->capacity;
+    } else {
+      width_cache.bytes = bytes;
+    }
+  }
+  if (entry->capacity != capacity) {
+    entry->capacity = capacity;
+    entry->text = check_alloc(realloc(entry->text, entry->capacity));
+    entry->widths = check_alloc(realloc(entry->widths, entry->capacity * sizeof(double)));
+  }
+  memcpy(entry->text, text, len);
+  entry->len = len;
+  entry->hash = hash;
+  entry->generation = width_cache.generation;
+  entry->tab_advance = tab_advance;
+  entry->scale = surface_scale;
+  for (int i = 0; i < FONT_FALLBACK_MAX; ++i)
+    entry->fonts[i] = fonts[i];
+
   double width = 0;
   const char* end = text + len;
-  GlyphMetric* metric = NULL; GlyphSet* set = NULL;
+  GlyphMetric* metric = NULL;
+  entry->count = 0;
   while (text < end) {
     unsigned int codepoint;
     text = utf8_to_codepoint(text, &codepoint);
-    RenFont* font = font_group_get_glyph(&set, &metric, fonts, codepoint, 0);
+    RenFont* font = font_group_get_glyph(&metric, NULL, fonts, codepoint, 0);
     if (!metric)
       break;
-    width += (!font || metric->xadvance) ? metric->xadvance : fonts[0]->space_advance;
+    if (codepoint == '\t')
+      width += tab_advance;
+    else
+      width += (!font || metric->xadvance) ? metric->xadvance : fonts[0]->space_advance;
+    entry->widths[entry->count++] = width / surface_scale;
   }
-  const double surface_scale = renwin_get_surface(window_renderer).scale_x;
-  return width / surface_scale;
+  return entry;
 }
 
-double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, float y, RenColor color) {
-  SDL_Surface *surface = rs->surface;
+double ren_font_group_get_width(RenWindow *window_renderer, RenFont **fonts, const char *text, size_t len) {
+  WidthCacheEntry *entry = font_group_get_prefix_widths(window_renderer, fonts, text, len);
+  return entry->count > 0 ? entry->widths[entry->count - 1] : 0;
+}
+
+int ren_font_group_get_prefix_widths(RenWindow *window_renderer, RenFont **fonts, const char *text, size_t len, const double **widths) {
+  WidthCacheEntry *entry = font_group_get_prefix_widths(window_renderer, fonts, text, len);
+  *widths = entry->widths;
+  return entry->count;
+}
+
+void ren_set_glyph_cache_size(size_t size) {
+  glyph_atlas.budget = size;
+}
+
+void ren_glyph_cache_end_frame(void) {
+  // pages drawn during the frame that just ended are kept even over budget
+  int frame = SDL_AtomicGet(&glyph_atlas.frame);
+  while (glyph_atlas.size > glyph_atlas.budget) {
+    GlyphPage *lru = NULL;
+    for (GlyphPage *page = glyph_atlas.pages; page; page = page->next) {
+      unsigned age = frame - SDL_AtomicGet(&page->last_used);
+      if (age > 0 && (!lru || age > (unsigned) (frame - SDL_AtomicGet(&lru->last_used))))
+        lru = page;
+    }
+    if (!lru)
+      break;
+    atlas_free_page(lru);
+  }
+  SDL_LockMutex(glyph_mutex);
+  for (GlyphTable *table = retired_glyph_tables, *next; table; table = next) {
+    next = table->retired_next;
+    free(table);
+  }
+  retired_glyph_tables = NULL;
+  SDL_UnlockMutex(glyph_mutex);
+  SDL_AtomicIncRef(&glyph_atlas.frame);
+}
+
+static void get_clip_rect(RenSurface *rs, SDL_Rect *clip) {
+  if (!rs->renderer) {
+    SDL_GetClipRect(rs->surface, clip);
+    return;
+  }
+  SDL_RenderGetClipRect(rs->renderer, clip);
+  if (!SDL_RenderIsClipEnabled(rs->renderer)) {
+    *clip = (SDL_Rect){ 0 };
+    SDL_GetRendererOutputSize(rs->renderer, &clip->w, &clip->h);
+  }
+}
+
+static void draw_glyph_surface(SDL_Surface *surface, SDL_Rect clip, RenFont *font, GlyphPage *page, GlyphMetric *metric,
+                               int start_x, float y, double surface_scale_y, RenColor color) {
+  int bytes_per_pixel = surface->format->BytesPerPixel;
+  uint8_t* destination_pixels = surface->pixels;
+  int clip_end_x = clip.x + clip.w, clip_end_y = clip.y + clip.h;
+  int glyph_end = metric->x1, glyph_start = metric->x0;
+  unsigned int r, g, b;
+
+  // the vectorized path needs 32 bit pixels with byte aligned color channels
+  SDL_PixelFormat *format = surface->format;
+  bool vectorized = blend_span && is_byte_aligned_32bpp(format);
+  uint32_t color_word = (uint32_t) color.r << format->Rshift | (uint32_t) color.g << format->Gshift | (uint32_t) color.b << format->Bshift;
+  uint32_t coverage[BLEND_SPAN_MAX];
+
+  uint8_t* source_pixels = page->surface->pixels;
+  for (int line = metric->y0; line < metric->y1; ++line) {
+    int target_y = line - metric->y0 + y - metric->bitmap_top + font->baseline * surface_scale_y;
+    if (target_y < clip.y)
+      continue;
+    if (target_y >= clip_end_y)
+      break;
+    if (start_x + (glyph_end - glyph_start) >= clip_end_x)
+      glyph_end = glyph_start + (clip_end_x - start_x);
+    if (start_x < clip.x) {
+      int offset = clip.x - start_x;
+      start_x += offset;
+      glyph_start += offset;
+    }
+    uint32_t* destination_pixel = (uint32_t*)&(destination_pixels[surface->pitch * target_y + start_x * bytes_per_pixel]);
+    uint8_t* source_pixel = &source_pixels[line * page->surface->pitch + glyph_start * (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 3 : 1)];
+    if (vectorized) {
+      for (int x = glyph_start; x < glyph_end; x += BLEND_SPAN_MAX) {
+        int count = glyph_end - x < BLEND_SPAN_MAX ? glyph_end - x : BLEND_SPAN_MAX;
+        for (int i = 0; i < count; ++i) {
+          uint32_t src_r = *source_pixel, src_g = *source_pixel, src_b = *source_pixel;
+          if (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL) {
+            src_g = source_pixel[1];
+            src_b = source_pixel[2];
+            source_pixel += 2;
+          }
+          source_pixel++;
+          coverage[i] = src_r << format->Rshift | src_g << format->Gshift | src_b << format->Bshift;
+        }
+        blend_span(destination_pixel, coverage, count, color_word, color.a);
+        destination_pixel += count;
+      }
+      continue;
+    }
+    // scalar fallback
+    for (int x = glyph_start; x < glyph_end; ++x) {
+      uint32_t destination_color = *destination_pixel;
+      // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
+      SDL_Color dst = { (destination_color & surface->format->Rmask) >> surface->format->Rshift, (destination_color & surface->format->Gmask) >> surface->format->Gshift, (destination_color & surface->format->Bmask) >> surface->format->Bshift, (destination_color & surface->format->Amask) >> surface->format->Ashift };
+      SDL_Color src;
+
+      if (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL) {
+        src.r = *(source_pixel++);
+        src.g = *(source_pixel++);
+      }
+      else  {
+        src.r = *(source_pixel);
+        src.g = *(source_pixel);
+      }
+
+      src.b = *(source_pixel++);
+      src.a = 0xFF;
+
+      r = (color.r * src.r * color.a + dst.r * (65025 - src.r * color.a) + 32767) / 65025;
+      g = (color.g * src.g * color.a + dst.g * (65025 - src.g * color.a) + 32767) / 65025;
+      b = (color.b * src.b * color.a + dst.b * (65025 - src.b * color.a) + 32767) / 65025;
+      // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
+      *destination_pixel++ = dst.a << surface->format->Ashift | r << surface->format->Rshift | g << surface->format->Gshift | b << surface->format->Bshift;
+    }
+  }
+}
+
+static void draw_glyph_renderer(SDL_Renderer *renderer, GlyphPage *page, GlyphMetric *metric, int x, int y, RenColor color) {
+  SDL_Texture *texture = atlas_get_texture(page, renderer);
+  if (!texture)
+    return;
+  int w = metric->x1 - metric->x0, h = metric->y1 - metric->y0;
+  SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+  SDL_SetTextureAlphaMod(texture, color.a);
+  SDL_RenderCopy(renderer, texture, &(SDL_Rect){ metric->x0, metric->y0, w, h }, &(SDL_Rect){ x, y, w, h });
+}
+
+double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, float y, RenColor color, int tab_size) {
   SDL_Rect clip;
-  SDL_GetClipRect(surface, &clip);
+  get_clip_rect(rs, &clip);
 
   const double surface_scale_x = rs->scale_x, surface_scale_y = rs->scale_y;
   double pen_x = x * surface_scale_x;
   y *= surface_scale_y;
-  int bytes_per_pixel = surface->format->BytesPerPixel;
   const char* end = text + len;
-  uint8_t* destination_pixels = surface->pixels;
-  int clip_end_x = clip.x + clip.w, clip_end_y = clip.y + clip.h;
+  int clip_end_x = clip.x + clip.w;
 
   RenFont* last = NULL;
   double last_pen_x = x;
@@ -599,62 +1064,26 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
   bool strikethrough = fonts[0]->style & FONT_STYLE_STRIKETHROUGH;
 
   while (text < end) {
-    unsigned int codepoint, r, g, b;
+    unsigned int codepoint;
     text = utf8_to_codepoint(text, &codepoint);
-    GlyphSet* set = NULL; GlyphMetric* metric = NULL;
-    RenFont* font = font_group_get_glyph(&set, &metric, fonts, codepoint, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED));
+    GlyphPage* page = NULL; GlyphMetric* metric = NULL;
+    RenFont* font = font_group_get_glyph(&metric, &page, fonts, codepoint, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED));
     if (!metric)
       break;
     int start_x = floor(pen_x) + metric->bitmap_left;
     int end_x = (metric->x1 - metric->x0) + start_x;
-    int glyph_end = metric->x1, glyph_start = metric->x0;
     if (!metric->loaded && codepoint > 0xFF)
       ren_draw_rect(rs, (RenRect){ start_x + 1, y, font->space_advance - 1, ren_font_group_get_height(fonts) }, color);
-    if (set->surface && color.a > 0 && end_x >= clip.x && start_x < clip_end_x) {
-      uint8_t* source_pixels = set->surface->pixels;
-      for (int line = metric->y0; line < metric->y1; ++line) {
-        int target_y = line + y - metric->bitmap_top + font->baseline * surface_scale_y;
-        if (target_y < clip.y)
-          continue;
-        if (target_y >= clip_end_y)
-          break;
-        if (start_x + (glyph_end - glyph_start) >= clip_end_x)
-          glyph_end = glyph_start + (clip_end_x - start_x);
-        if (start_x < clip.x) {
-          int offset = clip.x - start_x;
-          start_x += offset;
-          glyph_start += offset;
-        }
-        uint32_t* destination_pixel = (uint32_t*)&(destination_pixels[surface->pitch * target_y + start_x * bytes_per_pixel]);
-        uint8_t* source_pixel = &source_pixels[line * set->surface->pitch + glyph_start * (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 3 : 1)];
-        for (int x = glyph_start; x < glyph_end; ++x) {
-          uint32_t destination_color = *destination_pixel;
-          // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
-          SDL_Color dst = { (destination_color & surface->format->Rmask) >> surface->format->Rshift, (destination_color & surface->format->Gmask) >> surface->format->Gshift, (destination_color & surface->format->Bmask) >> surface->format->Bshift, (destination_color & surface->format->Amask) >> surface->format->Ashift };
-          SDL_Color src;
-
-          if (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL) {
-            src.r = *(source_pixel++);
-            src.g = *(source_pixel++);
-          }
-          else  {
-            src.r = *(source_pixel);
-            src.g = *(source_pixel);
-          }
-
-          src.b = *(source_pixel++);
-          src.a = 0xFF;
-
-          r = (color.r * src.r * color.a + dst.r * (65025 - src.r * color.a) + 32767) / 65025;
-          g = (color.g * src.g * color.a + dst.g * (65025 - src.g * color.a) + 32767) / 65025;
-          b = (color.b * src.b * color.a + dst.b * (65025 - src.b * color.a) + 32767) / 65025;
-          // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
-          *destination_pixel++ = dst.a << surface->format->Ashift | r << surface->format->Rshift | g << surface->format->Gshift | b << surface->format->Bshift;
-        }
-      }
+    if (page && color.a > 0 && end_x >= clip.x && start_x < clip_end_x) {
+      if (rs->renderer)
+        draw_glyph_renderer(rs->renderer, page, metric, start_x, y - metric->bitmap_top + font->baseline * surface_scale_y, color);
+      else
+        draw_glyph_surface(rs->surface, clip, font, page, metric, start_x, y, surface_scale_y, color);
     }
 
-    float adv = metric->xadvance ? metric->xadvance : font->space_advance;
+    // the tab size is passed explicitly as the fonts may be shared with other threads
+    float adv = codepoint == '\t' ? font->space_advance * tab_size
+      : metric->xadvance ? metric->xadvance : font->space_advance;
 
     if(!last) last = font;
     else if(font != last || text == end) {
@@ -693,6 +1122,13 @@ void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
                          rect.width * surface_scale_x,
                          rect.height * surface_scale_y };
 
+  if (rs->renderer) {
+    SDL_SetRenderDrawBlendMode(rs->renderer, color.a == 0xff ? SDL_BLENDMODE_NONE : SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(rs->renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderFillRect(rs->renderer, &dest_rect);
+    return;
+  }
+
   if (color.a == 0xff) {
     uint32_t translated = SDL_MapRGB(surface->format, color.r, color.g, color.b);
     SDL_FillRect(surface, &dest_rect, translated);
@@ -703,21 +1139,73 @@ void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
     SDL_GetClipRect(surface, &clip);
     if (!SDL_IntersectRect(&clip, &dest_rect, &dest_rect)) return;
 
+    SDL_PixelFormat *format = surface->format;
+    if (is_byte_aligned_32bpp(format)) {
+      // blend in place, draw_rect_surface can't be shared between threads
+      RenBlendSpan blend = blend_span ? blend_span : ren_blend_span_scalar;
+      uint32_t coverage[BLEND_SPAN_MAX];
+      uint32_t color_word = (uint32_t) color.r << format->Rshift | (uint32_t) color.g << format->Gshift | (uint32_t) color.b << format->Bshift;
+      uint32_t full = 0xFFu << format->Rshift | 0xFFu << format->Gshift | 0xFFu << format->Bshift;
+      for (int i = 0; i < BLEND_SPAN_MAX && i < dest_rect.w; ++i)
+        coverage[i] = full;
+      for (int y = dest_rect.y; y < dest_rect.y + dest_rect.h; ++y) {
+        uint32_t *row = (uint32_t*) ((uint8_t*) surface->pixels + y * surface->pitch) + dest_rect.x;
+        for (int x = 0; x < dest_rect.w; x += BLEND_SPAN_MAX)
+          blend(row + x, coverage, dest_rect.w - x < BLEND_SPAN_MAX ? dest_rect.w - x : BLEND_SPAN_MAX, color_word, color.a);
+      }
+      return;
+    }
+
     uint32_t *pixel = (uint32_t *)draw_rect_surface->pixels;
     *pixel = SDL_MapRGBA(draw_rect_surface->format, color.r, color.g, color.b, color.a);
     SDL_BlitScaled(draw_rect_surface, NULL, surface, &dest_rect);
   }
 }
 
+bool ren_scroll_rect(RenSurface *rs, RenRect rect, int dx, int dy) {
+  SDL_Surface *surface = rs->surface;
+  // a render target can't be copied onto itself, the area is redrawn instead
+  if (!surface)
+    return false;
+  // only whole pixel moves can be done in place
+  const double pixel_dx = dx * rs->scale_x, pixel_dy = dy * rs->scale_y;
+  if (pixel_dx != (int) pixel_dx || pixel_dy != (int) pixel_dy)
+    return false;
+
+  SDL_Rect src = { rect.x * rs->scale_x, rect.y * rs->scale_y, rect.width * rs->scale_x, rect.height * rs->scale_y };
+  SDL_Rect bounds = { 0, 0, surface->w, surface->h };
+  if (!SDL_IntersectRect(&src, &bounds, &src))
+    return true;
+  SDL_Rect dst = { src.x + pixel_dx, src.y + pixel_dy, src.w, src.h };
+  if (!SDL_IntersectRect(&src, &dst, &dst))
+    return true;
+
+  int bytes_per_pixel = surface->format->BytesPerPixel;
+  int row_size = dst.w * bytes_per_pixel;
+  uint8_t *pixels = surface->pixels;
+  // walk the rows against the move so that they are read before being overwritten
+  for (int i = 0; i < dst.h; ++i) {
+    int y = pixel_dy > 0 ? dst.y + dst.h - 1 - i : dst.y + i;
+    memmove(pixels + y * surface->pitch + dst.x * bytes_per_pixel,
+      pixels + (y - (int) pixel_dy) * surface->pitch + (dst.x - (int) pixel_dx) * bytes_per_pixel, row_size);
+  }
+  return true;
+}
+
 /*************** Window Management ****************/
 void ren_free_window_resources(RenWindow *window_renderer) {
-  extern uint8_t *command_buf;
-  extern size_t command_buf_size;
+  extern uint8_t *command_buf, *prev_command_buf;
+  extern size_t command_buf_size, prev_command_buf_size;
+  // the glyph textures belong to the renderer destroyed along with the window
+  atlas_drop_textures();
   renwin_free(window_renderer);
   SDL_FreeSurface(draw_rect_surface);
   free(command_buf);
   command_buf = NULL;
   command_buf_size = 0;
+  free(prev_command_buf);
+  prev_command_buf = NULL;
+  prev_command_buf_size = 0;
 }
 
 // TODO remove global and return RenWindow*
@@ -733,6 +1221,8 @@ void ren_init(SDL_Window *win) {
   renwin_clip_to_surface(&window_renderer);
   draw_rect_surface = SDL_CreateRGBSurface(0, 1, 1, 32,
                        0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+  blend_span = ren_blend_get_span();
+  glyph_mutex = SDL_CreateMutex();
 }
 
 
@@ -741,6 +1231,17 @@ void ren_resize_window(RenWindow *window_renderer) {
 }
 
 
+/* The render device was reset, which loses the content of every texture:
+** the glyph pages are uploaded again and the window target is recreated. */
+void ren_reset_textures(RenWindow *window_renderer) {
+  SDL_LockMutex(glyph_mutex);
+  atlas_drop_textures();
+  SDL_UnlockMutex(glyph_mutex);
+  renwin_init_surface(window_renderer);
+  renwin_clip_to_surface(window_renderer);
+}
+
+
 void ren_update_rects(RenWindow *window_renderer, RenRect *rects, int count) {
   static bool initial_frame = true;
   if (initial_frame) {
@@ -758,8 +1259,13 @@ void ren_set_clip_rect(RenWindow *window_renderer, RenRect rect) {
 
 void ren_get_size(RenWindow *window_renderer, int *x, int *y) {
   RenSurface rs = renwin_get_surface(window_renderer);
-  *x = rs.surface->w / rs.scale_x;
-  *y = rs.surface->h / rs.scale_y;
+  int w, h;
+  if (rs.renderer)
+    SDL_GetRendererOutputSize(rs.renderer, &w, &h);
+  else
+    w = rs.surface->w, h = rs.surface->h;
+  *x = w / rs.scale_x;
+  *y = h / rs.scale_y;
 }
 
 
@@ -25,7 +25,8 @@ typedef enum { FONT_STYLE_BOLD = 1, FONT_STYLE_ITALIC = 2, FONT_STYLE_UNDERLINE
 typedef enum { FONT_FAMILY, FONT_SUBFAMILY, FONT_ID, FONT_FULLNAME, FONT_VERSION, FONT_PSNAME, FONT_TFAMILY, FONT_TSUBFAMILY, FONT_WWSFAMILY, FONT_WWSSUBFAMILY } EFontMetaTag;
 typedef struct { uint8_t b, g, r, a; } RenColor;
 typedef struct { RECT_TYPE x, y, width, height; } RenRect;
-typedef struct { SDL_Surface *surface; double scale_x, scale_y; } RenSurface;
+/* Drawing goes to `surface`, or through `renderer` when the window draws on the GPU. */
+typedef struct { SDL_Surface *surface; SDL_Renderer *renderer; double scale_x, scale_y; } RenSurface;
 typedef struct { EFontMetaTag tag; char *value; size_t len; } FontMetaData;
 
 struct RenWindow;
@@ -43,12 +44,17 @@ float ren_font_group_get_size(RenFont **font);
 void ren_font_group_set_size(RenWindow *window_renderer, RenFont **font, float size);
 void ren_font_group_set_tab_size(RenFont **font, int n);
 double ren_font_group_get_width(RenWindow *window_renderer, RenFont **font, const char *text, size_t len);
-double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, float y, RenColor color);
+int ren_font_group_get_prefix_widths(RenWindow *window_renderer, RenFont **font, const char *text, size_t len, const double **widths);
+void ren_set_glyph_cache_size(size_t size);
+void ren_glyph_cache_end_frame(void);
+double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, float y, RenColor color, int tab_size);
 
 void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color);
+bool ren_scroll_rect(RenSurface *rs, RenRect rect, int dx, int dy);
 
 void ren_init(SDL_Window *win);
 void ren_resize_window(RenWindow *window_renderer);
+void ren_reset_textures(RenWindow *window_renderer);
 void ren_update_rects(RenWindow *window_renderer, RenRect *rects, int count);
 void ren_set_clip_rect(RenWindow *window_renderer, RenRect rect);
 void ren_get_size(RenWindow *window_renderer, int *x, int *y); /* Reports the size in points. */
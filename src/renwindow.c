@@ -14,16 +14,45 @@ static void update_surface_scale(RenWindow *ren) {
   ren->rensurface.scale_y = round(scaleY * 100) / 100;
 }
 
+static void create_renderer(RenWindow *ren) {
+  if (ren->renderer)
+    return;
+#ifdef LITE_USE_GPU_RENDERER
+  /* Prefer a hardware renderer; the software one keeps working without a GPU.
+     Both need render targets, as the window content is kept in a texture. */
+  ren->renderer = SDL_CreateRenderer(ren->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+  if (!ren->renderer)
+    ren->renderer = SDL_CreateRenderer(ren->window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+  if (ren->renderer && SDL_RenderTargetSupported(ren->renderer)) {
+    ren->rensurface.renderer = ren->renderer;
+    return;
+  }
+  fprintf(stderr, "Warning: (" __FILE__ "): no renderer with render targets, drawing on the CPU instead: %s\n", SDL_GetError());
+#endif
+  if (!ren->renderer)
+    ren->renderer = SDL_CreateRenderer(ren->window, -1, 0);
+}
+
 static void setup_renderer(RenWindow *ren, int w, int h) {
   /* Note that w and h here should always be in pixels and obtained from
      a call to SDL_GL_GetDrawableSize(). */
-  if (!ren->renderer) {
-    ren->renderer = SDL_CreateRenderer(ren->window, -1, 0);
-  }
   if (ren->texture) {
     SDL_DestroyTexture(ren->texture);
   }
-  ren->texture = SDL_CreateTexture(ren->renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING, w, h);
+  if (ren->rensurface.renderer) {
+    /* Frames are drawn into a persistent target texture, so that only the
+       dirty rects need to be redrawn. */
+    ren->texture = SDL_CreateTexture(ren->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+    if (!ren->texture) {
+      fprintf(stderr, "Error creating render target: %s", SDL_GetError());
+      exit(1);
+    }
+    SDL_SetRenderTarget(ren->renderer, ren->texture);
+    SDL_SetRenderDrawColor(ren->renderer, 0, 0, 0, 0xff);
+    SDL_RenderClear(ren->renderer);
+  } else {
+    ren->texture = SDL_CreateTexture(ren->renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING, w, h);
+  }
   update_surface_scale(ren);
 }
 #endif
@@ -33,13 +62,17 @@ void renwin_init_surface(UNUSED RenWindow *ren) {
 #ifdef LITE_USE_SDL_RENDERER
   if (ren->rensurface.surface) {
     SDL_FreeSurface(ren->rensurface.surface);
+    ren->rensurface.surface = NULL;
   }
   int w, h;
   SDL_GL_GetDrawableSize(ren->window, &w, &h);
-  ren->rensurface.surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_BGRA32);
-  if (!ren->rensurface.surface) {
-    fprintf(stderr, "Error creating surface: %s", SDL_GetError());
-    exit(1);
+  create_renderer(ren);
+  if (!ren->rensurface.renderer) {
+    ren->rensurface.surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_BGRA32);
+    if (!ren->rensurface.surface) {
+      fprintf(stderr, "Error creating surface: %s", SDL_GetError());
+      exit(1);
+    }
   }
   setup_renderer(ren, w, h);
 #endif
@@ -64,14 +97,22 @@ static RenRect scaled_rect(const RenRect rect, const RenSurface *rs) {
 
 
 void renwin_clip_to_surface(RenWindow *ren) {
-  SDL_SetClipRect(renwin_get_surface(ren).surface, NULL);
+  RenSurface rs = renwin_get_surface(ren);
+  if (rs.renderer)
+    SDL_RenderSetClipRect(rs.renderer, NULL);
+  else
+    SDL_SetClipRect(rs.surface, NULL);
 }
 
 
 void renwin_set_clip_rect(RenWindow *ren, RenRect rect) {
   RenSurface rs = renwin_get_surface(ren);
   RenRect sr = scaled_rect(rect, &rs);
-  SDL_SetClipRect(rs.surface, &(SDL_Rect){.x = sr.x, .y = sr.y, .w = sr.width, .h = sr.height});
+  SDL_Rect clip = {.x = sr.x, .y = sr.y, .w = sr.width, .h = sr.height};
+  if (rs.renderer)
+    SDL_RenderSetClipRect(rs.renderer, &clip);
+  else
+    SDL_SetClipRect(rs.surface, &clip);
 }
 
 
@@ -90,13 +131,13 @@ RenSurface renwin_get_surface(RenWindow *ren) {
 
 void renwin_resize_surface(UNUSED RenWindow *ren) {
 #ifdef LITE_USE_SDL_RENDERER
-  int new_w, new_h;
+  int w, h, new_w, new_h;
   SDL_GL_GetDrawableSize(ren->window, &new_w, &new_h);
+  SDL_QueryTexture(ren->texture, NULL, NULL, &w, &h);
   /* Note that (w, h) may differ from (new_w, new_h) on retina displays. */
-  if (new_w != ren->rensurface.surface->w || new_h != ren->rensurface.surface->h) {
+  if (new_w != w || new_h != h) {
     renwin_init_surface(ren);
     renwin_clip_to_surface(ren);
-    setup_renderer(ren, new_w, new_h);
   }
 #endif
 }
@@ -107,6 +148,14 @@ void renwin_show_window(RenWindow *ren) {
 
 void renwin_update_rects(RenWindow *ren, RenRect *rects, int count) {
 #ifdef LITE_USE_SDL_RENDERER
+  if (ren->rensurface.renderer) {
+    /* the dirty rects were already drawn into the target texture */
+    SDL_SetRenderTarget(ren->renderer, NULL);
+    SDL_RenderCopy(ren->renderer, ren->texture, NULL, NULL);
+    SDL_RenderPresent(ren->renderer);
+    SDL_SetRenderTarget(ren->renderer, ren->texture);
+    return;
+  }
   const double scale_x = ren->rensurface.scale_x;
   const double scale_y = ren->rensurface.scale_y;
   for (int i = 0; i < count; i++) {